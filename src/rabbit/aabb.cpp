@@ -31,35 +31,6 @@ const Interval& AxisAlignedBoundingBox::GetAxisInterval(int axis) const {
     return x;
 }
 
-bool AxisAlignedBoundingBox::Hit(const Ray& r, Interval ray_time_interval) const {
-    auto&& edp = r.GetEndpoint();
-    auto&& dir = r.GetDirection();
-
-    // traverse all three axis to check t-interval overlap
-    for (int axis = 0; axis < 3; axis++) {
-        auto&& axis_interval = GetAxisInterval(axis);
-        double axis_direction_inv = 1.0 / dir[axis];
-
-        double t0 = (axis_interval.GetMin()-edp[axis]) * axis_direction_inv;
-        double t1 = (axis_interval.GetMax()-edp[axis]) * axis_direction_inv;
-
-        // deal with corner case: direction component on axis equals zero (contains +infty/-infty)
-        if (t0 < t1) {
-            // try to shrink interval
-            if (t0 > ray_time_interval.GetMin()) { ray_time_interval.SetMin(t0); }
-            if (t1 < ray_time_interval.GetMax()) { ray_time_interval.SetMax(t1); }
-        } else {
-            if (t1 > ray_time_interval.GetMin()) { ray_time_interval.SetMin(t1); }
-            if (t0 < ray_time_interval.GetMax()) { ray_time_interval.SetMax(t0); }
-        }
-
-        if (ray_time_interval.GetMax() <= ray_time_interval.GetMin()) {
-            return false;
-        }
-    }
-    return true;
-}
-
 int AxisAlignedBoundingBox::LongestAxis() const {
     if (x.Size() > y.Size()) {
         return x.Size() > z.Size() ? 0 : 2;
@@ -68,6 +39,16 @@ int AxisAlignedBoundingBox::LongestAxis() const {
     }
 }
 
+double AxisAlignedBoundingBox::SurfaceArea() const {
+    double dx = x.Size();
+    double dy = y.Size();
+    double dz = z.Size();
+    if (dx < 0 || dy < 0 || dz < 0) {
+        return 0;
+    }
+    return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
 void AxisAlignedBoundingBox::PadToMinimums(double delta) {
     if (x.Size() < delta) {
         x = x.Expand(delta);
@@ -80,8 +61,14 @@ void AxisAlignedBoundingBox::PadToMinimums(double delta) {
     }
 }
 
-const AxisAlignedBoundingBox AxisAlignedBoundingBox::empty    = AxisAlignedBoundingBox(Interval::empty,    Interval::empty,    Interval::empty);
-const AxisAlignedBoundingBox AxisAlignedBoundingBox::universe = AxisAlignedBoundingBox(Interval::universe, Interval::universe, Interval::universe);
+// NOTE: built from kInfinity rather than Interval::empty/universe, which live in another translation unit
+// and may not be initialized yet when these constants are (static initialization order)
+const AxisAlignedBoundingBox AxisAlignedBoundingBox::empty    = AxisAlignedBoundingBox(Interval(+kInfinity, -kInfinity),
+                                                                                       Interval(+kInfinity, -kInfinity),
+                                                                                       Interval(+kInfinity, -kInfinity));
+const AxisAlignedBoundingBox AxisAlignedBoundingBox::universe = AxisAlignedBoundingBox(Interval(-kInfinity, +kInfinity),
+                                                                                       Interval(-kInfinity, +kInfinity),
+                                                                                       Interval(-kInfinity, +kInfinity));
 
 AxisAlignedBoundingBox operator+(const AxisAlignedBoundingBox& bbox, const Vec3& offset) {
     return AxisAlignedBoundingBox(bbox.x+offset.X(), bbox.y+offset.Y(), bbox.z+offset.Z());
@@ -3,6 +3,7 @@
 /*
 Class AxisAlignedBoundingBox
 reference: https://github.com/RayTracing/raytracing.github.io/blob/release/src/TheNextWeek
+           https://jcgt.org/published/0002/02/02/ (Ize, Robust BVH Ray Traversal)
 */
 
 #include "rabbit/mathtools.h"
@@ -12,6 +13,21 @@ namespace gplay {
 
 namespace rabbit {
 
+// Widens the far distance of the slab test by 1 + 2 gamma(3), gamma(n) = n u / (1 - n u) with the unit roundoff u:
+// the rounding errors of a distance stay below that bound, so a box the ray touches is never culled
+const double kSlabFarScale = 1 + 2 * (3 * 0.5 * std::numeric_limits<double>::epsilon())
+                                   / (1 - 3 * 0.5 * std::numeric_limits<double>::epsilon());
+
+// ClipToSlab narrows [tmin, tmax] to the distances where the ray lies between the two planes of one axis
+// near_plane is the one the ray enters through, see Ray::IsDirectionNegative. Without branches: min and max
+// keep the interval for the NaN distance of a ray lying in a plane and parallel to it
+inline void ClipToSlab(double near_plane, double far_plane, double origin, double inv_dir, double& tmin, double& tmax) {
+    double t0 = (near_plane - origin) * inv_dir;
+    double t1 = (far_plane - origin) * inv_dir * kSlabFarScale;
+    tmin = t0 > tmin ? t0 : tmin;
+    tmax = t1 < tmax ? t1 : tmax;
+}
+
 class AxisAlignedBoundingBox {
 public:
     AxisAlignedBoundingBox();
@@ -27,11 +43,27 @@ public:
 
     // Hit test ray intersection with AABB
     // If a ray intersects the box bounded by all pairs of planes, then all 𝑡-intervals will overlap
-    bool Hit(const Ray& r, Interval ray_time_interval) const;
+    inline bool Hit(const Ray& r, Interval ray_time_interval) const {
+        const Point3& origin = r.GetEndpoint();
+        const Vec3& inv_dir = r.GetInvDirection();
+        double tmin = ray_time_interval.GetMin();
+        double tmax = ray_time_interval.GetMax();
+        // unrolled, the near and far planes come from the direction signs instead of comparing the distances
+        bool neg_x = r.IsDirectionNegative(0);
+        bool neg_y = r.IsDirectionNegative(1);
+        bool neg_z = r.IsDirectionNegative(2);
+        ClipToSlab(neg_x ? x.GetMax() : x.GetMin(), neg_x ? x.GetMin() : x.GetMax(), origin[0], inv_dir[0], tmin, tmax);
+        ClipToSlab(neg_y ? y.GetMax() : y.GetMin(), neg_y ? y.GetMin() : y.GetMax(), origin[1], inv_dir[1], tmin, tmax);
+        ClipToSlab(neg_z ? z.GetMax() : z.GetMin(), neg_z ? z.GetMin() : z.GetMax(), origin[2], inv_dir[2], tmin, tmax);
+        return tmin < tmax;
+    }
 
     // LongestAxis returns the index of the longest axis of the bounding box
     int LongestAxis() const;
 
+    // SurfaceArea returns the area of the six faces, 0 for an empty box
+    double SurfaceArea() const;
+
 public:
     Interval x;
     Interval y;
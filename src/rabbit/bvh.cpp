@@ -4,81 +4,182 @@ namespace gplay {
 
 namespace rabbit {
 
-BVHNode::BVHNode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end) {
-    // -- Build BVH Tree --
-    // the key point is splitting bvh volumes:
-    // 1. randomly choose an axis
-    //   1.1 optimization: Instead of choosing a random splitting axis,
-    //                     split the longest axis of the enclosing bounding box to get the most subdivision
-    // 2. sort the primitives
-    // 3. put half in each subtree
-
-    // int axis = RandomInt(0, 2);
+LinearBVH::LinearBVH(const HittableList& obj_list, const BVHBuildOptions& options)
+    : LinearBVH(obj_list.objs, options) {}
 
+LinearBVH::LinearBVH(const std::vector<std::shared_ptr<Hittable>>& objects, const BVHBuildOptions& options) {
+    std::vector<AxisAlignedBoundingBox> prim_bounds;
+    prim_bounds.reserve(objects.size());
     _bbox = AxisAlignedBoundingBox::empty;
-    for (size_t obj_idx = start; obj_idx < end; obj_idx++) {
-        _bbox = AxisAlignedBoundingBox(_bbox, objects[obj_idx]->GetBoundingBox());
+    for (const auto& obj : objects) {
+        prim_bounds.push_back(obj->GetBoundingBox());
+        _bbox = AxisAlignedBoundingBox(_bbox, prim_bounds.back());
     }
-    int axis = _bbox.LongestAxis();
-
-    size_t list_span = end - start;
-    if (list_span == 1) {
-        // just have one element, duplicate it in each subtree (leaf)
-        _left = _right = objects[start];
-    } else if (list_span == 2) {
-        // two elements, put one in each subtree (leaf)
-        _left = objects[start];
-        _right = objects[start+1];
-    } else {
-        // auto comparator = [axis](const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-        //     return BoxCompare(a, b, axis);
-        // };
-
-        auto comparator = (axis == 0) ? BoxCompareX
-                        : (axis == 1) ? BoxCompareY
-                                      : BoxCompareZ;
-        std::sort(objects.begin()+start, objects.begin()+end, comparator);
-        size_t mid = start + list_span/2;
-
-        // build bvh recursively
-        _left = std::make_shared<BVHNode>(objects, start, mid);
-        _right = std::make_shared<BVHNode>(objects, mid, end);
+
+    std::vector<uint32_t> prim_order;
+    _build_stats = BuildLinearBVH(prim_bounds, options, _nodes, prim_order);
+    _primitives = LeafPrimitives(objects, prim_order, _nodes);
+}
+
+bool LinearBVH::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
+    if (_nodes.empty()) {
+        return false;
     }
+    double closest = ray_time_interval.GetMax();
+    return IntersectSubtree(0, r, ray_time_interval.GetMin(), closest, info, rng);
 }
 
-BVHNode::BVHNode(HittableList obj_list) : BVHNode(obj_list.objs, 0, obj_list.Size()) {}
+bool LinearBVH::IntersectSubtree(uint32_t root, const Ray& r, double tmin, double& closest, HitInfo& info,
+                                 RandomStream& rng) const {
+    bool is_hit = false;
+    TraverseLinearBVH(_nodes, r, tmin, closest, [&](uint32_t first, uint32_t count, double& leaf_closest) {
+        if (_primitives.IntersectLeaf(first, count, r, tmin, leaf_closest, info, rng)) {
+            is_hit = true;
+            closest = leaf_closest;
+        }
+    }, root);
+    return is_hit;
+}
 
-bool BVHNode::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
-    if (!_bbox.Hit(r, ray_time_interval)) {
+bool LinearBVH::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    if (_nodes.empty()) {
         return false;
     }
-    bool hit_left = _left->Hit(r, ray_time_interval, record);
-    bool hit_right = _right->Hit(r, Interval(ray_time_interval.GetMin(),
-                                             hit_left ? record.GetHitTime() : ray_time_interval.GetMax()),
-                                 record);
-    return hit_left || hit_right;
+    return OccludedSubtree(0, r, ray_time_interval, rng);
 }
 
-AxisAlignedBoundingBox BVHNode::GetBoundingBox() const {
-    return _bbox;
+bool LinearBVH::OccludedSubtree(uint32_t root, const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    return OccludedLinearBVH(_nodes, r, ray_time_interval.GetMin(), ray_time_interval.GetMax(),
+                             [&](uint32_t first, uint32_t count) {
+        return _primitives.OccludedLeaf(first, count, r, ray_time_interval, rng);
+    }, root);
+}
+
+void LinearBVH::IntersectPacket(RayPacket& packet, HitInfo* infos, bool* hits) const {
+    if (_nodes.empty()) {
+        return;
+    }
+
+    // every stack entry carries the rays that still have to visit the node
+    struct StackEntry {
+        uint32_t node_index;
+        uint32_t mask;
+    };
+    StackEntry stack[kBVHTraversalStackSize];
+    int stack_size = 0;
+    uint32_t node_index = 0;
+    uint32_t mask = packet.FullMask();
+    while (true) {
+        const BVHLinearNode& node = _nodes[node_index];
+        mask = node.HitPacket(packet, mask);
+        if (IsSingleRay(mask)) {
+            // the packet has split up, a lone ray is faster on its own
+            int k = LowestRay(mask);
+            double closest = packet.tmax[k];
+            if (IntersectSubtree(node_index, *packet.rays[k], packet.tmin[k], closest, infos[k], *packet.rng[k])) {
+                hits[k] = true;
+                packet.tmax[k] = closest;
+            }
+        } else if (mask != 0) {
+            if (node.IsLeaf()) {
+                for (int k = 0; k < packet.Size(); k++) {
+                    if ((mask & (1u << k)) && _primitives.IntersectLeaf(node.offset, node.prim_count,
+                            *packet.rays[k], packet.tmin[k], packet.tmax[k], infos[k], *packet.rng[k])) {
+                        hits[k] = true;
+                    }
+                }
+            } else {
+                // coherent rays share their direction signs, the first active ray picks the nearer child
+                if (packet.inv_dir[node.axis][LowestRay(mask)] < 0) {
+                    stack[stack_size++] = StackEntry{node.offset, mask};
+                    node_index = node.offset + 1;
+                } else {
+                    stack[stack_size++] = StackEntry{node.offset + 1, mask};
+                    node_index = node.offset;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        stack_size--;
+        node_index = stack[stack_size].node_index;
+        mask = stack[stack_size].mask;
+    }
 }
 
-bool BoxCompare(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b, int axis) {
-    auto&& a_axis_interval = a->GetBoundingBox().GetAxisInterval(axis);
-    auto&& b_axis_interval = b->GetBoundingBox().GetAxisInterval(axis);
-    return a_axis_interval.GetMin() < b_axis_interval.GetMin();
+void LinearBVH::OccludedPacket(const RayPacket& packet, bool* occluded) const {
+    if (_nodes.empty()) {
+        return;
+    }
+
+    uint32_t blocked = 0;
+    for (int k = 0; k < packet.Size(); k++) {
+        blocked |= static_cast<uint32_t>(occluded[k]) << k;
+    }
+
+    struct StackEntry {
+        uint32_t node_index;
+        uint32_t mask;
+    };
+    StackEntry stack[kBVHTraversalStackSize];
+    int stack_size = 0;
+    uint32_t node_index = 0;
+    uint32_t mask = packet.FullMask() & ~blocked;
+    while (true) {
+        const BVHLinearNode& node = _nodes[node_index];
+        // rays blocked in another subtree meanwhile are done
+        mask = node.HitPacket(packet, mask & ~blocked);
+        if (IsSingleRay(mask)) {
+            int k = LowestRay(mask);
+            if (OccludedSubtree(node_index, *packet.rays[k], Interval(packet.tmin[k], packet.tmax[k]),
+                                *packet.rng[k])) {
+                blocked |= mask;
+            }
+        } else if (mask != 0) {
+            if (node.IsLeaf()) {
+                for (int k = 0; k < packet.Size(); k++) {
+                    if ((mask & (1u << k)) && _primitives.OccludedLeaf(node.offset, node.prim_count,
+                            *packet.rays[k], Interval(packet.tmin[k], packet.tmax[k]), *packet.rng[k])) {
+                        blocked |= 1u << k;
+                    }
+                }
+            } else {
+                stack[stack_size++] = StackEntry{node.offset + 1, mask};
+                node_index = node.offset;
+                continue;
+            }
+        }
+        if (stack_size == 0 || blocked == packet.FullMask()) {
+            break;
+        }
+        stack_size--;
+        node_index = stack[stack_size].node_index;
+        mask = stack[stack_size].mask;
+    }
+
+    for (int k = 0; k < packet.Size(); k++) {
+        occluded[k] = (blocked & (1u << k)) != 0;
+    }
 }
 
-bool BoxCompareX(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-    return BoxCompare(a, b, 0);
+void LinearBVH::CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {
+    for (const auto& prim : _primitives.GetObjects()) {
+        prim->CollectLights(materials, lights);
+    }
 }
 
-bool BoxCompareY(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-    return BoxCompare(a, b, 1);
+int LinearBVH::GetInstanceDepth() const {
+    int depth = 0;
+    for (const auto& prim : _primitives.GetObjects()) {
+        depth = std::max(depth, prim->GetInstanceDepth());
+    }
+    return depth;
 }
 
-bool BoxCompareZ(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b) {
-    return BoxCompare(a, b, 2);
+AxisAlignedBoundingBox LinearBVH::GetBoundingBox() const {
+    return _bbox;
 }
 
 } // namespace rabbit
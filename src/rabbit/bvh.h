@@ -1,47 +1,280 @@
 #ifndef GPLAY_RABBIT_BVH_H
 #define GPLAY_RABBIT_BVH_H
 /*
-Class BVHNode - A binary tree structured Bounding Volume Hierarchies
+Class LinearBVH - A flattened, index based Bounding Volume Hierarchy
 reference: https://github.com/RayTracing/raytracing.github.io/blob/release/src/TheNextWeek
+           https://pbr-book.org/3ed-2018/Primitives_and_Intersection_Acceleration/Bounding_Volume_Hierarchies
 The key idea of creating bounding volumes for a set of primitives is to find a volume that fully encloses (bounds) all the objects.
+The tree is stored as one array of 32-byte nodes: children and primitives are addressed by offsets instead of pointers,
+and the primitives are reordered so that every leaf references a contiguous range of them.
 */
 
 #include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
 #include "rabbit/hittable.h"
+#include "rabbit/leaf_primitives.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace gplay {
 
 namespace rabbit {
 
-class BVHNode : public Hittable {
+// BVHLinearNode a node of the flattened BVH
+struct BVHLinearNode {
+    // Node bounds in single precision, rounded outwards so that they still enclose the double precision bounds
+    float bounds_min[3];
+    float bounds_max[3];
+    // Interior node: index of the first child, the second child is stored right after it
+    // Leaf node: index of the first primitive in the reordered primitive array
+    uint32_t offset;
+    // Number of primitives in a leaf node, 0 for an interior node
+    uint16_t prim_count;
+    // Split axis of an interior node, used to visit the nearer child first
+    uint8_t axis;
+    uint8_t pad;
+
+    inline bool IsLeaf() const {
+        return prim_count > 0;
+    }
+
+    // SetBounds stores bbox conservatively in single precision
+    void SetBounds(const AxisAlignedBoundingBox& bbox);
+
+    // Hit slab test of the node bounds against the ray in [tmin, tmax], branchless with the precomputed ray data
+    inline bool Hit(const Ray& r, double tmin, double tmax) const {
+        const Point3& origin = r.GetEndpoint();
+        const Vec3& inv_dir = r.GetInvDirection();
+        for (int axis = 0; axis < 3; axis++) {
+            bool is_neg = r.IsDirectionNegative(axis);
+            ClipToSlab(is_neg ? bounds_max[axis] : bounds_min[axis], is_neg ? bounds_min[axis] : bounds_max[axis],
+                       origin[axis], inv_dir[axis], tmin, tmax);
+        }
+        return tmin <= tmax;
+    }
+
+    // HitPacket the slab test of Hit for the rays of packet in mask, two rays at a time
+    // The rays of a packet may run in different directions, each lane picks its near and far planes from the sign of
+    // its inverse direction like Ray::IsDirectionNegative. Returns the mask of the rays that hit, every ray gets
+    // exactly the result of Hit
+    inline uint32_t HitPacket(const RayPacket& packet, uint32_t mask) const {
+        uint32_t hits = 0;
+#if defined(__SSE2__)
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d far_scale = _mm_set1_pd(kSlabFarScale);
+        for (int k = 0; k < RayPacket::kMaxSize; k += 2) {
+            __m128d tmin = _mm_loadu_pd(&packet.tmin[k]);
+            __m128d tmax = _mm_loadu_pd(&packet.tmax[k]);
+            for (int axis = 0; axis < 3; axis++) {
+                __m128d origin = _mm_load_pd(&packet.origin[axis][k]);
+                __m128d inv_dir = _mm_load_pd(&packet.inv_dir[axis][k]);
+                __m128d is_neg = _mm_cmplt_pd(inv_dir, zero);
+                __m128d plane_min = _mm_set1_pd(bounds_min[axis]);
+                __m128d plane_max = _mm_set1_pd(bounds_max[axis]);
+                __m128d near_plane = _mm_or_pd(_mm_and_pd(is_neg, plane_max), _mm_andnot_pd(is_neg, plane_min));
+                __m128d far_plane = _mm_or_pd(_mm_and_pd(is_neg, plane_min), _mm_andnot_pd(is_neg, plane_max));
+                __m128d t0 = _mm_mul_pd(_mm_sub_pd(near_plane, origin), inv_dir);
+                __m128d t1 = _mm_mul_pd(_mm_mul_pd(_mm_sub_pd(far_plane, origin), inv_dir), far_scale);
+                // max/min return their second operand unless the first compares greater/less, like the ternaries of
+                // ClipToSlab: a NaN slab distance leaves the interval unchanged
+                tmin = _mm_max_pd(t0, tmin);
+                tmax = _mm_min_pd(t1, tmax);
+            }
+            hits |= static_cast<uint32_t>(_mm_movemask_pd(_mm_cmple_pd(tmin, tmax))) << k;
+        }
+#else
+        for (int k = 0; k < RayPacket::kMaxSize; k++) {
+            double tmin = packet.tmin[k];
+            double tmax = packet.tmax[k];
+            for (int axis = 0; axis < 3; axis++) {
+                bool is_neg = packet.inv_dir[axis][k] < 0;
+                ClipToSlab(is_neg ? bounds_max[axis] : bounds_min[axis], is_neg ? bounds_min[axis] : bounds_max[axis],
+                           packet.origin[axis][k], packet.inv_dir[axis][k], tmin, tmax);
+            }
+            hits |= static_cast<uint32_t>(tmin <= tmax) << k;
+        }
+#endif
+        return hits & mask;
+    }
+};
+
+static_assert(sizeof(BVHLinearNode) == 32, "BVHLinearNode is expected to be 32 bytes");
+
+// BVHSplitMethod how the builder partitions the primitives of a node
+enum class BVHSplitMethod {
+    // Split at the median centroid of the widest axis, fast to build, good for quick previews
+    kMedian,
+    // Binned Surface Area Heuristic, slower to build but much cheaper to traverse
+    kSAH,
+    // Linear BVH: primitives sorted by the Morton code of their centroids and split at the highest differing bit,
+    // near instant builds for large or animated inputs at some traversal cost
+    kLBVH,
+};
+
+// BVHBuildOptions settings of the BVH builder
+class BVHBuildOptions {
+public:
+    BVHSplitMethod split_method = BVHSplitMethod::kSAH;
+    // Number of centroid bins per axis evaluated by the SAH builder
+    int sah_bins = 16;
+    // Leaves hold at most this many primitives
+    int max_leaf_size = 4;
+    // Cost of one node traversal step, relative to intersection_cost
+    double traversal_cost = 1.0;
+    // Cost of one ray-primitive intersection test
+    double intersection_cost = 1.0;
+    // Number of build threads, non-positive means GPLAY_RABBIT_THREADS or all hardware threads
+    // Large subtrees are built as parallel tasks, the result does not depend on the thread count
+    int num_threads = 0;
+};
+
+// BVHBuildStats summary of a built tree
+// The expected costs are the surface area estimates for rays that hit the root bounds, i.e. the SAH cost of the tree
+class BVHBuildStats {
+public:
+    BVHSplitMethod split_method = BVHSplitMethod::kSAH;
+    int num_threads = 1;
+    size_t prim_count = 0;
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    int max_depth = 0;
+    // Wall clock build time in milliseconds
+    double build_time_ms = 0;
+    // Expected number of nodes visited per ray
+    double expected_node_visits = 0;
+    // Expected number of ray-primitive tests per ray
+    double expected_prim_tests = 0;
+    // Expected traversal cost per ray, weighted by the build option costs
+    double expected_cost = 0;
+};
+
+std::ostream& operator<<(std::ostream& out, const BVHBuildStats& stats);
+
+// BuildLinearBVH builds a flattened BVH over the primitive bounds, node 0 is the root
+// prim_order receives the primitive indices in leaf order, leaves reference ranges of it
+BVHBuildStats BuildLinearBVH(const std::vector<AxisAlignedBoundingBox>& prim_bounds, const BVHBuildOptions& options,
+                             std::vector<BVHLinearNode>& nodes, std::vector<uint32_t>& prim_order);
+
+// Traversal stack size of the BVH traversals, the builders keep every tree shallower than this
+const int kBVHTraversalStackSize = 128;
+
+// TraverseLinearBVH visits the leaves of the subtree at root hit by the ray in [tmin, closest], nearer child first
+// intersect_leaf(first, count, closest) tests a primitive range and shrinks closest on a hit
+template <typename LeafFn>
+void TraverseLinearBVH(const std::vector<BVHLinearNode>& nodes, const Ray& r, double tmin, double closest,
+                       LeafFn&& intersect_leaf, uint32_t root = 0) {
+    // depth-first traversal with an explicit stack of node indices still to visit
+    uint32_t stack[kBVHTraversalStackSize];
+    int stack_size = 0;
+    uint32_t node_index = root;
+    while (true) {
+        const BVHLinearNode& node = nodes[node_index];
+        if (node.Hit(r, tmin, closest)) {
+            if (node.IsLeaf()) {
+                intersect_leaf(node.offset, node.prim_count, closest);
+            } else {
+                // visit the nearer child first, so that the farther one can be culled by the closest hit
+                if (r.IsDirectionNegative(node.axis)) {
+                    stack[stack_size++] = node.offset;
+                    node_index = node.offset + 1;
+                } else {
+                    stack[stack_size++] = node.offset + 1;
+                    node_index = node.offset;
+                }
+                continue;
+            }
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+}
+
+// OccludedLinearBVH returns whether any leaf range of the subtree at root hit by the ray in [tmin, tmax] reports an
+// intersection, the first leaf with occluded(first, count) true ends the traversal
+template <typename LeafFn>
+bool OccludedLinearBVH(const std::vector<BVHLinearNode>& nodes, const Ray& r, double tmin, double tmax,
+                       LeafFn&& occluded, uint32_t root = 0) {
+    uint32_t stack[kBVHTraversalStackSize];
+    int stack_size = 0;
+    uint32_t node_index = root;
+    while (true) {
+        const BVHLinearNode& node = nodes[node_index];
+        if (node.Hit(r, tmin, tmax)) {
+            if (node.IsLeaf()) {
+                if (occluded(node.offset, node.prim_count)) {
+                    return true;
+                }
+            } else {
+                // no closest hit to shrink the interval, the order of the children does not matter
+                stack[stack_size++] = node.offset + 1;
+                node_index = node.offset;
+                continue;
+            }
+        }
+        if (stack_size == 0) {
+            break;
+        }
+        node_index = stack[--stack_size];
+    }
+    return false;
+}
+
+class LinearBVH : public Hittable {
 public:
-    BVHNode(HittableList obj_list);
+    LinearBVH(const HittableList& obj_list, const BVHBuildOptions& options = BVHBuildOptions());
+
+    LinearBVH(const std::vector<std::shared_ptr<Hittable>>& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+    // Intersect respond to the query "does this ray hit you?" with the closest primitive hit
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
+
+    // Occluded any-hit traversal, children are visited in storage order and the first intersection ends the query
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
 
-    BVHNode(std::vector<std::shared_ptr<Hittable>>& objects, size_t start, size_t end);
+    // IntersectPacket traverses the tree once for the whole packet, children are visited in the order that suits
+    // the first active ray. Subtrees reached by a single ray are finished with the single ray traversal.
+    void IntersectPacket(RayPacket& packet, HitInfo* infos, bool* hits) const override;
 
-    // Hit respond to the query "does this ray hit you?"
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    // OccludedPacket any-hit traversal for the packet, blocked rays drop out of the traversal
+    void OccludedPacket(const RayPacket& packet, bool* occluded) const override;
+
+    void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const override;
+
+    int GetInstanceDepth() const override;
 
     // GetBoundingBox ...
     AxisAlignedBoundingBox GetBoundingBox() const override;
 
-private:
-    std::shared_ptr<Hittable> _left;
-    std::shared_ptr<Hittable> _right;
-    AxisAlignedBoundingBox _bbox;
-};
+    // NodeCount returns the number of nodes in the flattened tree
+    inline size_t NodeCount() const {
+        return _nodes.size();
+    }
 
-// BoxCompare compare AABBs by axis
-bool BoxCompare(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b, int axis);
+    // GetBuildStats returns build time and expected traversal cost of the tree
+    inline const BVHBuildStats& GetBuildStats() const {
+        return _build_stats;
+    }
 
-// BoxCompareX ...
-bool BoxCompareX(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b);
+private:
+    // IntersectSubtree closest hit traversal of the subtree at root, shrinks closest on a hit
+    bool IntersectSubtree(uint32_t root, const Ray& r, double tmin, double& closest, HitInfo& info,
+                          RandomStream& rng) const;
 
-// BoxCompareY ...
-bool BoxCompareY(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b);
+    // OccludedSubtree any-hit traversal of the subtree at root
+    bool OccludedSubtree(uint32_t root, const Ray& r, Interval ray_time_interval, RandomStream& rng) const;
 
-// BoxCompareZ ...
-bool BoxCompareZ(const std::shared_ptr<Hittable> a, const std::shared_ptr<Hittable> b);
+    std::vector<BVHLinearNode> _nodes;
+    BVHBuildStats _build_stats;
+    // Primitives reordered so that each leaf covers a contiguous range
+    LeafPrimitives _primitives;
+    AxisAlignedBoundingBox _bbox;
+};
 
 } // namespace rabbit
 
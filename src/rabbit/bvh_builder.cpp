@@ -0,0 +1,599 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#include "rabbit/bvh.h"
+#include "rabbit/parallel.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+// Below this depth the SAH builder may produce unbalanced subtrees, deeper nodes fall back to median splits
+// so that even degenerate inputs keep the tree depth within kBVHTraversalStackSize
+const int kMaxSAHDepth = 32;
+
+// A leaf stores its primitive count in 16 bits
+const size_t kMaxLeafCapacity = 0xffff;
+
+// Subtrees with fewer primitives than this are always built on the current thread
+const size_t kParallelSubtreeSize = 4096;
+
+// Nodes with at least this many primitives compute their bounds and SAH bins on all build threads
+const size_t kParallelRangeSize = 65536;
+
+// Upper bound of the number of SAH bins per axis, the bins live on the stack
+const int kMaxSAHBins = 64;
+
+// Morton codes use 21 bits per axis
+const uint32_t kMortonBits = 21;
+
+// RoundDown/RoundUp convert to single precision without shrinking the interval
+float RoundDown(double value) {
+    float f = static_cast<float>(value);
+    return static_cast<double>(f) > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+float RoundUp(double value) {
+    float f = static_cast<float>(value);
+    return static_cast<double>(f) < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// BuildBounds plain min/max box, cheaper to grow than AxisAlignedBoundingBox in the build loops
+struct BuildBounds {
+    double lo[3] = { kInfinity, kInfinity, kInfinity };
+    double hi[3] = { -kInfinity, -kInfinity, -kInfinity };
+
+    inline void Extend(const BuildBounds& b) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = b.lo[a] < lo[a] ? b.lo[a] : lo[a];
+            hi[a] = b.hi[a] > hi[a] ? b.hi[a] : hi[a];
+        }
+    }
+
+    inline void Extend(const Point3& p) {
+        for (int a = 0; a < 3; a++) {
+            lo[a] = p[a] < lo[a] ? p[a] : lo[a];
+            hi[a] = p[a] > hi[a] ? p[a] : hi[a];
+        }
+    }
+
+    inline double Extent(int axis) const {
+        return hi[axis] - lo[axis];
+    }
+
+    inline int LongestAxis() const {
+        if (Extent(0) > Extent(1)) {
+            return Extent(0) > Extent(2) ? 0 : 2;
+        }
+        return Extent(1) > Extent(2) ? 1 : 2;
+    }
+
+    inline double SurfaceArea() const {
+        double dx = Extent(0);
+        double dy = Extent(1);
+        double dz = Extent(2);
+        if (dx < 0 || dy < 0 || dz < 0) {
+            return 0;
+        }
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    inline AxisAlignedBoundingBox ToAABB() const {
+        return AxisAlignedBoundingBox(Interval(lo[0], hi[0]), Interval(lo[1], hi[1]), Interval(lo[2], hi[2]));
+    }
+};
+
+struct BuildPrimitive {
+    BuildBounds bbox;
+    Point3 centroid;
+    uint32_t index;
+    // Morton code of the centroid, only used by the LBVH builder
+    uint64_t morton;
+};
+
+// BuildContext state shared by all threads working on one build
+// Nodes come from a pre-sized array through an atomic pair allocator, and leaves reference their range
+// of the (in place partitioned) primitive array directly, so concurrent subtree builds never touch the same data
+struct BuildContext {
+    std::vector<BuildPrimitive>& prims;
+    std::vector<BVHLinearNode>& nodes;
+    const BVHBuildOptions& options;
+    int num_threads;
+    std::atomic<uint32_t> next_node;
+    std::atomic<int> busy_threads;
+    std::atomic<int> max_depth;
+
+    BuildContext(std::vector<BuildPrimitive>& build_prims, std::vector<BVHLinearNode>& build_nodes,
+                 const BVHBuildOptions& build_options, int threads)
+        : prims(build_prims), nodes(build_nodes), options(build_options), num_threads(threads),
+          next_node(1), busy_threads(1), max_depth(0) {}
+
+    // AllocateNodePair reserves two adjacent nodes and returns the index of the first
+    inline uint32_t AllocateNodePair() {
+        return next_node.fetch_add(2, std::memory_order_relaxed);
+    }
+
+    inline void UpdateMaxDepth(int depth) {
+        int curr = max_depth.load(std::memory_order_relaxed);
+        while (depth > curr && !max_depth.compare_exchange_weak(curr, depth, std::memory_order_relaxed)) {}
+    }
+};
+
+// RunSubtrees builds the two subtrees, handing the first one to a new thread when it is big enough and
+// the build still has idle threads
+template <typename LeftFn, typename RightFn>
+void RunSubtrees(BuildContext& ctx, size_t left_size, size_t right_size, LeftFn left, RightFn right) {
+    if (left_size >= kParallelSubtreeSize && right_size >= kParallelSubtreeSize) {
+        if (ctx.busy_threads.fetch_add(1) < ctx.num_threads) {
+            std::thread worker(left);
+            right();
+            worker.join();
+            ctx.busy_threads.fetch_sub(1);
+            return;
+        }
+        ctx.busy_threads.fetch_sub(1);
+    }
+    left();
+    right();
+}
+
+// MakeLeaf turns node into a leaf over the primitive range [start, end)
+void MakeLeaf(BVHLinearNode& node, size_t start, size_t end) {
+    node.offset = static_cast<uint32_t>(start);
+    node.prim_count = static_cast<uint16_t>(end - start);
+    node.axis = 0;
+}
+
+// ComputeRangeBounds returns the bounds of the primitives and of their centroids in [start, end)
+void ComputeRangeBounds(BuildContext& ctx, size_t start, size_t end,
+                        BuildBounds& bbox, BuildBounds& centroid_bbox) {
+    auto accumulate = [&ctx](size_t from, size_t to, BuildBounds& b, BuildBounds& cb) {
+        b = BuildBounds();
+        cb = BuildBounds();
+        for (size_t i = from; i < to; i++) {
+            b.Extend(ctx.prims[i].bbox);
+            cb.Extend(ctx.prims[i].centroid);
+        }
+    };
+
+    size_t count = end - start;
+    if (count < kParallelRangeSize || ctx.num_threads <= 1) {
+        accumulate(start, end, bbox, centroid_bbox);
+        return;
+    }
+
+    int num_chunks = ctx.num_threads;
+    std::vector<BuildBounds> chunk_bbox(num_chunks), chunk_centroid_bbox(num_chunks);
+    ParallelFor(num_chunks, ctx.num_threads, [&](int chunk, int) {
+        accumulate(start + count*chunk/num_chunks, start + count*(chunk+1)/num_chunks,
+                   chunk_bbox[chunk], chunk_centroid_bbox[chunk]);
+    });
+    bbox = BuildBounds();
+    centroid_bbox = BuildBounds();
+    for (int chunk = 0; chunk < num_chunks; chunk++) {
+        bbox.Extend(chunk_bbox[chunk]);
+        centroid_bbox.Extend(chunk_centroid_bbox[chunk]);
+    }
+}
+
+// MedianSplit partitions [start, end) around the median centroid on axis, returns the split position
+size_t MedianSplit(std::vector<BuildPrimitive>& prims, size_t start, size_t end, int axis) {
+    size_t mid = start + (end-start)/2;
+    std::nth_element(prims.begin()+start, prims.begin()+mid, prims.begin()+end,
+                     [axis](const BuildPrimitive& a, const BuildPrimitive& b) {
+                         return a.centroid[axis] < b.centroid[axis];
+                     });
+    return mid;
+}
+
+// SAHBin accumulated bounds and count of the primitives whose centroids fall into one bin
+struct SAHBin {
+    BuildBounds bbox;
+    size_t count = 0;
+};
+
+// FillSAHBins bins the primitives of [start, end) along all three axes, bins holds 3 * num_bins entries
+void FillSAHBins(BuildContext& ctx, size_t start, size_t end, const BuildBounds& centroid_bbox,
+                 int num_bins, SAHBin* bins) {
+    auto fill = [&](size_t from, size_t to, SAHBin* out) {
+        std::fill(out, out + 3*num_bins, SAHBin());
+        for (int a = 0; a < 3; a++) {
+            double cmin = centroid_bbox.lo[a];
+            double extent = centroid_bbox.Extent(a);
+            if (!(extent > 0)) {
+                continue;
+            }
+            double scale = num_bins / extent;
+            for (size_t i = from; i < to; i++) {
+                int b = static_cast<int>((ctx.prims[i].centroid[a] - cmin) * scale);
+                b = b < num_bins ? b : num_bins-1;
+                SAHBin& bin = out[a*num_bins + b];
+                bin.bbox.Extend(ctx.prims[i].bbox);
+                bin.count++;
+            }
+        }
+    };
+
+    size_t count = end - start;
+    if (count < kParallelRangeSize || ctx.num_threads <= 1) {
+        fill(start, end, bins);
+        return;
+    }
+
+    int num_chunks = ctx.num_threads;
+    std::vector<SAHBin> chunk_bins(num_chunks * 3 * num_bins);
+    ParallelFor(num_chunks, ctx.num_threads, [&](int chunk, int) {
+        fill(start + count*chunk/num_chunks, start + count*(chunk+1)/num_chunks, &chunk_bins[chunk * 3 * num_bins]);
+    });
+    std::fill(bins, bins + 3*num_bins, SAHBin());
+    for (int chunk = 0; chunk < num_chunks; chunk++) {
+        for (int b = 0; b < 3*num_bins; b++) {
+            bins[b].bbox.Extend(chunk_bins[chunk * 3 * num_bins + b].bbox);
+            bins[b].count += chunk_bins[chunk * 3 * num_bins + b].count;
+        }
+    }
+}
+
+// SAHSplit looks for the cheapest binned SAH split of [start, end)
+// returns false if keeping the primitives in one leaf is cheaper, otherwise partitions the range and sets mid/axis
+bool SAHSplit(BuildContext& ctx, size_t start, size_t end, const BuildBounds& bbox,
+              const BuildBounds& centroid_bbox, size_t& mid, int& axis) {
+    // -- Surface Area Heuristic --
+    // the probability that a ray hitting the parent also hits a child is about SA(child) / SA(parent), so
+    //   C(split) = C_trav + (SA(L) N_L + SA(R) N_R) / SA(parent) * C_isect
+    // the candidate splits are the boundaries between equally sized centroid bins on each axis
+
+    const int num_bins = std::max(2, std::min(ctx.options.sah_bins, kMaxSAHBins));
+    size_t count = end - start;
+    double parent_area = bbox.SurfaceArea();
+
+    SAHBin bins[3 * kMaxSAHBins];
+    FillSAHBins(ctx, start, end, centroid_bbox, num_bins, bins);
+
+    double best_cost = kInfinity;
+    int best_axis = -1;
+    int best_bin = -1;
+    double right_area[kMaxSAHBins];
+    size_t right_count[kMaxSAHBins];
+
+    for (int a = 0; a < 3; a++) {
+        if (!(centroid_bbox.Extent(a) > 0)) {
+            continue;
+        }
+        const SAHBin* axis_bins = &bins[a*num_bins];
+
+        // sweep from the right to get the area/count of every right side, then from the left to evaluate the costs
+        BuildBounds acc;
+        size_t acc_count = 0;
+        for (int b = num_bins-1; b > 0; b--) {
+            acc.Extend(axis_bins[b].bbox);
+            acc_count += axis_bins[b].count;
+            right_area[b] = acc.SurfaceArea();
+            right_count[b] = acc_count;
+        }
+        acc = BuildBounds();
+        acc_count = 0;
+        for (int b = 0; b < num_bins-1; b++) {
+            acc.Extend(axis_bins[b].bbox);
+            acc_count += axis_bins[b].count;
+            if (acc_count == 0 || right_count[b+1] == 0) {
+                continue;
+            }
+            double cost = ctx.options.traversal_cost +
+                          ctx.options.intersection_cost *
+                          (acc.SurfaceArea() * acc_count + right_area[b+1] * right_count[b+1]) / parent_area;
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = a;
+                best_bin = b;
+            }
+        }
+    }
+
+    double leaf_cost = ctx.options.intersection_cost * count;
+    if (best_axis < 0 || (leaf_cost <= best_cost && count <= static_cast<size_t>(ctx.options.max_leaf_size))) {
+        return false;
+    }
+
+    double cmin = centroid_bbox.lo[best_axis];
+    double scale = num_bins / centroid_bbox.Extent(best_axis);
+    auto split_it = std::partition(ctx.prims.begin()+start, ctx.prims.begin()+end,
+                                   [=](const BuildPrimitive& p) {
+                                       int b = static_cast<int>((p.centroid[best_axis] - cmin) * scale);
+                                       b = b < num_bins ? b : num_bins-1;
+                                       return b <= best_bin;
+                                   });
+    mid = static_cast<size_t>(split_it - ctx.prims.begin());
+    axis = best_axis;
+    return true;
+}
+
+size_t MaxLeafSize(const BVHBuildOptions& options) {
+    size_t max_leaf_size = options.max_leaf_size > 0 ? options.max_leaf_size : 1;
+    return max_leaf_size < kMaxLeafCapacity ? max_leaf_size : kMaxLeafCapacity;
+}
+
+void BuildRecursive(BuildContext& ctx, size_t start, size_t end, uint32_t node_index, int depth) {
+    // -- Build BVH Tree --
+    // the key point is splitting bvh volumes:
+    // 1. choose the axis and position of the split (SAH or median of the widest centroid axis)
+    // 2. partition the primitives
+    // 3. build both halves recursively, stop when a leaf is cheaper than any split
+
+    ctx.UpdateMaxDepth(depth);
+
+    BuildBounds bbox, centroid_bbox;
+    ComputeRangeBounds(ctx, start, end, bbox, centroid_bbox);
+    BVHLinearNode& node = ctx.nodes[node_index];
+    node.SetBounds(bbox.ToAABB());
+
+    size_t list_span = end - start;
+    size_t max_leaf_size = MaxLeafSize(ctx.options);
+
+    size_t mid = start;
+    int axis = centroid_bbox.LongestAxis();
+    bool do_split = list_span > max_leaf_size;
+    if (list_span > 1 && ctx.options.split_method == BVHSplitMethod::kSAH && depth < kMaxSAHDepth) {
+        do_split = SAHSplit(ctx, start, end, bbox, centroid_bbox, mid, axis) || list_span > max_leaf_size;
+    } else if (do_split) {
+        mid = MedianSplit(ctx.prims, start, end, axis);
+    }
+    if (do_split && (mid == start || mid == end)) {
+        // the binned split could not separate the centroids (or found no split for an oversized leaf),
+        // fall back to the median
+        mid = MedianSplit(ctx.prims, start, end, axis);
+    }
+
+    if (!do_split) {
+        MakeLeaf(node, start, end);
+        return;
+    }
+
+    // both children are allocated together, so the second child is always offset + 1
+    uint32_t child_index = ctx.AllocateNodePair();
+    node.offset = child_index;
+    node.prim_count = 0;
+    node.axis = static_cast<uint8_t>(axis);
+
+    // build bvh recursively
+    RunSubtrees(ctx, mid-start, end-mid,
+                [&ctx, start, mid, child_index, depth]() { BuildRecursive(ctx, start, mid, child_index, depth+1); },
+                [&ctx, mid, end, child_index, depth]() { BuildRecursive(ctx, mid, end, child_index+1, depth+1); });
+}
+
+// ExpandBits21 spreads the lower 21 bits of v so that there are two zero bits between each of them
+uint64_t ExpandBits21(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
+
+// ComputeMortonCodes quantizes the primitive centroids in the centroid bounds and interleaves the axis bits
+void ComputeMortonCodes(BuildContext& ctx, const BuildBounds& centroid_bbox) {
+    const double quantize = static_cast<double>((1u << kMortonBits) - 1);
+    double scale[3], cmin[3];
+    for (int a = 0; a < 3; a++) {
+        double extent = centroid_bbox.Extent(a);
+        cmin[a] = centroid_bbox.lo[a];
+        scale[a] = extent > 0 ? quantize / extent : 0;
+    }
+
+    size_t count = ctx.prims.size();
+    int num_chunks = ctx.num_threads;
+    ParallelFor(num_chunks, ctx.num_threads, [&](int chunk, int) {
+        for (size_t i = count*chunk/num_chunks; i < count*(chunk+1)/num_chunks; i++) {
+            BuildPrimitive& prim = ctx.prims[i];
+            uint64_t code = 0;
+            for (int a = 0; a < 3; a++) {
+                uint64_t q = static_cast<uint64_t>((prim.centroid[a] - cmin[a]) * scale[a]);
+                code |= ExpandBits21(q) << (2 - a);
+            }
+            prim.morton = code;
+        }
+    });
+}
+
+// SortByMortonCode sorts the primitives by Morton code: each thread sorts one chunk, then sorted runs are merged pairwise
+void SortByMortonCode(BuildContext& ctx) {
+    auto less = [](const BuildPrimitive& a, const BuildPrimitive& b) {
+        return a.morton < b.morton || (a.morton == b.morton && a.index < b.index);
+    };
+
+    size_t count = ctx.prims.size();
+    int num_chunks = count < kParallelSubtreeSize ? 1 : ctx.num_threads;
+    std::vector<size_t> bounds(num_chunks+1);
+    for (int chunk = 0; chunk <= num_chunks; chunk++) {
+        bounds[chunk] = count * chunk / num_chunks;
+    }
+    ParallelFor(num_chunks, ctx.num_threads, [&](int chunk, int) {
+        std::sort(ctx.prims.begin()+bounds[chunk], ctx.prims.begin()+bounds[chunk+1], less);
+    });
+    for (int width = 1; width < num_chunks; width *= 2) {
+        int num_merges = (num_chunks + 2*width - 1) / (2*width);
+        ParallelFor(num_merges, ctx.num_threads, [&](int merge, int) {
+            int first = merge * 2 * width;
+            int middle = first + width < num_chunks ? first + width : num_chunks;
+            int last = first + 2*width < num_chunks ? first + 2*width : num_chunks;
+            std::inplace_merge(ctx.prims.begin()+bounds[first], ctx.prims.begin()+bounds[middle],
+                               ctx.prims.begin()+bounds[last], less);
+        });
+    }
+}
+
+// BuildLBVHRecursive splits [start, end) of the Morton sorted primitives at the highest differing code bit
+// the node bounds are filled bottom up, the subtree bounds are returned to the parent
+BuildBounds BuildLBVHRecursive(BuildContext& ctx, size_t start, size_t end, uint32_t node_index, int depth) {
+    ctx.UpdateMaxDepth(depth);
+
+    BVHLinearNode& node = ctx.nodes[node_index];
+    if (end - start <= MaxLeafSize(ctx.options)) {
+        BuildBounds bbox;
+        for (size_t i = start; i < end; i++) {
+            bbox.Extend(ctx.prims[i].bbox);
+        }
+        node.SetBounds(bbox.ToAABB());
+        MakeLeaf(node, start, end);
+        return bbox;
+    }
+
+    // the primitives sharing the code prefix up to the highest differing bit go left, found by binary search
+    uint64_t first_code = ctx.prims[start].morton;
+    uint64_t last_code = ctx.prims[end-1].morton;
+    size_t mid = start + (end-start)/2;
+    int axis = 0;
+    if (first_code != last_code) {
+        int highest_bit = 63;
+        while (((first_code ^ last_code) >> highest_bit) == 0) {
+            highest_bit--;
+        }
+        uint64_t mask = 1ULL << highest_bit;
+        auto split_it = std::partition_point(ctx.prims.begin()+start, ctx.prims.begin()+end,
+                                             [mask](const BuildPrimitive& p) { return (p.morton & mask) == 0; });
+        mid = static_cast<size_t>(split_it - ctx.prims.begin());
+        // bit 3k+2 of the interleaved code belongs to x, 3k+1 to y and 3k to z
+        axis = 2 - highest_bit % 3;
+    }
+
+    uint32_t child_index = ctx.AllocateNodePair();
+    node.offset = child_index;
+    node.prim_count = 0;
+    node.axis = static_cast<uint8_t>(axis);
+
+    BuildBounds left_bbox, right_bbox;
+    RunSubtrees(ctx, mid-start, end-mid,
+                [&]() { left_bbox = BuildLBVHRecursive(ctx, start, mid, child_index, depth+1); },
+                [&]() { right_bbox = BuildLBVHRecursive(ctx, mid, end, child_index+1, depth+1); });
+
+    BuildBounds bbox = left_bbox;
+    bbox.Extend(right_bbox);
+    ctx.nodes[node_index].SetBounds(bbox.ToAABB());
+    return bbox;
+}
+
+double NodeSurfaceArea(const BVHLinearNode& node) {
+    double dx = static_cast<double>(node.bounds_max[0]) - node.bounds_min[0];
+    double dy = static_cast<double>(node.bounds_max[1]) - node.bounds_min[1];
+    double dz = static_cast<double>(node.bounds_max[2]) - node.bounds_min[2];
+    return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
+// ComputeTreeCosts fills the node/leaf counts and surface area cost estimates of stats
+void ComputeTreeCosts(const std::vector<BVHLinearNode>& nodes, const BVHBuildOptions& options, BVHBuildStats& stats) {
+    stats.node_count = nodes.size();
+    if (nodes.empty()) {
+        return;
+    }
+    double root_area = NodeSurfaceArea(nodes[0]);
+    for (const auto& node : nodes) {
+        double ratio = root_area > 0 ? NodeSurfaceArea(node) / root_area : 1.0;
+        stats.expected_node_visits += ratio;
+        if (node.IsLeaf()) {
+            stats.leaf_count++;
+            stats.expected_prim_tests += ratio * node.prim_count;
+        }
+    }
+    stats.expected_cost = options.traversal_cost * stats.expected_node_visits +
+                          options.intersection_cost * stats.expected_prim_tests;
+}
+
+const char* SplitMethodName(BVHSplitMethod method) {
+    switch (method) {
+    case BVHSplitMethod::kMedian:
+        return "median";
+    case BVHSplitMethod::kSAH:
+        return "SAH";
+    case BVHSplitMethod::kLBVH:
+        return "LBVH";
+    }
+    return "unknown";
+}
+
+} // namespace
+
+std::ostream& operator<<(std::ostream& out, const BVHBuildStats& stats) {
+    out << "BVH (" << SplitMethodName(stats.split_method) << ", " << stats.num_threads << " threads): "
+        << stats.prim_count << " primitives, "
+        << stats.node_count << " nodes, "
+        << stats.leaf_count << " leaves, depth " << stats.max_depth << ", "
+        << "built in " << stats.build_time_ms << " ms, "
+        << "per ray: " << stats.expected_node_visits << " node visits, "
+        << stats.expected_prim_tests << " primitive tests, cost " << stats.expected_cost;
+    return out;
+}
+
+void BVHLinearNode::SetBounds(const AxisAlignedBoundingBox& bbox) {
+    for (int axis = 0; axis < 3; axis++) {
+        bounds_min[axis] = RoundDown(bbox.GetAxisInterval(axis).GetMin());
+        bounds_max[axis] = RoundUp(bbox.GetAxisInterval(axis).GetMax());
+    }
+}
+
+BVHBuildStats BuildLinearBVH(const std::vector<AxisAlignedBoundingBox>& prim_bounds, const BVHBuildOptions& options,
+                             std::vector<BVHLinearNode>& nodes, std::vector<uint32_t>& prim_order) {
+    auto start_time = std::chrono::steady_clock::now();
+
+    BVHBuildStats stats;
+    stats.split_method = options.split_method;
+    stats.prim_count = prim_bounds.size();
+    stats.num_threads = ResolveThreadCount(options.num_threads);
+    nodes.clear();
+    prim_order.clear();
+    if (prim_bounds.empty()) {
+        return stats;
+    }
+
+    std::vector<BuildPrimitive> prims(prim_bounds.size());
+    ParallelFor(stats.num_threads, stats.num_threads, [&](int chunk, int) {
+        size_t count = prims.size();
+        for (size_t i = count*chunk/stats.num_threads; i < count*(chunk+1)/stats.num_threads; i++) {
+            BuildBounds& bbox = prims[i].bbox;
+            for (int a = 0; a < 3; a++) {
+                bbox.lo[a] = prim_bounds[i].GetAxisInterval(a).GetMin();
+                bbox.hi[a] = prim_bounds[i].GetAxisInterval(a).GetMax();
+            }
+            prims[i].centroid = Point3(0.5 * (bbox.lo[0] + bbox.hi[0]),
+                                       0.5 * (bbox.lo[1] + bbox.hi[1]),
+                                       0.5 * (bbox.lo[2] + bbox.hi[2]));
+            prims[i].index = static_cast<uint32_t>(i);
+            prims[i].morton = 0;
+        }
+    });
+
+    // a binary tree over n primitives has at most 2n-1 nodes
+    nodes.resize(2 * prims.size());
+    BuildContext ctx(prims, nodes, options, stats.num_threads);
+    if (options.split_method == BVHSplitMethod::kLBVH) {
+        BuildBounds bbox, centroid_bbox;
+        ComputeRangeBounds(ctx, 0, prims.size(), bbox, centroid_bbox);
+        ComputeMortonCodes(ctx, centroid_bbox);
+        SortByMortonCode(ctx);
+        BuildLBVHRecursive(ctx, 0, prims.size(), 0, 0);
+    } else {
+        BuildRecursive(ctx, 0, prims.size(), 0, 0);
+    }
+    nodes.resize(ctx.next_node.load());
+
+    // leaves reference their range of the partitioned primitive array
+    prim_order.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); i++) {
+        prim_order[i] = prims[i].index;
+    }
+
+    auto end_time = std::chrono::steady_clock::now();
+    stats.max_depth = ctx.max_depth.load();
+    stats.build_time_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+    ComputeTreeCosts(nodes, options, stats);
+    return stats;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -48,17 +48,19 @@ void Camera::Initialize() {
     _defocus_disk_v = defocus_disk_radius * _v;
 }
 
-Ray Camera::GetRay(int i, int j) const {
-    Point3 offset_in_pixel = RandomPointInUnitSquare();
+Ray Camera::GetRay(int i, int j, Sampler& sampler) const {
+    // the pixel, lens and time dimensions always come first, in this order
+    Sample2D offset_in_pixel = sampler.Get2D();
     Point3 target = _location_origin_pixel_grid +
-                    _pixel_delta_u * (static_cast<double>(i)+offset_in_pixel.X()) +
-                    _pixel_delta_v * (static_cast<double>(j)+offset_in_pixel.Y());
+                    _pixel_delta_u * (static_cast<double>(i)+offset_in_pixel.x) +
+                    _pixel_delta_v * (static_cast<double>(j)+offset_in_pixel.y);
     Point3 origin = _center;
+    Sample2D lens = sampler.Get2D();
     if (defocus_angle > 0) {
-        Point3 point_in_disk = RandomPointInUnitDisk();
+        Point3 point_in_disk = SamplePointInUnitDisk(lens);
         origin += point_in_disk.X()*_defocus_disk_u + point_in_disk.Y()*_defocus_disk_v;
     }
-    return Ray(origin, target-origin, RandomDouble());
+    return Ray(origin, target-origin, sampler.Get1D());
 }
 
 void Camera::SetBackgroundColor(Color color) {
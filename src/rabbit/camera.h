@@ -11,6 +11,7 @@ Class Camera
 
 #include "rabbit/mathtools.h"
 #include "rabbit/ray.h"
+#include "rabbit/sampler.h"
 
 namespace gplay {
 
@@ -27,9 +28,9 @@ public:
     // Initialize ...
     void Initialize();
 
-    // GetRay construct a camera ray originating from the defocus disk and directed at a randomly
-    // sampled point around the pixel location i, j
-    Ray GetRay(int i, int j) const;
+    // GetRay construct a camera ray originating from the defocus disk and directed at a sampled point
+    // around the pixel location i, j, the sampler must be positioned at the sample of pixel i, j
+    Ray GetRay(int i, int j, Sampler& sampler) const;
 
     // SetBackgroundColor ...
     void SetBackgroundColor(Color color);
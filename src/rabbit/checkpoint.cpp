@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "rabbit/checkpoint.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+const char kCheckpointMagic[8] = {'G', 'P', 'R', 'B', 'C', 'K', 'P', 'T'};
+
+template <typename T>
+void WriteValue(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+void ReadValue(std::istream& in, T& value) {
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+}
+
+// SyncFile waits until the contents of the closed file at path are on the disk
+bool SyncFile(const std::string& path) {
+    int fd = open(path.c_str(), O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    return close(fd) == 0 && synced;
+}
+
+} // namespace
+
+bool CheckpointHeader::operator==(const CheckpointHeader& other) const {
+    return version == other.version && width == other.width && height == other.height &&
+           sampler_type == other.sampler_type && sampler_samples_per_pixel == other.sampler_samples_per_pixel &&
+           seed == other.seed && scene_hash == other.scene_hash;
+}
+
+bool SaveCheckpoint(const std::string& path, const CheckpointHeader& header, const Framebuffer& framebuffer) {
+    // write a temporary file and rename it over the old checkpoint, a process killed while saving
+    // leaves the previous checkpoint intact
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "ERROR: Could not open checkpoint file '" << temp_path << "'.\n";
+            return false;
+        }
+        file.write(kCheckpointMagic, sizeof(kCheckpointMagic));
+        WriteValue(file, header.version);
+        WriteValue(file, header.width);
+        WriteValue(file, header.height);
+        WriteValue(file, header.sampler_type);
+        WriteValue(file, header.sampler_samples_per_pixel);
+        WriteValue(file, header.seed);
+        WriteValue(file, header.scene_hash);
+        if (!framebuffer.Write(file)) {
+            std::cerr << "ERROR: Could not write checkpoint file '" << temp_path << "'.\n";
+            return false;
+        }
+    }
+    // the rename may reach the disk before the data does, a crash in between would leave an empty checkpoint
+    if (!SyncFile(temp_path)) {
+        std::cerr << "ERROR: Could not flush checkpoint file '" << temp_path << "' to disk.\n";
+        return false;
+    }
+    if (std::rename(temp_path.c_str(), path.c_str()) != 0) {
+        std::cerr << "ERROR: Could not replace checkpoint file '" << path << "'.\n";
+        return false;
+    }
+    return true;
+}
+
+CheckpointLoadResult LoadCheckpoint(const std::string& path, const CheckpointHeader& expected, Framebuffer& framebuffer) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return CheckpointLoadResult::kNotFound;
+    }
+
+    char magic[sizeof(kCheckpointMagic)];
+    file.read(magic, sizeof(magic));
+    CheckpointHeader header;
+    ReadValue(file, header.version);
+    ReadValue(file, header.width);
+    ReadValue(file, header.height);
+    ReadValue(file, header.sampler_type);
+    ReadValue(file, header.sampler_samples_per_pixel);
+    ReadValue(file, header.seed);
+    ReadValue(file, header.scene_hash);
+    if (!file || std::memcmp(magic, kCheckpointMagic, sizeof(magic)) != 0 || !(header == expected)) {
+        return CheckpointLoadResult::kInvalid;
+    }
+
+    Framebuffer restored(expected.width, expected.height);
+    if (!restored.Read(file) || file.peek() != std::ifstream::traits_type::eof()) {
+        return CheckpointLoadResult::kInvalid;
+    }
+    framebuffer = restored;
+    return CheckpointLoadResult::kLoaded;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,56 @@
+#ifndef GPLAY_RABBIT_CHECKPOINT_H
+#define GPLAY_RABBIT_CHECKPOINT_H
+/*
+Checkpoint - Saving and restoring unfinished renders
+A checkpoint holds the accumulation buffer and whatever is needed to continue each pixel's sample sequence.
+Sampler values are pure functions of (sampler type, sample count, seed, pixel, sample index), so the per-pixel sample
+counts together with the sampler settings are the complete random number state of a render.
+Binary layout, native byte order:
+    magic "GPRBCKPT", CheckpointHeader fields in declaration order,
+    per pixel in scanline order: RGB sum as 3 doubles, then luminance square sums as doubles, then sample counts as ints
+*/
+
+#include <cstdint>
+#include <string>
+#include "rabbit/framebuffer.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+// CheckpointHeader the render settings a checkpoint belongs to, resuming requires all of them to match
+class CheckpointHeader {
+public:
+    static const uint32_t kVersion = 2;
+
+    uint32_t version = kVersion;
+    int32_t width = 0;
+    int32_t height = 0;
+    // SamplerType and the samples per pixel the samplers were created with
+    uint32_t sampler_type = 0;
+    int32_t sampler_samples_per_pixel = 0;
+    uint64_t seed = 0;
+    // Fingerprint of the scene and the path settings the pixels depend on, e.g. camera, max depth and scene name
+    uint64_t scene_hash = 0;
+
+    bool operator==(const CheckpointHeader& other) const;
+};
+
+enum class CheckpointLoadResult {
+    kNotFound,
+    kLoaded,
+    // The file exists but is damaged or belongs to a render with other settings
+    kInvalid,
+};
+
+// SaveCheckpoint writes framebuffer to path, the previous checkpoint is replaced only once the new one is complete
+bool SaveCheckpoint(const std::string& path, const CheckpointHeader& header, const Framebuffer& framebuffer);
+
+// LoadCheckpoint restores framebuffer from path if the checkpoint there was written with the expected header
+CheckpointLoadResult LoadCheckpoint(const std::string& path, const CheckpointHeader& expected, Framebuffer& framebuffer);
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_CHECKPOINT_H
@@ -0,0 +1,580 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "rabbit/distributed.h"
+#include "rabbit/parallel.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+const char kHelloMagic[8] = {'G', 'P', 'R', 'B', 'W', 'O', 'R', 'K'};
+const uint32_t kProtocolVersion = 2;
+// Longest render name a coordinator accepts in a hello
+const uint32_t kMaxNameLength = 4096;
+
+// Messages of the coordinator to a worker connection, non-negative values are tile indices
+const int32_t kMessageDone = -1;
+const int32_t kMessageWrongJob = -2;
+
+// Pause of a worker before it tries again to reach a coordinator that is not listening yet or busy with another render
+const int kRetryMilliseconds = 100;
+// Interval at which the coordinator checks its local workers while it waits for connections
+const int kPollMilliseconds = 100;
+// Time a new connection has to send its hello
+const double kHelloTimeoutSeconds = 10;
+// Once tile times are known, a result is given up after this many times the slowest tile, but not below the minimum
+const double kResultTimeoutFactor = 10;
+const double kMinResultTimeoutSeconds = 10;
+
+#ifdef MSG_NOSIGNAL
+// a closed peer makes send fail instead of raising SIGPIPE
+const int kSendFlags = MSG_NOSIGNAL;
+#else
+const int kSendFlags = 0;
+#endif
+
+// Socket owns a socket descriptor
+class Socket {
+public:
+    explicit Socket(int fd = -1) : _fd(fd) {}
+
+    ~Socket() {
+        Close();
+    }
+
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+
+    inline int Fd() const {
+        return _fd;
+    }
+
+    inline bool IsOpen() const {
+        return _fd >= 0;
+    }
+
+    void Reset(int fd) {
+        Close();
+        _fd = fd;
+    }
+
+    void Close() {
+        if (_fd >= 0) {
+            close(_fd);
+            _fd = -1;
+        }
+    }
+
+    bool SendAll(const void* data, size_t size) {
+        const char* bytes = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t sent = send(_fd, bytes, size, kSendFlags);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent <= 0) {
+                return false;
+            }
+            bytes += sent;
+            size -= static_cast<size_t>(sent);
+        }
+        return true;
+    }
+
+    bool ReceiveAll(void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            ssize_t received = recv(_fd, bytes, size, 0);
+            if (received < 0 && errno == EINTR) {
+                continue;
+            }
+            if (received <= 0) {
+                return false;
+            }
+            bytes += received;
+            size -= static_cast<size_t>(received);
+        }
+        return true;
+    }
+
+    template <typename T>
+    bool Send(const T& value) {
+        return SendAll(&value, sizeof(T));
+    }
+
+    template <typename T>
+    bool Receive(T& value) {
+        return ReceiveAll(&value, sizeof(T));
+    }
+
+    // SetReceiveTimeout limits how long a receive blocks, 0 means forever
+    void SetReceiveTimeout(double seconds) {
+        timeval timeout = {};
+        timeout.tv_sec = static_cast<time_t>(seconds);
+        timeout.tv_usec = static_cast<suseconds_t>((seconds - timeout.tv_sec) * 1e6);
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    }
+
+    // ConfigureConnection sends the small tile messages right away
+    void ConfigureConnection() {
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        // keepalive lets a coordinator notice a worker host that went away without closing the connection
+        setsockopt(_fd, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    }
+
+private:
+    int _fd;
+};
+
+template <typename T>
+void WriteValue(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// TileBytes size of a tile result as written by Framebuffer::WriteTile
+size_t TileBytes(const Tile& tile) {
+    return static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0) * (4 * sizeof(double) + sizeof(int));
+}
+
+std::string EncodeHello(const RenderJob& job) {
+    std::ostringstream out;
+    out.write(kHelloMagic, sizeof(kHelloMagic));
+    WriteValue(out, kProtocolVersion);
+    WriteValue(out, job.settings.version);
+    WriteValue(out, job.settings.width);
+    WriteValue(out, job.settings.height);
+    WriteValue(out, job.settings.sampler_type);
+    WriteValue(out, job.settings.sampler_samples_per_pixel);
+    WriteValue(out, job.settings.seed);
+    WriteValue(out, job.settings.scene_hash);
+    WriteValue(out, job.tile_size);
+    WriteValue(out, static_cast<uint32_t>(job.name.size()));
+    out.write(job.name.data(), job.name.size());
+    return out.str();
+}
+
+// ReceiveHello reads the hello of a worker connection, false if it is not a worker of this protocol version
+bool ReceiveHello(Socket& socket, RenderJob& job) {
+    char magic[sizeof(kHelloMagic)];
+    uint32_t protocol_version = 0;
+    if (!socket.ReceiveAll(magic, sizeof(magic)) || std::memcmp(magic, kHelloMagic, sizeof(magic)) != 0 ||
+        !socket.Receive(protocol_version) || protocol_version != kProtocolVersion) {
+        return false;
+    }
+    uint32_t name_length = 0;
+    bool ok = socket.Receive(job.settings.version) && socket.Receive(job.settings.width) &&
+              socket.Receive(job.settings.height) && socket.Receive(job.settings.sampler_type) &&
+              socket.Receive(job.settings.sampler_samples_per_pixel) && socket.Receive(job.settings.seed) &&
+              socket.Receive(job.settings.scene_hash) && socket.Receive(job.tile_size) && socket.Receive(name_length) &&
+              name_length <= kMaxNameLength;
+    if (!ok) {
+        return false;
+    }
+    job.name.resize(name_length);
+    return name_length == 0 || socket.ReceiveAll(&job.name[0], name_length);
+}
+
+// Listen opens a TCP socket that accepts connections on all interfaces, port 0 picks a free port
+// Returns the descriptor and stores the port actually used, -1 on failure
+int Listen(int port, int& bound_port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    // consecutive renders of one program listen on the same port
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    socklen_t length = sizeof(address);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 ||
+        getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        close(fd);
+        return -1;
+    }
+    bound_port = ntohs(address.sin_port);
+    return fd;
+}
+
+// Connect opens a TCP connection to host:port, -1 if nobody accepts it
+int Connect(const std::string& host, int port) {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* address = addresses; address && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+// TileQueue the tiles of a distributed render that are not merged yet
+class TileQueue {
+public:
+    explicit TileQueue(int num_tiles) : _remaining(num_tiles) {
+        for (int i = 0; i < num_tiles; i++) {
+            _pending.push_back(i);
+        }
+    }
+
+    // Take waits for a tile that nobody renders, -1 once all tiles are merged or the render is aborted
+    int Take() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _changed.wait(lock, [this] { return !_pending.empty() || _remaining == 0 || _aborted; });
+        if (_remaining == 0 || _aborted) {
+            return -1;
+        }
+        int tile_index = _pending.front();
+        _pending.pop_front();
+        return tile_index;
+    }
+
+    // Return puts back a tile whose worker is gone, it is handed out next
+    void Return(int tile_index) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.push_front(tile_index);
+        _changed.notify_one();
+    }
+
+    // Finish marks a tile as merged and returns the number of tiles left
+    int Finish() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_remaining == 0) {
+            _changed.notify_all();
+        }
+        return _remaining;
+    }
+
+    void Abort() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _aborted = true;
+        _changed.notify_all();
+    }
+
+    int Remaining() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _remaining;
+    }
+
+    // RecordTileTime remembers how long a worker took for a tile
+    void RecordTileTime(double seconds) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _slowest_tile_seconds = std::max(_slowest_tile_seconds, seconds);
+    }
+
+    // ResultTimeout how long to wait for the result of a tile, first_timeout until a tile time is known
+    double ResultTimeout(double first_timeout) const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_slowest_tile_seconds <= 0) {
+            return first_timeout;
+        }
+        return std::max(kMinResultTimeoutSeconds, kResultTimeoutFactor * _slowest_tile_seconds);
+    }
+
+private:
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<int> _pending;
+    int _remaining;
+    bool _aborted = false;
+    double _slowest_tile_seconds = 0;
+};
+
+// ServeWorker hands tiles to one worker connection and merges its results into framebuffer
+// A result that does not arrive within the queue's result timeout is given up like a broken connection
+void ServeWorker(int fd, const RenderJob& job, const std::vector<Tile>& tiles, const DistributedOptions& options,
+                 TileQueue& queue, std::atomic<int>& num_connections, std::mutex& progress_mutex,
+                 Framebuffer& framebuffer) {
+    using Clock = std::chrono::steady_clock;
+    Socket socket(fd);
+    socket.ConfigureConnection();
+    socket.SetReceiveTimeout(kHelloTimeoutSeconds);
+    RenderJob worker_job;
+    if (!ReceiveHello(socket, worker_job)) {
+        num_connections--;
+        return;
+    }
+    if (!(worker_job == job)) {
+        // most likely a worker that already moved on to the next render of the program, it asks again later
+        socket.Send(kMessageWrongJob);
+        num_connections--;
+        return;
+    }
+
+    std::string result;
+    while (true) {
+        int32_t tile_index = queue.Take();
+        if (tile_index < 0) {
+            socket.Send(kMessageDone);
+            break;
+        }
+        const Tile& tile = tiles[tile_index];
+        result.resize(TileBytes(tile));
+        int32_t result_index = -1;
+        double timeout = queue.ResultTimeout(options.result_timeout_seconds);
+        socket.SetReceiveTimeout(timeout);
+        Clock::time_point sent = Clock::now();
+        errno = 0;
+        if (!socket.Send(tile_index) || !socket.Receive(result_index) || result_index != tile_index ||
+            !socket.ReceiveAll(&result[0], result.size())) {
+            bool timed_out = errno == EAGAIN || errno == EWOULDBLOCK;
+            // closing the connection stops a late result from arriving after the tile was handed out again
+            socket.Close();
+            queue.Return(tile_index);
+            std::lock_guard<std::mutex> lock(progress_mutex);
+            if (timed_out) {
+                std::clog << "\nA worker took more than " << timeout << " s, tile " << tile_index
+                          << " is rendered again\n";
+            } else {
+                std::clog << "\nLost a worker connection, tile " << tile_index << " is rendered again\n";
+            }
+            break;
+        }
+        queue.RecordTileTime(std::chrono::duration<double>(Clock::now() - sent).count());
+        // the tile belongs to this connection until it is finished, no other thread writes its pixels
+        std::istringstream in(result);
+        framebuffer.ReadTile(in, tile);
+        int remaining = queue.Finish();
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+    }
+    num_connections--;
+}
+
+// ServeCoordinator renders the tiles that the coordinator sends over one connection
+// The connections of a process share framebuffer, tile_locks keeps a tile that is handed out again from being
+// rendered by two of them at once
+bool ServeCoordinator(const RenderJob& job, const std::string& hello, const std::vector<Tile>& tiles,
+                      const DistributedOptions& options, const TileRenderer& render_tile,
+                      std::vector<std::mutex>& tile_locks, Framebuffer& framebuffer) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.connect_timeout_seconds));
+
+    Socket socket;
+    int32_t message = kMessageWrongJob;
+    while (true) {
+        socket.Reset(Connect(options.coordinator_host, options.port));
+        if (socket.IsOpen()) {
+            socket.ConfigureConnection();
+            if (socket.SendAll(hello.data(), hello.size()) && socket.Receive(message) && message != kMessageWrongJob) {
+                break;
+            }
+            socket.Close();
+        }
+        if (Clock::now() >= deadline) {
+            std::cerr << "ERROR: Could not reach a coordinator for '" << job.name << "' at "
+                      << options.coordinator_host << ":" << options.port << ".\n";
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kRetryMilliseconds));
+    }
+
+    std::ostringstream result;
+    while (message != kMessageDone) {
+        if (message < 0 || message >= static_cast<int32_t>(tiles.size())) {
+            std::cerr << "ERROR: Coordinator sent an invalid tile index " << message << ".\n";
+            return false;
+        }
+        const Tile& tile = tiles[message];
+        result.str(std::string());
+        WriteValue(result, message);
+        {
+            // a tile given up on another connection may come back to this process, start again from empty pixels
+            // instead of adding a second set of samples
+            std::lock_guard<std::mutex> lock(tile_locks[message]);
+            framebuffer.ClearTile(tile);
+            render_tile(tile, framebuffer);
+            framebuffer.WriteTile(result, tile);
+        }
+        std::string bytes = result.str();
+        if (!socket.SendAll(bytes.data(), bytes.size()) || !socket.Receive(message)) {
+            std::cerr << "ERROR: Lost the connection to the coordinator.\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// AllExited reaps the local workers that have exited, true once none is left
+bool AllExited(std::vector<pid_t>& workers) {
+    bool all_exited = true;
+    for (pid_t& pid : workers) {
+        if (pid > 0 && waitpid(pid, nullptr, WNOHANG) == pid) {
+            pid = 0;
+        }
+        all_exited = all_exited && pid == 0;
+    }
+    return all_exited;
+}
+
+} // namespace
+
+DistributedOptions ResolveDistributedOptions(const DistributedOptions& requested) {
+    if (requested.role != DistributedRole::kLocal) {
+        return requested;
+    }
+
+    DistributedOptions resolved = requested;
+    auto env_coordinator = getenv("GPLAY_RABBIT_COORDINATOR");
+    auto env_local_workers = getenv("GPLAY_RABBIT_LOCAL_WORKERS");
+    auto env_worker = getenv("GPLAY_RABBIT_WORKER");
+    if (env_coordinator || env_local_workers) {
+        resolved.role = DistributedRole::kCoordinator;
+        resolved.port = env_coordinator ? std::atoi(env_coordinator) : 0;
+        resolved.local_workers = env_local_workers ? std::atoi(env_local_workers) : 0;
+    } else if (env_worker) {
+        std::string address(env_worker);
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos) {
+            std::cerr << "ERROR: GPLAY_RABBIT_WORKER must be <host>:<port>, rendering locally.\n";
+            return requested;
+        }
+        resolved.role = DistributedRole::kWorker;
+        resolved.coordinator_host = address.substr(0, colon);
+        resolved.port = std::atoi(address.c_str() + colon + 1);
+    }
+    return resolved;
+}
+
+bool RenderJob::operator==(const RenderJob& other) const {
+    return settings == other.settings && tile_size == other.tile_size && name == other.name;
+}
+
+bool CoordinateTiles(const RenderJob& job, const std::vector<Tile>& tiles, const DistributedOptions& options,
+                     int worker_threads, const TileRenderer& render_tile, Framebuffer& framebuffer) {
+    if (options.port == 0 && options.local_workers <= 0) {
+        std::cerr << "ERROR: A coordinator without local workers needs a port for remote workers.\n";
+        return false;
+    }
+    int port = 0;
+    Socket listener(Listen(options.port, port));
+    if (!listener.IsOpen()) {
+        std::cerr << "ERROR: Could not listen on port " << options.port << ".\n";
+        return false;
+    }
+    std::clog << "Coordinating '" << job.name << "' on port " << port << '\n';
+
+    std::vector<pid_t> local_workers;
+    for (int k = 0; k < options.local_workers; k++) {
+        // no render thread is running yet, the child starts with a consistent copy of the scene
+        std::clog.flush();
+        std::cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            listener.Close();
+            DistributedOptions worker_options = options;
+            worker_options.role = DistributedRole::kWorker;
+            worker_options.coordinator_host = "127.0.0.1";
+            worker_options.port = port;
+            Framebuffer worker_framebuffer(framebuffer.Width(), framebuffer.Height());
+            bool ok = WorkTiles(job, tiles, worker_options, worker_threads, render_tile, worker_framebuffer);
+            // leave without the destructors and exit handlers of the parent's objects
+            std::_Exit(ok ? 0 : 1);
+        }
+        if (pid < 0) {
+            std::cerr << "ERROR: Could not start local worker " << k << ".\n";
+        } else {
+            local_workers.push_back(pid);
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const Clock::duration connect_timeout = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.connect_timeout_seconds));
+    TileQueue queue(static_cast<int>(tiles.size()));
+    std::atomic<int> num_connections(0);
+    std::mutex progress_mutex;
+    std::vector<std::thread> connections;
+    // time since when no worker is connected and no local worker is running
+    Clock::time_point idle_since = Clock::now();
+    bool completed = true;
+    while (completed && queue.Remaining() > 0) {
+        pollfd listen_poll = {listener.Fd(), POLLIN, 0};
+        if (poll(&listen_poll, 1, kPollMilliseconds) > 0) {
+            int fd = accept(listener.Fd(), nullptr, nullptr);
+            if (fd >= 0) {
+                num_connections++;
+                connections.emplace_back(ServeWorker, fd, std::cref(job), std::cref(tiles), std::cref(options),
+                                         std::ref(queue), std::ref(num_connections), std::ref(progress_mutex),
+                                         std::ref(framebuffer));
+            }
+        }
+        if (!AllExited(local_workers) || num_connections > 0 || queue.Remaining() == 0) {
+            idle_since = Clock::now();
+        } else if (options.port == 0) {
+            // nobody else knows a port picked by the system, without local workers the render cannot finish
+            std::cerr << "\nERROR: All local workers exited before the render was finished.\n";
+            queue.Abort();
+            completed = false;
+        } else if (Clock::now() - idle_since > connect_timeout) {
+            std::cerr << "\nERROR: No worker connected to port " << port << " for " << options.connect_timeout_seconds
+                      << " s, giving up the render.\n";
+            queue.Abort();
+            completed = false;
+        }
+    }
+    listener.Close();
+    for (auto& connection : connections) {
+        connection.join();
+    }
+    for (pid_t pid : local_workers) {
+        if (pid > 0) {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    std::clog << "\rDone.                 \n";
+    return completed;
+}
+
+bool WorkTiles(const RenderJob& job, const std::vector<Tile>& tiles, const DistributedOptions& options,
+               int num_threads, const TileRenderer& render_tile, Framebuffer& framebuffer) {
+    std::string hello = EncodeHello(job);
+    std::atomic<bool> failed(false);
+    std::vector<std::mutex> tile_locks(tiles.size());
+    // one connection per render thread, each connection renders one tile at a time
+    ParallelFor(num_threads, num_threads, [&](int connection_index, int thread_index) {
+        if (!ServeCoordinator(job, hello, tiles, options, render_tile, tile_locks, framebuffer)) {
+            failed = true;
+        }
+    });
+    return !failed;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
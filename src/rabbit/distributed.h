@@ -0,0 +1,84 @@
+#ifndef GPLAY_RABBIT_DISTRIBUTED_H
+#define GPLAY_RABBIT_DISTRIBUTED_H
+/*
+Distributed rendering - a coordinator process hands out tiles to worker processes over TCP
+Every process builds the same scene and calls RenderWorld. The coordinator listens for workers, sends them tile
+indices and merges the returned tile sums into its framebuffer; only the coordinator writes the image.
+A worker opens one connection per render thread, each connection renders one tile at a time. A tile whose connection
+breaks or whose result takes much longer than the slowest tile so far goes back into the queue and is rendered by
+another worker. The samplers make
+every pixel independent of the process that renders it, so the image matches a local render exactly.
+Messages are sent in native byte order, all processes of a render have to run on the same architecture.
+*/
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "rabbit/checkpoint.h"
+#include "rabbit/framebuffer.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+enum class DistributedRole {
+    // Render with the threads of this process only
+    kLocal,
+    kCoordinator,
+    kWorker,
+};
+
+// DistributedOptions how a process takes part in a distributed render
+class DistributedOptions {
+public:
+    DistributedRole role = DistributedRole::kLocal;
+    // Coordinator: TCP port to listen on, 0 lets the system pick a free port (for local workers only)
+    // Worker: port of the coordinator
+    int port = 0;
+    // Worker: host name or address of the coordinator
+    std::string coordinator_host = "127.0.0.1";
+    // Coordinator: number of worker processes forked on this host, each with the configured render thread count
+    int local_workers = 0;
+    // Worker: how long to keep trying to reach a coordinator that serves the same render
+    // Coordinator with a port: how long to wait for workers while none is connected
+    double connect_timeout_seconds = 60;
+    // Coordinator: how long a worker may take for a tile before the tile counts as lost and goes to another worker,
+    // until the first tile is done. From then on the limit is a multiple of the slowest tile so far.
+    double result_timeout_seconds = 600;
+};
+
+// ResolveDistributedOptions a local role falls back to the environment:
+// GPLAY_RABBIT_COORDINATOR=<port> makes this process a coordinator, GPLAY_RABBIT_LOCAL_WORKERS=<n> forks n local
+// workers (a coordinator without a port picks a free one), GPLAY_RABBIT_WORKER=<host>:<port> makes it a worker
+DistributedOptions ResolveDistributedOptions(const DistributedOptions& requested);
+
+// RenderJob identifies a render, a worker only accepts tiles from a coordinator with the same job
+class RenderJob {
+public:
+    CheckpointHeader settings;
+    int32_t tile_size = 0;
+    // Name of the render, e.g. its output file, tells consecutive renders of one program apart
+    std::string name;
+
+    bool operator==(const RenderJob& other) const;
+};
+
+// TileRenderer renders all samples of the pixels in tile into framebuffer
+using TileRenderer = std::function<void(const Tile& tile, Framebuffer& framebuffer)>;
+
+// CoordinateTiles hands tiles out to workers until all results are merged into framebuffer
+// render_tile is used by the forked local workers. Returns false if the render cannot be completed.
+bool CoordinateTiles(const RenderJob& job, const std::vector<Tile>& tiles, const DistributedOptions& options,
+                     int worker_threads, const TileRenderer& render_tile, Framebuffer& framebuffer);
+
+// WorkTiles renders the tiles a coordinator hands out on num_threads connections, until the coordinator is done
+// framebuffer receives only the tiles rendered by this process. Returns false if no coordinator was reached in time
+// or a connection broke.
+bool WorkTiles(const RenderJob& job, const std::vector<Tile>& tiles, const DistributedOptions& options,
+               int num_threads, const TileRenderer& render_tile, Framebuffer& framebuffer);
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_DISTRIBUTED_H
@@ -1,9 +1,505 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+
 #include "rabbit/draw.h"
+#include "rabbit/checkpoint.h"
+#include "rabbit/parallel.h"
+#include "rabbit/rng.h"
+#include "rabbit/wavefront.h"
 
 namespace gplay {
 
 namespace rabbit {
 
+namespace {
+
+// Luminance below which the adaptive error estimate no longer grows, so that black pixels can converge
+const double kAdaptiveMinLuminance = 1e-3;
+
+// HashDouble folds the bit pattern of value into hash
+inline uint64_t HashDouble(uint64_t hash, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return MixBits(hash ^ bits);
+}
+
+// SceneHash fingerprints what the pixels depend on besides the sampler settings: the camera, the path settings,
+// the scene name (the output file) and the bounds of the world, so that a checkpoint of another scene is refused
+uint64_t SceneHash(const Camera& camera, const Hittable& world, const std::string& scene_name,
+                   const RenderOptions& options) {
+    uint64_t hash = 0;
+    for (char c : scene_name) {
+        hash = MixBits(hash ^ static_cast<unsigned char>(c));
+    }
+    for (int axis = 0; axis < 3; axis++) {
+        hash = HashDouble(hash, camera.lookfrom[axis]);
+        hash = HashDouble(hash, camera.lookat[axis]);
+        hash = HashDouble(hash, camera.vup[axis]);
+        hash = HashDouble(hash, camera.bgcolor[axis]);
+    }
+    hash = HashDouble(hash, camera.vfov);
+    hash = HashDouble(hash, camera.defocus_angle);
+    hash = HashDouble(hash, camera.focus_dist);
+    hash = MixBits(hash ^ static_cast<uint64_t>(camera.MaxBounce()));
+    hash = MixBits(hash ^ static_cast<uint64_t>(options.sample_lights));
+    AxisAlignedBoundingBox bounds = world.GetBoundingBox();
+    for (int axis = 0; axis < 3; axis++) {
+        hash = HashDouble(hash, bounds.GetAxisInterval(axis).GetMin());
+        hash = HashDouble(hash, bounds.GetAxisInterval(axis).GetMax());
+    }
+    return hash;
+}
+
+// SampleLight estimates the light scattered at record that arrives over the direct path from a randomly picked light,
+// weighted against the chance that the material samples the same direction
+Color SampleLight(const Ray& r_in, const HitRecord& record, const Hittable& world, const MaterialTable& materials,
+                  const LightList& lights, Sampler& sampler) {
+    LightSample sample;
+    if (!SampleLightDirection(lights, r_in, record, materials[record.material_id], sampler, sample)) {
+        return Color(0,0,0);
+    }
+    return TraceLightSample(sample, world, materials, sampler.Stream());
+}
+
+// SurvivesRoulette plays Russian roulette for the path leaving vertex depth with throughput: dim paths continue only
+// with probability q and the survivors are divided by q, which keeps the estimate unbiased while most of the work
+// goes into paths that still carry light
+bool SurvivesRoulette(int depth, Color& throughput, Sampler& sampler) {
+    if (depth < kRouletteStartDepth) {
+        return true;
+    }
+    double q = RouletteSurvival(throughput);
+    if (sampler.Get1D() >= q) {
+        return false;
+    }
+    throughput = throughput / q;
+    return true;
+}
+
+// TracePath continues a path at vertex depth along ray and adds the light it gathers to radiance, see RayColor
+void TracePath(Ray ray, int depth, int depth_limit, Color throughput, double prev_scatter_pdf, const Camera& camera,
+               const Hittable& world, const MaterialTable& materials, const LightList& lights, Sampler& sampler,
+               Color& radiance) {
+    // Iterative form of L = Le + weight * L(scattered): the product of the sample weights along the path so far
+    // (the throughput) weights everything gathered at the current vertex.
+    // prev_scatter_pdf is the density with which the last vertex scattered into ray, 0 for camera rays and specular
+    // scattering, whose light can not have been sampled directly.
+    // Intersection queries take what they need (e.g. volume scattering) from the sample's own stream
+    RandomStream& rng = sampler.Stream();
+
+    // Once the bounce limit is reached, no more light is gathered.
+    for (; depth < depth_limit; depth++) {
+        HitRecord record;
+
+        // If the ray hits nothing, gather the background color.
+        if (!world.Hit(ray, Interval(0.001, kInfinity), record, rng)) {
+            radiance += throughput * camera.BackgroundColor();
+            break;
+        }
+
+        const Material& material = materials[record.material_id];
+        if (material.IsEmissive()) {
+            // A light that the previous vertex could have sampled directly shares its contribution with that sample
+            double weight = 1;
+            if (prev_scatter_pdf > 0 && lights.Contains(record.prim)) {
+                double light_pdf = lights.DirectionPdf(*record.prim, ray.GetEndpoint(), ray.GetDirection(), ray.GetTime());
+                weight = PowerHeuristic(prev_scatter_pdf, light_pdf);
+            }
+            radiance += throughput * material.Emitted(record.u, record.v, record.hitpoint) * weight;
+        }
+
+        ScatterSample sample;
+        if (!material.Sample(ray, record, sample, sampler)) {
+            break;
+        }
+
+        if (!sample.IsSpecular() && !lights.Empty()) {
+            radiance += throughput * SampleLight(ray, record, world, materials, lights, sampler);
+        }
+        prev_scatter_pdf = sample.pdf;
+        throughput = throughput * sample.weight;
+        if (!SurvivesRoulette(depth, throughput, sampler)) {
+            break;
+        }
+        ray = sample.scattered;
+    }
+}
+
+// TracePacketPaths traces the paths of count camera rays, which start at the sampler states state, like RayColor and
+// adds them to the framebuffer. The camera rays and the shadow rays of the first vertices are traced as one packet
+// each; the scattered rays point every which way and continue path by path.
+void TracePacketPaths(const Ray* rays, SamplerState* state, int count, const Camera& camera, const Hittable& world,
+                      const MaterialTable& materials, const LightList& lights, Sampler& sampler,
+                      Framebuffer& framebuffer) {
+    RayPacket packet;
+    for (int n = 0; n < count; n++) {
+        packet.Add(rays[n], Interval(0.001, kInfinity), state[n].rng);
+    }
+    HitRecord records[RayPacket::kMaxSize];
+    bool hits[RayPacket::kMaxSize];
+    world.HitPacket(packet, records, hits);
+
+    // the first vertex of every path, the throughput of a camera ray is 1 and its emission gets no MIS weight
+    Color radiance[RayPacket::kMaxSize];
+    ScatterSample scatter[RayPacket::kMaxSize];
+    bool scattered[RayPacket::kMaxSize] = {};
+    LightSample light_sample[RayPacket::kMaxSize];
+    RayPacket shadow_packet;
+    int shadow_paths[RayPacket::kMaxSize];
+    for (int n = 0; n < count; n++) {
+        radiance[n] = Color(0,0,0);
+        if (!hits[n]) {
+            radiance[n] = camera.BackgroundColor();
+            continue;
+        }
+        const HitRecord& record = records[n];
+        const Material& material = materials[record.material_id];
+        if (material.IsEmissive()) {
+            radiance[n] = material.Emitted(record.u, record.v, record.hitpoint);
+        }
+        sampler.RestoreState(state[n]);
+        if (!material.Sample(rays[n], record, scatter[n], sampler)) {
+            continue;
+        }
+        if (!scatter[n].IsSpecular() && !lights.Empty() &&
+            SampleLightDirection(lights, rays[n], record, material, sampler, light_sample[n]) &&
+            LocateLightSample(light_sample[n], materials, sampler.Stream())) {
+            shadow_paths[shadow_packet.Size()] = n;
+            shadow_packet.Add(light_sample[n].shadow, ShadowInterval(light_sample[n]), state[n].rng);
+        }
+        state[n] = sampler.SaveState();
+        scattered[n] = true;
+    }
+
+    if (shadow_packet.Size() > 0) {
+        bool occluded[RayPacket::kMaxSize] = {};
+        world.OccludedPacket(shadow_packet, occluded);
+        for (int m = 0; m < shadow_packet.Size(); m++) {
+            if (!occluded[m]) {
+                radiance[shadow_paths[m]] += light_sample[shadow_paths[m]].light_color;
+            }
+        }
+    }
+
+    for (int n = 0; n < count; n++) {
+        if (scattered[n]) {
+            sampler.RestoreState(state[n]);
+            Color throughput = scatter[n].weight;
+            if (SurvivesRoulette(0, throughput, sampler)) {
+                TracePath(scatter[n].scattered, 1, camera.MaxBounce(), throughput, scatter[n].pdf, camera, world,
+                          materials, lights, sampler, radiance[n]);
+            }
+        }
+        framebuffer.AddSample(state[n].pixel_x, state[n].pixel_y, radiance[n]);
+    }
+}
+
+// RenderTilePackets RenderTileSamples path by path, with the paths of consecutive samples started in packets
+void RenderTilePackets(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                       const LightList& lights, const Tile& tile, const std::function<int(int, int)>& num_samples,
+                       Sampler& sampler, Framebuffer& framebuffer) {
+    Ray rays[RayPacket::kMaxSize];
+    SamplerState state[RayPacket::kMaxSize];
+    int count = 0;
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            // the pixel's earlier samples are all in the framebuffer; num_samples depends on the sample count,
+            // which grows as soon as a packet with some of the pixel's samples is done
+            int first_sample = framebuffer.GetSampleCount(i, j);
+            int end_sample = first_sample + num_samples(i, j);
+            for (int sample = first_sample; sample < end_sample; sample++) {
+                sampler.StartPixelSample(i, j, sample);
+                rays[count] = camera.GetRay(i, j, sampler);
+                state[count] = sampler.SaveState();
+                if (++count == RayPacket::kMaxSize) {
+                    TracePacketPaths(rays, state, count, camera, world, materials, lights, sampler, framebuffer);
+                    count = 0;
+                }
+            }
+        }
+    }
+    if (count > 0) {
+        TracePacketPaths(rays, state, count, camera, world, materials, lights, sampler, framebuffer);
+    }
+}
+
+// PixelError standard error of the mean luminance of pixel i, j after the gamma 2 transform of WriteColor
+double PixelError(const Framebuffer& framebuffer, int i, int j) {
+    int n = framebuffer.GetSampleCount(i, j);
+    if (n < 2) {
+        return kInfinity;
+    }
+    double mean = Luminance(framebuffer.GetPixelColor(i, j));
+    double standard_error = std::sqrt(framebuffer.GetLuminanceVariance(i, j) / n);
+    // first order error propagation through sqrt: d sqrt(L) = dL / (2 sqrt(L))
+    return standard_error / (2 * std::sqrt(std::fmax(mean, kAdaptiveMinLuminance)));
+}
+
+// RenderTileSamples traces num_samples(i, j) more samples of every pixel i, j of tile with the engine options selects
+void RenderTileSamples(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                       const LightList& lights, const Tile& tile, const std::function<int(int, int)>& num_samples,
+                       const RenderOptions& options, Sampler& sampler, Framebuffer& framebuffer) {
+    if (options.wavefront) {
+        RenderTileWavefront(camera, world, materials, lights, tile, num_samples, options.ray_packets, sampler,
+                            framebuffer);
+        return;
+    }
+    if (options.ray_packets && camera.MaxBounce() > 0) {
+        RenderTilePackets(camera, world, materials, lights, tile, num_samples, sampler, framebuffer);
+        return;
+    }
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            RenderPixelSamples(camera, world, materials, lights, i, j, num_samples(i, j), sampler, framebuffer);
+        }
+    }
+}
+
+// AdaptiveMaxSamples sample limit per pixel of the adaptive mode
+int AdaptiveMaxSamples(const Camera& camera, const RenderOptions& options) {
+    return options.adaptive_max_samples > 0 ? options.adaptive_max_samples : camera.SamplesPerPixel();
+}
+
+// ImageError RMS of the pixel error estimates, infinite while a pixel has fewer than two samples
+double ImageError(const Framebuffer& framebuffer) {
+    double sum_squared = 0;
+    for (int j = 0; j < framebuffer.Height(); j++) {
+        for (int i = 0; i < framebuffer.Width(); i++) {
+            double error = PixelError(framebuffer, i, j);
+            sum_squared += error * error;
+        }
+    }
+    return std::sqrt(sum_squared / (static_cast<double>(framebuffer.Width()) * framebuffer.Height()));
+}
+
+// CollectRenderStats sample counts and error estimate of a framebuffer
+RenderStats CollectRenderStats(const Framebuffer& framebuffer) {
+    RenderStats stats;
+    stats.min_samples_per_pixel = framebuffer.Width() * framebuffer.Height() > 0 ? framebuffer.GetSampleCount(0, 0) : 0;
+    for (int j = 0; j < framebuffer.Height(); j++) {
+        for (int i = 0; i < framebuffer.Width(); i++) {
+            int count = framebuffer.GetSampleCount(i, j);
+            stats.total_samples += count;
+            stats.min_samples_per_pixel = std::min(stats.min_samples_per_pixel, count);
+            stats.max_samples_per_pixel = std::max(stats.max_samples_per_pixel, count);
+        }
+    }
+    stats.estimated_error = stats.min_samples_per_pixel >= 2 ? ImageError(framebuffer) : 0;
+    return stats;
+}
+
+// Checkpointer saves the framebuffer to the checkpoint file of a render, does nothing if the path is empty
+class Checkpointer {
+public:
+    Checkpointer(const std::string& path, const CheckpointHeader& header, double interval_seconds)
+        : _path(path), _header(header), _interval_seconds(interval_seconds), _last_save(Clock::now()) {}
+
+    inline bool Enabled() const {
+        return !_path.empty();
+    }
+
+    inline double IntervalSeconds() const {
+        return _interval_seconds;
+    }
+
+    // SaveIfDue saves the framebuffer if the checkpoint interval has passed since the last save
+    // The caller ensures that no thread is rendering into framebuffer
+    void SaveIfDue(const Framebuffer& framebuffer) {
+        if (std::chrono::duration<double>(Clock::now() - _last_save).count() >= _interval_seconds) {
+            Save(framebuffer);
+        }
+    }
+
+    void Save(const Framebuffer& framebuffer) {
+        if (Enabled()) {
+            SaveCheckpoint(_path, _header, framebuffer);
+            _last_save = Clock::now();
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::string _path;
+    CheckpointHeader _header;
+    double _interval_seconds;
+    Clock::time_point _last_save;
+};
+
+// UpdateActivePixels selects the pixels of the next adaptive pass from the samples taken so far
+// A single pixel's variance estimate is itself noisy, so a noisy pixel keeps its neighbours active as well
+void UpdateActivePixels(const Framebuffer& framebuffer, int max_samples, double error_threshold,
+                        std::vector<uint8_t>& noisy, std::vector<uint8_t>& active) {
+    int width = framebuffer.Width();
+    int height = framebuffer.Height();
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            noisy[static_cast<size_t>(j) * width + i] =
+                framebuffer.GetSampleCount(i, j) < max_samples && PixelError(framebuffer, i, j) > error_threshold;
+        }
+    }
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            bool is_active = false;
+            if (framebuffer.GetSampleCount(i, j) < max_samples) {
+                for (int y = std::max(j-1, 0); y <= std::min(j+1, height-1) && !is_active; y++) {
+                    for (int x = std::max(i-1, 0); x <= std::min(i+1, width-1) && !is_active; x++) {
+                        is_active = noisy[static_cast<size_t>(y) * width + x] != 0;
+                    }
+                }
+            }
+            active[static_cast<size_t>(j) * width + i] = is_active;
+        }
+    }
+}
+
+// RenderAdaptive renders the image in passes, see RenderOptions::adaptive
+// A resumed render recomputes the active pixels from the framebuffer, which gives the same pixels as the
+// uninterrupted run because checkpoints are saved only between passes
+// Returns the number of passes
+int RenderAdaptive(const Camera& camera, const Hittable& world, const MaterialTable& materials, const LightList& lights,
+                   const std::vector<Tile>& tiles, int num_threads, const RenderOptions& options,
+                   Checkpointer& checkpointer, Framebuffer& framebuffer) {
+    int width = framebuffer.Width();
+    int height = framebuffer.Height();
+    int max_samples = AdaptiveMaxSamples(camera, options);
+    int pass_samples = std::max(1, std::min(options.adaptive_min_samples, max_samples));
+
+    // Whether a pixel receives samples in the next pass, scanline order
+    std::vector<uint8_t> active(static_cast<size_t>(width) * height, 1);
+    std::vector<uint8_t> noisy(active.size(), 0);
+    if (CollectRenderStats(framebuffer).max_samples_per_pixel > 0) {
+        UpdateActivePixels(framebuffer, max_samples, options.adaptive_error_threshold, noisy, active);
+    }
+    int passes = 0;
+    for (;; passes++) {
+        size_t num_active = std::count(active.begin(), active.end(), 1);
+        if (num_active == 0) {
+            break;
+        }
+        std::clog << "\rPass " << passes + 1 << ": " << num_active << " pixels active        " << std::flush;
+
+        ParallelFor(static_cast<int>(tiles.size()), num_threads, [&](int tile_index, int thread_index) {
+            // the samplers are sized for the sample limit, a pixel's samples are a prefix of one sequence
+            std::unique_ptr<Sampler> sampler = MakeSampler(options.sampler_type, max_samples, width, height, options.seed);
+            auto num_samples = [&](int i, int j) {
+                if (!active[static_cast<size_t>(j) * width + i]) {
+                    return 0;
+                }
+                return std::min(pass_samples, max_samples - framebuffer.GetSampleCount(i, j));
+            };
+            RenderTileSamples(camera, world, materials, lights, tiles[tile_index], num_samples, options, *sampler,
+                              framebuffer);
+        });
+
+        UpdateActivePixels(framebuffer, max_samples, options.adaptive_error_threshold, noisy, active);
+        checkpointer.SaveIfDue(framebuffer);
+    }
+    std::clog << "\rDone.                                   \n";
+    return passes;
+}
+
+// RenderPasses renders full image passes until the camera's SamplesPerPixel() are taken or a stop condition is met
+// The uniform mode takes all samples in one pass, unless passes have to end at checkpoints or at the deadline;
+// the progressive mode doubles the samples per pixel with every pass, see RenderOptions::progressive
+// A resumed render first brings all pixels to the same sample count, since a pass interrupted by the deadline
+// leaves the tiles it has not started behind
+// Returns the number of passes
+int RenderPasses(const Camera& camera, const Hittable& world, const MaterialTable& materials, const LightList& lights,
+                 const std::vector<Tile>& tiles, int num_threads, const RenderOptions& options,
+                 Checkpointer& checkpointer, Framebuffer& framebuffer) {
+    using Clock = std::chrono::steady_clock;
+    const Clock::time_point start = Clock::now();
+    const bool has_deadline = options.time_budget_seconds > 0;
+    const Clock::time_point deadline = start + std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(has_deadline ? options.time_budget_seconds : 0));
+
+    int max_samples = camera.SamplesPerPixel();
+    int num_tiles = static_cast<int>(tiles.size());
+    // Samples per pixel of all complete passes
+    int samples_done = CollectRenderStats(framebuffer).min_samples_per_pixel;
+    double seconds_per_sample = 0;
+    int passes = 0;
+    while (samples_done < max_samples) {
+        int pass_samples = max_samples - samples_done;
+        if (options.progressive) {
+            pass_samples = std::min(std::max(samples_done, 1), pass_samples);
+        }
+        if (passes == 0 && (has_deadline || checkpointer.Enabled())) {
+            // a pass of one sample per pixel measures the rendering speed
+            pass_samples = 1;
+        } else if (passes > 0) {
+            // the sample counts are clamped as doubles, a fast pass (or one too fast to measure, which counts as
+            // no limit) would overflow int
+            if (checkpointer.Enabled() && seconds_per_sample > 0) {
+                // end the pass at the next checkpoint, a killed job then loses at most one checkpoint interval
+                double interval_samples = checkpointer.IntervalSeconds() / seconds_per_sample;
+                pass_samples = std::max(1, static_cast<int>(std::min<double>(pass_samples, interval_samples)));
+            }
+            if (has_deadline) {
+                // shorten the pass to what is expected to fit in the remaining time
+                double remaining = std::chrono::duration<double>(deadline - Clock::now()).count();
+                if (remaining <= 0) {
+                    pass_samples = 0;
+                } else if (seconds_per_sample > 0) {
+                    pass_samples = static_cast<int>(std::min<double>(pass_samples, remaining / seconds_per_sample));
+                }
+                if (pass_samples < 1) {
+                    break;
+                }
+            }
+        }
+        int pass_target = samples_done + pass_samples;
+
+        std::atomic<bool> out_of_time(false);
+        std::atomic<int> tiles_done(0);
+        std::mutex progress_mutex;
+        Clock::time_point pass_start = Clock::now();
+        ParallelFor(num_tiles, num_threads, [&](int tile_index, int thread_index) {
+            if (has_deadline && Clock::now() >= deadline) {
+                out_of_time = true;
+                return;
+            }
+            std::unique_ptr<Sampler> sampler = MakeSampler(options.sampler_type, max_samples,
+                                                           framebuffer.Width(), framebuffer.Height(), options.seed);
+            auto num_samples = [&](int i, int j) {
+                return std::max(0, pass_target - framebuffer.GetSampleCount(i, j));
+            };
+            RenderTileSamples(camera, world, materials, lights, tiles[tile_index], num_samples, options, *sampler,
+                              framebuffer);
+
+            if (!options.progressive) {
+                int done = tiles_done.fetch_add(1) + 1;
+                std::lock_guard<std::mutex> lock(progress_mutex);
+                std::clog << "\rTiles remaining: " << (num_tiles - done) << ' ' << std::flush;
+            }
+        });
+        passes++;
+        if (out_of_time) {
+            break;
+        }
+        samples_done = pass_target;
+        seconds_per_sample = std::chrono::duration<double>(Clock::now() - pass_start).count() / pass_samples;
+        checkpointer.SaveIfDue(framebuffer);
+
+        if (options.progressive) {
+            double error = ImageError(framebuffer);
+            std::clog << "\rPass " << passes << ": " << samples_done << " samples per pixel, error " << error << "        "
+                      << std::flush;
+            if (options.progressive_target_error > 0 && error <= options.progressive_target_error) {
+                break;
+            }
+        }
+    }
+    std::clog << "\rDone.                                                  \n";
+    return passes;
+}
+
+} // namespace
+
 void WriteColor(std::ostream& out, const Color& pixel_color) {
     // Apply a linear to gamma transform for gamma 2
     auto r = LinearToGamma(pixel_color.R());
@@ -20,59 +516,165 @@ void WriteColor(std::ostream& out, const Color& pixel_color) {
     out << rbyte << ' ' << gbyte << ' ' << bbyte << '\n';
 }
 
-Color RayColor(const Ray& r, int depth_limit, const Camera& camera, const Hittable& world) {
-    // If we have exceeded the ray bounce limit, no more light is gathered.
-    if (depth_limit <= 0) {
-        return Color(0,0,0);
+bool WriteSampleCounts(const Framebuffer& framebuffer, const std::string& outfile) {
+    std::ofstream file(outfile);
+    if (!file.is_open()) {
+        std::cerr << "ERROR: Could not open image file '" << outfile << "'.\n";
+        return false;
+    }
+
+    int max_count = 1;
+    for (int j = 0; j < framebuffer.Height(); j++) {
+        for (int i = 0; i < framebuffer.Width(); i++) {
+            max_count = std::max(max_count, framebuffer.GetSampleCount(i, j));
+        }
+    }
+
+    file << "P3\n" << framebuffer.Width() << ' ' << framebuffer.Height() << "\n255\n";
+    for (int j = 0; j < framebuffer.Height(); j++) {
+        for (int i = 0; i < framebuffer.Width(); i++) {
+            int level = static_cast<int>(255.0 * framebuffer.GetSampleCount(i, j) / max_count);
+            file << level << ' ' << level << ' ' << level << '\n';
+        }
     }
+    return true;
+}
 
-    HitRecord record;
+bool WriteFramebuffer(const Framebuffer& framebuffer, const std::string& outfile) {
+    std::ofstream file(outfile);
+    if (!file.is_open()) {
+        std::cerr << "ERROR: Could not open image file '" << outfile << "'.\n";
+        return false;
+    }
 
-    // If the ray hits nothing, return the background color.
-    if (!world.Hit(r, Interval(0.001, kInfinity), record)) {
-        return camera.BackgroundColor();
+    file << "P3\n" << framebuffer.Width() << ' ' << framebuffer.Height() << "\n255\n";
+    for (int j = 0; j < framebuffer.Height(); j++) {
+        for (int i = 0; i < framebuffer.Width(); i++) {
+            WriteColor(file, framebuffer.GetPixelColor(i, j));
+        }
     }
+    return true;
+}
 
-    Ray scattered;
-    Color attenuation;
+Color RayColor(const Ray& r, int depth_limit, const Camera& camera, const Hittable& world, const MaterialTable& materials,
+               const LightList& lights, Sampler& sampler) {
+    Color radiance(0,0,0);
+    TracePath(r, 0, depth_limit, Color(1,1,1), 0, camera, world, materials, lights, sampler, radiance);
+    return radiance;
+}
 
-    Color color_from_emission = record.material->Emitted(record.u, record.v, record.hitpoint);
+void RenderPixelSamples(const Camera& camera, const Hittable& world, const MaterialTable& materials, const LightList& lights,
+                        int i, int j, int num_samples, Sampler& sampler, Framebuffer& framebuffer) {
+    int first_sample = framebuffer.GetSampleCount(i, j);
+    for (int sample = first_sample; sample < first_sample + num_samples; sample++) {
+        // the sampler values depend only on pixel and sample, so the result does not depend on which thread renders it
+        sampler.StartPixelSample(i, j, sample);
+        Ray r = camera.GetRay(i, j, sampler);
+        framebuffer.AddSample(i, j, RayColor(r, camera.MaxBounce(), camera, world, materials, lights, sampler));
+    }
+}
 
-    if (!record.material->Scatter(r, record, attenuation, scattered)) {
-        return color_from_emission;
+void RenderTile(const Camera& camera, const Hittable& world, const MaterialTable& materials, const LightList& lights,
+                const Tile& tile, Sampler& sampler, Framebuffer& framebuffer) {
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            RenderPixelSamples(camera, world, materials, lights, i, j, camera.SamplesPerPixel(), sampler, framebuffer);
+        }
     }
-    Color color_from_scatter = attenuation * RayColor(scattered, depth_limit-1, camera, world);
+}
 
-    return color_from_emission + color_from_scatter;
+std::ostream& operator<<(std::ostream& out, const RenderStats& stats) {
+    out << "Render: " << stats.passes << " passes, " << stats.total_samples << " samples, "
+        << stats.min_samples_per_pixel << "-" << stats.max_samples_per_pixel << " per pixel, "
+        << stats.render_seconds << " s";
+    if (stats.estimated_error > 0) {
+        out << ", estimated error " << stats.estimated_error;
+    }
+    return out;
 }
 
-void RenderWorld(const Camera& camera, const Hittable& world, const std::string& outfile) {
-    // Note that here we use C++ IO Redirection
-    // Actually, if we don't do this, another choice is using bash pipe to write to an image file
-    // Like this: ./main >> "xxx.ppm"
+RenderStats RenderWorld(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                        const std::string& outfile, const RenderOptions& options) {
+    // The image is split into tiles that the render threads pick up dynamically
+    // Each tile owns its pixels, so the threads accumulate into the shared framebuffer without locking,
+    // and the image file is written once after all tiles are done
 
-    std::fstream file;
-    file.open(outfile, std::ios::out);
-    std::streambuf* stream_buffer_cout = std::cout.rdbuf();
-    std::streambuf* stream_buffer_file = file.rdbuf();
-    std::cout.rdbuf(stream_buffer_file);
+    LightList lights = options.sample_lights ? LightList(world, materials) : LightList();
+    Framebuffer framebuffer(camera.ImageWidth(), camera.ImageHeight());
+    std::vector<Tile> tiles = GenerateTiles(camera.ImageWidth(), camera.ImageHeight(), options.tile_size);
+    int num_threads = ResolveThreadCount(options.num_threads);
 
-    std::cout << "P3\n" << camera.ImageWidth() << ' ' << camera.ImageHeight() << "\n255\n";
-    for (int j = 0; j < camera.ImageHeight(); j++) {
-        std::clog << "\rScanlines remaining: " << (camera.ImageHeight() - j) << ' ' << std::flush;
-        for (int i = 0; i < camera.ImageWidth(); i++) {
-            Color pixel_color(0,0,0);
-            for (int sample = 0; sample < camera.SamplesPerPixel(); sample++) {
-                Ray r = camera.GetRay(i, j);
-                pixel_color += RayColor(r, camera.MaxBounce(), camera, world);
-            }
-            WriteColor(std::cout, camera.PixelSamplesScaleFactor() * pixel_color);
+    DistributedOptions distributed = ResolveDistributedOptions(options.distributed);
+    const bool local = distributed.role == DistributedRole::kLocal;
+
+    CheckpointHeader header;
+    header.width = camera.ImageWidth();
+    header.height = camera.ImageHeight();
+    header.sampler_type = static_cast<uint32_t>(options.sampler_type);
+    header.sampler_samples_per_pixel = local && options.adaptive && !options.progressive
+        ? AdaptiveMaxSamples(camera, options) : camera.SamplesPerPixel();
+    header.seed = options.seed;
+    header.scene_hash = SceneHash(camera, world, outfile, options);
+    if (local && !options.checkpoint_file.empty()) {
+        switch (LoadCheckpoint(options.checkpoint_file, header, framebuffer)) {
+        case CheckpointLoadResult::kLoaded:
+            std::clog << "Resuming from checkpoint '" << options.checkpoint_file << "'.\n";
+            break;
+        case CheckpointLoadResult::kInvalid:
+            std::cerr << "ERROR: Checkpoint file '" << options.checkpoint_file
+                      << "' is damaged or was written with other render settings.\n";
+            return RenderStats();
+        case CheckpointLoadResult::kNotFound:
+            break;
         }
     }
-    std::clog << "\rDone.                 \n";
+    Checkpointer checkpointer(local ? options.checkpoint_file : std::string(), header,
+                              options.checkpoint_interval_seconds);
 
-    // restore cout buffer
-    std::cout.rdbuf(stream_buffer_cout);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int passes = 0;
+    if (!local) {
+        RenderJob job;
+        job.settings = header;
+        job.tile_size = options.tile_size;
+        job.name = outfile;
+        TileRenderer render_tile = [&](const Tile& tile, Framebuffer& target) {
+            std::unique_ptr<Sampler> sampler = MakeSampler(options.sampler_type, camera.SamplesPerPixel(),
+                                                           camera.ImageWidth(), camera.ImageHeight(), options.seed);
+            auto num_samples = [&](int i, int j) {
+                return camera.SamplesPerPixel();
+            };
+            RenderTileSamples(camera, world, materials, lights, tile, num_samples, options, *sampler, target);
+        };
+        bool completed = distributed.role == DistributedRole::kCoordinator
+            ? CoordinateTiles(job, tiles, distributed, num_threads, render_tile, framebuffer)
+            : WorkTiles(job, tiles, distributed, num_threads, render_tile, framebuffer);
+        if (!completed) {
+            return RenderStats();
+        }
+        passes = 1;
+    } else if (options.adaptive && !options.progressive) {
+        passes = RenderAdaptive(camera, world, materials, lights, tiles, num_threads, options, checkpointer, framebuffer);
+    } else {
+        passes = RenderPasses(camera, world, materials, lights, tiles, num_threads, options, checkpointer, framebuffer);
+    }
+    checkpointer.Save(framebuffer);
+
+    RenderStats stats = CollectRenderStats(framebuffer);
+    stats.passes = passes;
+    stats.render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::clog << stats << '\n';
+    if (distributed.role == DistributedRole::kWorker) {
+        // the framebuffer holds only this worker's tiles, the coordinator writes the image
+        return stats;
+    }
+
+    // whatever the stop condition, the image holds the average of all samples taken
+    WriteFramebuffer(framebuffer, outfile);
+    if (!options.sample_count_outfile.empty()) {
+        WriteSampleCounts(framebuffer, options.sample_count_outfile);
+    }
+    return stats;
 }
 
 } // namespace rabbit
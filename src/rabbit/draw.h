@@ -4,6 +4,10 @@
 #include <fstream>
 #include "rabbit/camera.h"
 #include "rabbit/material.h"
+#include "rabbit/light.h"
+#include "rabbit/sampler.h"
+#include "rabbit/framebuffer.h"
+#include "rabbit/distributed.h"
 
 namespace gplay {
 
@@ -20,11 +24,115 @@ inline double LinearToGamma(double linear_component) {
 // WriteColor writes a single pixel's color out to the standard output stream
 void WriteColor(std::ostream& out, const Color& pixel_color);
 
-// RayColor ...
-Color RayColor(const Ray& r, int depth_limit, const Camera& camera, const Hittable& world);
+// RenderOptions settings of the parallel tile renderer
+class RenderOptions {
+public:
+    // Number of render threads, non-positive means GPLAY_RABBIT_THREADS or all hardware threads
+    int num_threads = 0;
+    // Edge length of the square image tiles handed out to the render threads
+    int tile_size = 16;
+    // Seed of the samplers, the same seed gives the same image for any thread count
+    uint64_t seed = 0;
+    // Generator of the pixel, lens and bounce samples
+    SamplerType sampler_type = SamplerType::kZSobol;
+    // Sample the emissive primitives directly at every diffuse vertex and combine with the scattered rays by MIS
+    bool sample_lights = true;
+    // Trace the samples of a tile as a wavefront: batches of paths advanced together stage by stage, with the
+    // shading sorted by material, see wavefront.h. Gives the same image as the path by path renderer.
+    bool wavefront = false;
+    // Trace the camera rays of neighbouring samples and the shadow rays of their first vertices as packets,
+    // see packet.h, with the wavefront as well as with the path by path renderer.
+    // Volumes may draw their random numbers in another order, otherwise the image does not change.
+    bool ray_packets = true;
 
-// RenderWorld ...
-void RenderWorld(const Camera& camera, const Hittable& world, const std::string& outfile);
+    // Adaptive sampling: every pixel first gets adaptive_min_samples samples, then passes of as many samples go
+    // only to the pixels (and their neighbours) whose estimated error is still above adaptive_error_threshold
+    bool adaptive = false;
+    int adaptive_min_samples = 16;
+    // Sample limit per pixel of the adaptive mode, non-positive means the camera's SamplesPerPixel()
+    int adaptive_max_samples = 0;
+    // Standard error of the pixel mean, in display (gamma 2) units, at which a pixel counts as converged
+    double adaptive_error_threshold = 0.005;
+    // Progressive rendering: full image passes of 1, 1, 2, 4, ... samples per pixel, i.e. every pass doubles the
+    // samples taken so far, until the time budget is used up, the estimated image error reaches progressive_target_error
+    // or the camera's SamplesPerPixel() are taken. Takes precedence over adaptive.
+    bool progressive = false;
+    // Wall clock budget of the progressive and the uniform (neither progressive nor adaptive) mode in seconds,
+    // non-positive means no deadline
+    // A pass that would not finish in time is shortened, tiles that have not started at the deadline are skipped
+    double time_budget_seconds = 0;
+    // RMS of the pixel error estimates (see adaptive_error_threshold) at which the progressive mode stops,
+    // non-positive means no noise target
+    double progressive_target_error = 0;
+
+    // Checkpointing: if not empty, the unfinished render is saved to this file every checkpoint_interval_seconds
+    // and once at the end. A render started with an existing checkpoint continues where it stopped and gives the
+    // same image as an uninterrupted run, so a long render can be spread over several jobs, e.g. with a time budget.
+    // A checkpoint only resumes the render of the same output file with the same camera, max depth and world bounds
+    std::string checkpoint_file;
+    double checkpoint_interval_seconds = 300;
+
+    // Distributed rendering over worker processes, a local role means the GPLAY_RABBIT_COORDINATOR,
+    // GPLAY_RABBIT_LOCAL_WORKERS and GPLAY_RABBIT_WORKER environment variables decide, see distributed.h
+    // Distributed renders take all samples of a tile at once, the adaptive, progressive and checkpoint settings
+    // do not apply; num_threads is the number of connections of each worker process
+    DistributedOptions distributed;
+
+    // If not empty, an image of the number of samples taken per pixel is written to this file
+    std::string sample_count_outfile;
+};
+
+// RenderStats what a RenderWorld call actually did
+class RenderStats {
+public:
+    // Samples traced for the whole image
+    uint64_t total_samples = 0;
+    int min_samples_per_pixel = 0;
+    int max_samples_per_pixel = 0;
+    int passes = 0;
+    // Wall clock time of the rendering, without writing the image
+    double render_seconds = 0;
+    // RMS of the pixel error estimates in display units, 0 if a pixel has fewer than two samples
+    double estimated_error = 0;
+};
+
+std::ostream& operator<<(std::ostream& out, const RenderStats& stats);
+
+// WriteFramebuffer writes the resolved framebuffer as a plain PPM (P3) image file
+bool WriteFramebuffer(const Framebuffer& framebuffer, const std::string& outfile);
+
+// WriteSampleCounts writes the number of samples per pixel as a gray PPM (P3) image, white is the largest count
+bool WriteSampleCounts(const Framebuffer& framebuffer, const std::string& outfile);
+
+// Number of bounces that are always traced before Russian roulette may end a path
+const int kRouletteStartDepth = 3;
+// Upper bound of the roulette survival probability, even bright paths are ended now and then
+const double kRouletteMaxSurvival = 0.95;
+
+// RouletteSurvival probability with which Russian roulette continues a path that carries throughput
+inline double RouletteSurvival(const Color& throughput) {
+    return std::fmin(kRouletteMaxSurvival, std::fmax(throughput.R(), std::fmax(throughput.G(), throughput.B())));
+}
+
+// RayColor traces one path from r and returns the radiance it carries, iteratively with Russian roulette
+// At diffuse vertices one of the lights is sampled as well (next event estimation), both estimates are
+// weighted by the power heuristic; an empty light list gives the plain path tracer
+Color RayColor(const Ray& r, int depth_limit, const Camera& camera, const Hittable& world, const MaterialTable& materials,
+               const LightList& lights, Sampler& sampler);
+
+// RenderPixelSamples traces num_samples more samples of pixel i, j, continuing the pixel's sample sequence
+void RenderPixelSamples(const Camera& camera, const Hittable& world, const MaterialTable& materials, const LightList& lights,
+                        int i, int j, int num_samples, Sampler& sampler, Framebuffer& framebuffer);
+
+// RenderTile traces all samples of the pixels in tile and accumulates them into the framebuffer
+void RenderTile(const Camera& camera, const Hittable& world, const MaterialTable& materials, const LightList& lights,
+                const Tile& tile, Sampler& sampler, Framebuffer& framebuffer);
+
+// RenderWorld renders the image tile by tile on a pool of threads, then writes it to outfile once
+// materials resolves the material ids of the objects in world
+// A distributed worker renders the tiles handed out by its coordinator and writes no image
+RenderStats RenderWorld(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                        const std::string& outfile, const RenderOptions& options = RenderOptions());
 
 } // namespace rabbit
 
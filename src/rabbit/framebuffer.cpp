@@ -0,0 +1,111 @@
+#include "rabbit/framebuffer.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+std::vector<Tile> GenerateTiles(int width, int height, int tile_size) {
+    tile_size = tile_size > 0 ? tile_size : 1;
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tile_size) {
+        for (int x = 0; x < width; x += tile_size) {
+            Tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = x + tile_size < width ? x + tile_size : width;
+            tile.y1 = y + tile_size < height ? y + tile_size : height;
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+Framebuffer::Framebuffer(int width, int height)
+    : _width(width),
+      _height(height),
+      _sum(static_cast<size_t>(width) * height, Color(0,0,0)),
+      _sum_luminance_squared(static_cast<size_t>(width) * height, 0.0),
+      _sample_count(static_cast<size_t>(width) * height, 0) {}
+
+Color Framebuffer::GetPixelColor(int i, int j) const {
+    size_t idx = PixelIndex(i, j);
+    if (_sample_count[idx] == 0) {
+        return Color(0,0,0);
+    }
+    return _sum[idx] / static_cast<double>(_sample_count[idx]);
+}
+
+bool Framebuffer::Write(std::ostream& out) const {
+    // the sums are stored exactly, so that a restored framebuffer continues bit for bit where this one stopped
+    for (const Color& sum : _sum) {
+        double rgb[3] = {sum.R(), sum.G(), sum.B()};
+        out.write(reinterpret_cast<const char*>(rgb), sizeof(rgb));
+    }
+    out.write(reinterpret_cast<const char*>(_sum_luminance_squared.data()), _sum_luminance_squared.size() * sizeof(double));
+    out.write(reinterpret_cast<const char*>(_sample_count.data()), _sample_count.size() * sizeof(int));
+    return static_cast<bool>(out);
+}
+
+bool Framebuffer::Read(std::istream& in) {
+    for (Color& sum : _sum) {
+        double rgb[3];
+        in.read(reinterpret_cast<char*>(rgb), sizeof(rgb));
+        sum = Color(rgb[0], rgb[1], rgb[2]);
+    }
+    in.read(reinterpret_cast<char*>(_sum_luminance_squared.data()), _sum_luminance_squared.size() * sizeof(double));
+    in.read(reinterpret_cast<char*>(_sample_count.data()), _sample_count.size() * sizeof(int));
+    return static_cast<bool>(in);
+}
+
+bool Framebuffer::WriteTile(std::ostream& out, const Tile& tile) const {
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            size_t idx = PixelIndex(i, j);
+            double values[4] = {_sum[idx].R(), _sum[idx].G(), _sum[idx].B(), _sum_luminance_squared[idx]};
+            out.write(reinterpret_cast<const char*>(values), sizeof(values));
+            out.write(reinterpret_cast<const char*>(&_sample_count[idx]), sizeof(int));
+        }
+    }
+    return static_cast<bool>(out);
+}
+
+bool Framebuffer::ReadTile(std::istream& in, const Tile& tile) {
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            size_t idx = PixelIndex(i, j);
+            double values[4];
+            in.read(reinterpret_cast<char*>(values), sizeof(values));
+            in.read(reinterpret_cast<char*>(&_sample_count[idx]), sizeof(int));
+            _sum[idx] = Color(values[0], values[1], values[2]);
+            _sum_luminance_squared[idx] = values[3];
+        }
+    }
+    return static_cast<bool>(in);
+}
+
+void Framebuffer::ClearTile(const Tile& tile) {
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            size_t idx = PixelIndex(i, j);
+            _sum[idx] = Color(0,0,0);
+            _sum_luminance_squared[idx] = 0;
+            _sample_count[idx] = 0;
+        }
+    }
+}
+
+double Framebuffer::GetLuminanceVariance(int i, int j) const {
+    size_t idx = PixelIndex(i, j);
+    int n = _sample_count[idx];
+    if (n < 2) {
+        return 0;
+    }
+    double mean = Luminance(_sum[idx]) / n;
+    double variance = (_sum_luminance_squared[idx] - n * mean * mean) / (n - 1);
+    return variance > 0 ? variance : 0;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,99 @@
+#ifndef GPLAY_RABBIT_FRAMEBUFFER_H
+#define GPLAY_RABBIT_FRAMEBUFFER_H
+/*
+Class Framebuffer - In-memory accumulation buffer for rendered samples
+*/
+
+#include <iostream>
+#include <vector>
+#include "rabbit/vec3.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+// Tile a rectangular block of pixels [x0,x1) x [y0,y1)
+struct Tile {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// Luminance relative luminance of a linear RGB color (Rec. 709 weights)
+inline double Luminance(const Color& c) {
+    return 0.2126*c.R() + 0.7152*c.G() + 0.0722*c.B();
+}
+
+// GenerateTiles splits a width x height image into tiles of at most tile_size x tile_size pixels, in scanline order
+std::vector<Tile> GenerateTiles(int width, int height, int tile_size);
+
+class Framebuffer {
+public:
+    Framebuffer(int width, int height);
+
+    inline int Width() const {
+        return _width;
+    }
+
+    inline int Height() const {
+        return _height;
+    }
+
+    // AddSample accumulates one radiance sample into pixel i, j
+    // Distinct pixels may be updated concurrently from different threads
+    inline void AddSample(int i, int j, const Color& sample) {
+        size_t idx = PixelIndex(i, j);
+        _sum[idx] += sample;
+        double luminance = Luminance(sample);
+        _sum_luminance_squared[idx] += luminance * luminance;
+        _sample_count[idx] += 1;
+    }
+
+    // GetPixelColor returns the average of the samples accumulated in pixel i, j
+    Color GetPixelColor(int i, int j) const;
+
+    // GetSampleCount returns the number of samples accumulated in pixel i, j
+    inline int GetSampleCount(int i, int j) const {
+        return _sample_count[PixelIndex(i, j)];
+    }
+
+    // GetLuminanceVariance returns the sample variance of the luminance of the samples in pixel i, j
+    double GetLuminanceVariance(int i, int j) const;
+
+    // Write stores the accumulated sums and sample counts in binary form, native byte order
+    bool Write(std::ostream& out) const;
+
+    // Read restores the state stored by Write into a framebuffer of the same size
+    bool Read(std::istream& in);
+
+    // WriteTile stores the sums and sample counts of the pixels in tile, pixel by pixel in scanline order
+    bool WriteTile(std::ostream& out, const Tile& tile) const;
+
+    // ReadTile replaces the pixels in tile with the state stored by WriteTile
+    bool ReadTile(std::istream& in, const Tile& tile);
+
+    // ClearTile drops the samples accumulated in the pixels of tile
+    void ClearTile(const Tile& tile);
+
+private:
+    inline size_t PixelIndex(int i, int j) const {
+        return static_cast<size_t>(j) * _width + i;
+    }
+
+private:
+    int _width;
+    int _height;
+    // Sum of radiance samples per pixel, scanline order
+    std::vector<Color> _sum;
+    // Sum of squared sample luminances per pixel, for the variance estimate
+    std::vector<double> _sum_luminance_squared;
+    // Number of samples accumulated per pixel
+    std::vector<int> _sample_count;
+};
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_FRAMEBUFFER_H
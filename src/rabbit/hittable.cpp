@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "rabbit/hittable.h"
 
 namespace gplay {
@@ -10,6 +12,64 @@ void HitRecord::SetFaceNormal(const Ray& r, const Vec3& outward_normal) {
     normal = _is_front_face ? outward_normal : -outward_normal;
 }
 
+bool Hittable::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record, RandomStream& rng) const {
+    HitInfo info;
+    if (!Intersect(r, ray_time_interval, info, rng)) {
+        return false;
+    }
+    FinalizeHit(r, info, record);
+    return true;
+}
+
+bool Hittable::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    HitInfo info;
+    return Intersect(r, ray_time_interval, info, rng);
+}
+
+void Hittable::IntersectPacket(RayPacket& packet, HitInfo* infos, bool* hits) const {
+    for (int k = 0; k < packet.Size(); k++) {
+        if (Intersect(*packet.rays[k], Interval(packet.tmin[k], packet.tmax[k]), infos[k], *packet.rng[k])) {
+            hits[k] = true;
+            packet.tmax[k] = infos[k].GetHitTime();
+        }
+    }
+}
+
+void Hittable::OccludedPacket(const RayPacket& packet, bool* occluded) const {
+    for (int k = 0; k < packet.Size(); k++) {
+        if (!occluded[k]) {
+            occluded[k] = Occluded(*packet.rays[k], Interval(packet.tmin[k], packet.tmax[k]), *packet.rng[k]);
+        }
+    }
+}
+
+void Hittable::HitPacket(RayPacket& packet, HitRecord* records, bool* hits) const {
+    HitInfo infos[RayPacket::kMaxSize];
+    for (int k = 0; k < packet.Size(); k++) {
+        hits[k] = false;
+    }
+    IntersectPacket(packet, infos, hits);
+    for (int k = 0; k < packet.Size(); k++) {
+        if (hits[k]) {
+            FinalizeHit(*packet.rays[k], infos[k], records[k]);
+        }
+    }
+}
+
+void FinalizeHit(const Ray& r, const HitInfo& info, HitRecord& record) {
+    // Move the ray into the space of the primitive, evaluate there, and bring the result back out
+    Ray object_r = r;
+    for (int i = 0; i < info.instance_count; i++) {
+        object_r = info.instance_transforms[i]->ApplyInverse(object_r);
+    }
+    info.prim->ComputeHitRecord(object_r, info, record);
+    record.prim = info.instance_count == 0 ? info.prim : nullptr;
+    for (int i = info.instance_count - 1; i >= 0; i--) {
+        record.hitpoint = info.instance_transforms[i]->ApplyPoint(record.hitpoint);
+        record.normal = UnitVec(info.instance_transforms[i]->ApplyNormal(record.normal));
+    }
+}
+
 HittableList::HittableList() {}
 
 HittableList::HittableList(std::shared_ptr<Hittable> obj) {
@@ -29,28 +89,61 @@ size_t HittableList::Size() {
     return objs.size();
 }
 
-bool HittableList::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
-    HitRecord tmp_rec;
+bool HittableList::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
     bool is_hit = false;
     double curr_closest = ray_time_interval.GetMax();
 
-    // find the closest hit record if exist
+    // find the closest hit if exist, info only changes when a closer hit is found
     for (const auto& obj : objs) {
-        if (obj->Hit(r, Interval(ray_time_interval.GetMin(), curr_closest), tmp_rec)) {
+        if (obj->Intersect(r, Interval(ray_time_interval.GetMin(), curr_closest), info, rng)) {
             is_hit = true;
-            curr_closest = tmp_rec.GetHitTime();
+            curr_closest = info.GetHitTime();
         }
     }
-    if (is_hit) {
-        record = tmp_rec;
-    }
     return is_hit;
 }
 
+bool HittableList::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    // any hit will do, stop at the first one
+    for (const auto& obj : objs) {
+        if (obj->Occluded(r, ray_time_interval, rng)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HittableList::IntersectPacket(RayPacket& packet, HitInfo* infos, bool* hits) const {
+    // the packet carries the closest hit of each ray from one object to the next
+    for (const auto& obj : objs) {
+        obj->IntersectPacket(packet, infos, hits);
+    }
+}
+
+void HittableList::OccludedPacket(const RayPacket& packet, bool* occluded) const {
+    for (const auto& obj : objs) {
+        obj->OccludedPacket(packet, occluded);
+    }
+}
+
 AxisAlignedBoundingBox HittableList::GetBoundingBox() const {
     return _bbox;
 }
 
+void HittableList::CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {
+    for (const auto& obj : objs) {
+        obj->CollectLights(materials, lights);
+    }
+}
+
+int HittableList::GetInstanceDepth() const {
+    int depth = 0;
+    for (const auto& obj : objs) {
+        depth = std::max(depth, obj->GetInstanceDepth());
+    }
+    return depth;
+}
+
 } // namespace rabbit
 
 } // namespace gplay
@@ -5,14 +5,19 @@ Class Hittable - Abstract class for anything a ray might hit
 reference: https://github.com/RayTracing/raytracing.github.io/blob/release/src/TheNextWeek
 */
 
+#include <cstdint>
+#include <memory>
 #include <vector>
 #include "rabbit/aabb.h"
+#include "rabbit/packet.h"
+#include "rabbit/transform.h"
 
 namespace gplay {
 
 namespace rabbit {
 
-class Material;
+class Hittable;
+class MaterialTable;
 
 class HitRecord {
 public:
@@ -25,8 +30,8 @@ public:
     }
 
     // SetFrontFace ...
-    inline void SetFrontFace() {
-        _is_front_face = true;
+    inline void SetFrontFace(bool is_front_face = true) {
+        _is_front_face = is_front_face;
     }
 
     // GetHitTime ...
@@ -37,7 +42,10 @@ public:
 public:
     Point3 hitpoint;
     Vec3 normal;
-    std::shared_ptr<Material> material;
+    // Index of the surface material in the scene's MaterialTable
+    uint32_t material_id;
+    // The primitive that was hit, nullptr for hits found through an instance
+    const Hittable* prim;
 
     // Hit time
     double t;
@@ -50,14 +58,107 @@ private:
     bool _is_front_face;
 };
 
+// HitInfo result of the closest hit search: just enough to compute the surface interaction of the winner afterwards
+class HitInfo {
+public:
+    static const int kMaxInstanceDepth = 4;
+
+    // GetHitTime ...
+    inline double GetHitTime() const {
+        return t;
+    }
+
+    // SetHit records a hit of primitive prim found directly in the space the ray was given in
+    inline void SetHit(double hit_time, const Hittable* hit_prim, double hit_b0 = 0, double hit_b1 = 0,
+                       uint32_t hit_element = 0) {
+        t = hit_time;
+        prim = hit_prim;
+        b0 = hit_b0;
+        b1 = hit_b1;
+        element = hit_element;
+        // a farther hit found through instances may have filled the stack before
+        instance_count = 0;
+    }
+
+public:
+    // Hit time
+    double t;
+    // The primitive that reported the hit
+    const Hittable* prim = nullptr;
+    // Raw primitive coordinates of the hit, e.g. the planar coordinates of a quadrilateral
+    double b0;
+    double b1;
+    // Part of the primitive that was hit, e.g. the triangle of a mesh
+    uint32_t element;
+    // Object to world transforms of the instances the hit was found through, outermost first
+    const Transform* instance_transforms[kMaxInstanceDepth];
+    int instance_count = 0;
+};
+
+// PrimitiveType shapes that BVH leaves store and intersect themselves instead of calling Intersect, see LeafPrimitives
+enum class PrimitiveType : uint8_t {
+    kOther,
+    kSphere,
+    kQuadrilateral,
+};
+
 class Hittable {
 public:
     virtual ~Hittable() = default;
 
-    // Hit ray-object intersection
-    virtual bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const = 0;
+    // Intersect closest hit search, rng serves objects that intersect stochastically e.g. volumes
+    // Only t, the primitive and its raw coordinates are recorded, info is left untouched when nothing closer is found
+    virtual bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const = 0;
+
+    // ComputeHitRecord computes hit point, normal, texture coordinates and material of a hit reported by this primitive
+    // The ray is given in the space of the primitive, containers never report hits themselves and keep the default
+    virtual void ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const {}
+
+    // Hit ray-object intersection, the surface interaction is only evaluated once for the closest hit
+    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record, RandomStream& rng) const;
+
+    // Occluded any-hit query for shadow and visibility rays: is there any intersection in the interval?
+    // Implementations return at the first intersection found and skip normals, texture coordinates and materials,
+    // the default falls back to Intersect
+    virtual bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const;
+
+    // IntersectPacket Intersect for every ray of packet: a closer hit of ray k goes to infos[k], sets hits[k] and
+    // shrinks packet.tmax[k]. The default intersects the rays one by one, LinearBVH traverses the packet together
+    virtual void IntersectPacket(RayPacket& packet, HitInfo* infos, bool* hits) const;
+
+    // OccludedPacket Occluded for every ray of packet, sets occluded[k] for the blocked rays
+    // Rays with occluded[k] already set are skipped
+    virtual void OccludedPacket(const RayPacket& packet, bool* occluded) const;
+
+    // HitPacket Hit for every ray of packet, records[k] is valid where hits[k] is set
+    void HitPacket(RayPacket& packet, HitRecord* records, bool* hits) const;
 
     virtual AxisAlignedBoundingBox GetBoundingBox() const = 0;
+
+    // GetPrimitiveType kOther unless the object intersects exactly like one of the block shapes
+    virtual PrimitiveType GetPrimitiveType() const {
+        return PrimitiveType::kOther;
+    }
+
+    // CollectLights appends the primitives with an emissive material to lights
+    // Instances keep the default and collect nothing, their emitters are only reached by scattered rays
+    virtual void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {}
+
+    // GetInstanceDepth number of nested Instance levels a hit of this object is found through, at most
+    // Containers report the deepest of their objects
+    virtual int GetInstanceDepth() const {
+        return 0;
+    }
+
+    // SampleDirection maps u to a direction from origin towards a point of this primitive, for light sampling
+    virtual Vec3 SampleDirection(const Point3& origin, double time, const Sample2D& u) const {
+        return Vec3(1, 0, 0);
+    }
+
+    // DirectionPdf solid angle density of SampleDirection picking direction, 0 where it misses the primitive
+    virtual double DirectionPdf(const Point3& origin, const Vec3& direction, double time) const {
+        return 0;
+    }
 };
 
 class HittableList : public Hittable {
@@ -71,10 +172,20 @@ public:
 
     size_t Size();
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
+
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
+
+    void IntersectPacket(RayPacket& packet, HitInfo* infos, bool* hits) const override;
+
+    void OccludedPacket(const RayPacket& packet, bool* occluded) const override;
 
     AxisAlignedBoundingBox GetBoundingBox() const override;
 
+    void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const override;
+
+    int GetInstanceDepth() const override;
+
 public:
     std::vector<std::shared_ptr<Hittable>> objs;
 
@@ -82,6 +193,9 @@ private:
     AxisAlignedBoundingBox _bbox;
 };
 
+// FinalizeHit evaluates the surface interaction of a hit found by Intersect, in world space
+void FinalizeHit(const Ray& r, const HitInfo& info, HitRecord& record);
+
 } // namespace rabbit
 
 } // namespace gplay
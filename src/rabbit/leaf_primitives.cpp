@@ -0,0 +1,425 @@
+#include <cmath>
+#include <limits>
+#include <typeinfo>
+
+#include "rabbit/leaf_primitives.h"
+#include "rabbit/bvh.h"
+#include "rabbit/object.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+// BlockType the block shape obj is stored as, kOther unless obj is exactly a Sphere or a Quadrilateral:
+// a derived class that overrides the intersection but keeps the reported type must not be cast to its base
+PrimitiveType BlockType(const Hittable& obj) {
+    PrimitiveType type = obj.GetPrimitiveType();
+    if ((type == PrimitiveType::kSphere && typeid(obj) == typeid(Sphere)) ||
+        (type == PrimitiveType::kQuadrilateral && typeid(obj) == typeid(Quadrilateral))) {
+        return type;
+    }
+    return PrimitiveType::kOther;
+}
+
+// SphereLaneHit the nearest root of sphere k of block strictly inside ray_time_interval, as in Sphere::Intersect
+inline bool SphereLaneHit(const SphereBlock& block, int k, const Ray& r, Interval ray_time_interval, double& t) {
+    const Point3& origin = r.GetEndpoint();
+    const Vec3& dir = r.GetDirection();
+    double time = r.GetTime();
+    double oc[3];
+    for (int axis = 0; axis < 3; axis++) {
+        oc[axis] = (block.center[axis][k] + time * block.motion[axis][k]) - origin[axis];
+    }
+    double h = dir[0] * oc[0] + dir[1] * oc[1] + dir[2] * oc[2];
+    double c = (oc[0] * oc[0] + oc[1] * oc[1] + oc[2] * oc[2]) - block.radius_squared[k];
+    double a = dir.LengthSquared();
+    double discriminant = h*h - a*c;
+    if (discriminant < 0) {
+        return false;
+    }
+
+    double sqrtd = std::sqrt(discriminant);
+    t = (h - sqrtd) / a;
+    if (!ray_time_interval.Surrounds(t)) {
+        t = (h + sqrtd) / a;
+        return ray_time_interval.Surrounds(t);
+    }
+    return true;
+}
+
+// QuadLaneHit the plane hit of quadrilateral k of block within ray_time_interval, as in Quadrilateral::PlaneHit
+inline bool QuadLaneHit(const QuadBlock& block, int k, const Ray& r, Interval ray_time_interval, double& t,
+                        double& alpha, double& beta) {
+    const Point3& origin = r.GetEndpoint();
+    const Vec3& dir = r.GetDirection();
+    double n[3] = { block.normal[0][k], block.normal[1][k], block.normal[2][k] };
+    double denom = n[0] * dir[0] + n[1] * dir[1] + n[2] * dir[2];
+    if (std::fabs(denom) < 1e-8) {
+        return false;
+    }
+
+    t = (block.plane_distance[k] - (n[0] * origin[0] + n[1] * origin[1] + n[2] * origin[2])) / denom;
+    if (!ray_time_interval.Contains(t)) {
+        return false;
+    }
+
+    double p[3], u[3], v[3], w[3];
+    for (int axis = 0; axis < 3; axis++) {
+        p[axis] = (origin[axis] + t * dir[axis]) - block.corner[axis][k];
+        u[axis] = block.side_u[axis][k];
+        v[axis] = block.side_v[axis][k];
+        w[axis] = block.plane_basis[axis][k];
+    }
+    alpha = w[0] * (p[1] * v[2] - p[2] * v[1]) + w[1] * -(p[0] * v[2] - p[2] * v[0])
+          + w[2] * (p[0] * v[1] - p[1] * v[0]);
+    beta = w[0] * (u[1] * p[2] - u[2] * p[1]) + w[1] * -(u[0] * p[2] - u[2] * p[0])
+         + w[2] * (u[0] * p[1] - u[1] * p[0]);
+    return 0 <= alpha && alpha <= 1 && 0 <= beta && beta <= 1;
+}
+
+// LaneMask bit mask of the first count lanes of a Block, the SSE tests compute lanes in pairs
+template <typename Block>
+inline int LaneMask(uint32_t count) {
+    return count < Block::kWidth ? (1 << count) - 1 : (1 << Block::kWidth) - 1;
+}
+
+// SphereBlockHits roots of the first count spheres of block within (tmin, tmax), the nearer one where both are
+// Returns the bit mask of the lanes hit, t receives their hit distances
+inline int SphereBlockHits(const SphereBlock& block, uint32_t count, const Ray& r, double tmin, double tmax,
+                           double t[SphereBlock::kWidth]) {
+    int mask = 0;
+#if defined(__SSE2__)
+    const Point3& origin = r.GetEndpoint();
+    const Vec3& dir = r.GetDirection();
+    double a = dir.LengthSquared();
+    __m128d time = _mm_set1_pd(r.GetTime());
+    __m128d a2 = _mm_set1_pd(a);
+    __m128d lo = _mm_set1_pd(tmin);
+    __m128d hi = _mm_set1_pd(tmax);
+    for (uint32_t k = 0; k < count && k < SphereBlock::kWidth; k += 2) {
+        __m128d oc[3];
+        for (int axis = 0; axis < 3; axis++) {
+            __m128d center = _mm_add_pd(_mm_load_pd(&block.center[axis][k]),
+                                        _mm_mul_pd(time, _mm_load_pd(&block.motion[axis][k])));
+            oc[axis] = _mm_sub_pd(center, _mm_set1_pd(origin[axis]));
+        }
+        __m128d h = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_set1_pd(dir[0]), oc[0]),
+                                          _mm_mul_pd(_mm_set1_pd(dir[1]), oc[1])),
+                               _mm_mul_pd(_mm_set1_pd(dir[2]), oc[2]));
+        __m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(oc[0], oc[0]), _mm_mul_pd(oc[1], oc[1])),
+                                          _mm_mul_pd(oc[2], oc[2])),
+                               _mm_load_pd(&block.radius_squared[k]));
+        // most spheres of a leaf are missed, skip the square root and divisions when both are
+        __m128d discriminant = _mm_sub_pd(_mm_mul_pd(h, h), _mm_mul_pd(a2, c));
+        if (_mm_movemask_pd(_mm_cmpge_pd(discriminant, _mm_setzero_pd())) == 0) {
+            continue;
+        }
+        // a negative discriminant gives NaN roots, which fail every comparison
+        __m128d sqrtd = _mm_sqrt_pd(discriminant);
+        __m128d root1 = _mm_div_pd(_mm_sub_pd(h, sqrtd), a2);
+        __m128d root2 = _mm_div_pd(_mm_add_pd(h, sqrtd), a2);
+        __m128d in1 = _mm_and_pd(_mm_cmplt_pd(lo, root1), _mm_cmplt_pd(root1, hi));
+        __m128d in2 = _mm_and_pd(_mm_cmplt_pd(lo, root2), _mm_cmplt_pd(root2, hi));
+        _mm_storeu_pd(&t[k], _mm_or_pd(_mm_and_pd(in1, root1), _mm_andnot_pd(in1, root2)));
+        mask |= _mm_movemask_pd(_mm_or_pd(in1, in2)) << k;
+    }
+#else
+    for (uint32_t k = 0; k < count && k < SphereBlock::kWidth; k++) {
+        mask |= SphereLaneHit(block, k, r, Interval(tmin, tmax), t[k]) << k;
+    }
+#endif
+    return mask & LaneMask<SphereBlock>(count);
+}
+
+// QuadBlockHits plane hits of the first count quadrilaterals of block within [tmin, tmax] that lie inside them
+// Returns the bit mask of the lanes hit, t, alpha and beta receive hit distances and planar coordinates
+inline int QuadBlockHits(const QuadBlock& block, uint32_t count, const Ray& r, double tmin, double tmax,
+                         double t[QuadBlock::kWidth], double alpha[QuadBlock::kWidth], double beta[QuadBlock::kWidth]) {
+    int mask = 0;
+#if defined(__SSE2__)
+    const Point3& origin = r.GetEndpoint();
+    const Vec3& dir = r.GetDirection();
+    const __m128d sign_bit = _mm_set1_pd(-0.0);
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d one = _mm_set1_pd(1.0);
+    __m128d lo = _mm_set1_pd(tmin);
+    __m128d hi = _mm_set1_pd(tmax);
+    __m128d o[3] = { _mm_set1_pd(origin[0]), _mm_set1_pd(origin[1]), _mm_set1_pd(origin[2]) };
+    __m128d d[3] = { _mm_set1_pd(dir[0]), _mm_set1_pd(dir[1]), _mm_set1_pd(dir[2]) };
+    for (uint32_t k = 0; k < count && k < QuadBlock::kWidth; k += 2) {
+        __m128d n[3];
+        for (int axis = 0; axis < 3; axis++) {
+            n[axis] = _mm_load_pd(&block.normal[axis][k]);
+        }
+        // rays parallel to the plane never hit
+        __m128d denom = _mm_add_pd(_mm_add_pd(_mm_mul_pd(n[0], d[0]), _mm_mul_pd(n[1], d[1])), _mm_mul_pd(n[2], d[2]));
+        __m128d valid = _mm_cmpge_pd(_mm_andnot_pd(sign_bit, denom), _mm_set1_pd(1e-8));
+        __m128d n_dot_o = _mm_add_pd(_mm_add_pd(_mm_mul_pd(n[0], o[0]), _mm_mul_pd(n[1], o[1])),
+                                     _mm_mul_pd(n[2], o[2]));
+        __m128d hit_t = _mm_div_pd(_mm_sub_pd(_mm_load_pd(&block.plane_distance[k]), n_dot_o), denom);
+        valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmple_pd(lo, hit_t), _mm_cmple_pd(hit_t, hi)));
+
+        __m128d p[3], u[3], v[3], w[3];
+        for (int axis = 0; axis < 3; axis++) {
+            p[axis] = _mm_sub_pd(_mm_add_pd(o[axis], _mm_mul_pd(hit_t, d[axis])), _mm_load_pd(&block.corner[axis][k]));
+            u[axis] = _mm_load_pd(&block.side_u[axis][k]);
+            v[axis] = _mm_load_pd(&block.side_v[axis][k]);
+            w[axis] = _mm_load_pd(&block.plane_basis[axis][k]);
+        }
+        // alpha = w . (p x v), beta = w . (u x p), with the operation order of Vec3Cross and Vec3Dot
+        __m128d pv0 = _mm_sub_pd(_mm_mul_pd(p[1], v[2]), _mm_mul_pd(p[2], v[1]));
+        __m128d pv1 = _mm_xor_pd(sign_bit, _mm_sub_pd(_mm_mul_pd(p[0], v[2]), _mm_mul_pd(p[2], v[0])));
+        __m128d pv2 = _mm_sub_pd(_mm_mul_pd(p[0], v[1]), _mm_mul_pd(p[1], v[0]));
+        __m128d up0 = _mm_sub_pd(_mm_mul_pd(u[1], p[2]), _mm_mul_pd(u[2], p[1]));
+        __m128d up1 = _mm_xor_pd(sign_bit, _mm_sub_pd(_mm_mul_pd(u[0], p[2]), _mm_mul_pd(u[2], p[0])));
+        __m128d up2 = _mm_sub_pd(_mm_mul_pd(u[0], p[1]), _mm_mul_pd(u[1], p[0]));
+        __m128d hit_alpha = _mm_add_pd(_mm_add_pd(_mm_mul_pd(w[0], pv0), _mm_mul_pd(w[1], pv1)), _mm_mul_pd(w[2], pv2));
+        __m128d hit_beta = _mm_add_pd(_mm_add_pd(_mm_mul_pd(w[0], up0), _mm_mul_pd(w[1], up1)), _mm_mul_pd(w[2], up2));
+        valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmple_pd(zero, hit_alpha), _mm_cmple_pd(hit_alpha, one)));
+        valid = _mm_and_pd(valid, _mm_and_pd(_mm_cmple_pd(zero, hit_beta), _mm_cmple_pd(hit_beta, one)));
+
+        _mm_storeu_pd(&t[k], hit_t);
+        _mm_storeu_pd(&alpha[k], hit_alpha);
+        _mm_storeu_pd(&beta[k], hit_beta);
+        mask |= _mm_movemask_pd(valid) << k;
+    }
+#else
+    for (uint32_t k = 0; k < count && k < QuadBlock::kWidth; k++) {
+        mask |= QuadLaneHit(block, k, r, Interval(tmin, tmax), t[k], alpha[k], beta[k]) << k;
+    }
+#endif
+    return mask & LaneMask<QuadBlock>(count);
+}
+
+// FillLane copies sphere into lane k of block, a null sphere clears the lane
+void FillLane(SphereBlock& block, uint32_t k, const Sphere* sphere) {
+    for (int axis = 0; axis < 3; axis++) {
+        block.center[axis][k] = sphere ? sphere->GetCenterPath().GetEndpoint()[axis] : kNaN;
+        block.motion[axis][k] = sphere ? sphere->GetCenterPath().GetDirection()[axis] : kNaN;
+    }
+    block.radius_squared[k] = sphere ? sphere->GetRadius() * sphere->GetRadius() : kNaN;
+}
+
+// FillLane copies quad into lane k of block, a null quad clears the lane
+void FillLane(QuadBlock& block, uint32_t k, const Quadrilateral* quad) {
+    for (int axis = 0; axis < 3; axis++) {
+        block.corner[axis][k] = quad ? quad->GetCorner()[axis] : kNaN;
+        block.side_u[axis][k] = quad ? quad->GetSideU()[axis] : kNaN;
+        block.side_v[axis][k] = quad ? quad->GetSideV()[axis] : kNaN;
+        block.plane_basis[axis][k] = quad ? quad->GetPlaneBasis()[axis] : kNaN;
+        block.normal[axis][k] = quad ? quad->GetNormal()[axis] : kNaN;
+    }
+    block.plane_distance[k] = quad ? quad->GetPlaneDistance() : kNaN;
+}
+
+// AddLane copies primitive into the next free lane of blocks and returns the lane
+// with start_block the lane is the first of a new block, so that a leaf owns its blocks alone
+template <typename Block, typename Primitive>
+uint32_t AddLane(std::vector<Block>& blocks, uint32_t& lane_count, bool start_block, const Primitive* primitive) {
+    if (start_block) {
+        lane_count = static_cast<uint32_t>(blocks.size() * Block::kWidth);
+    }
+    if (lane_count == blocks.size() * Block::kWidth) {
+        blocks.emplace_back();
+        for (uint32_t k = 0; k < Block::kWidth; k++) {
+            FillLane(blocks.back(), k, static_cast<const Primitive*>(nullptr));
+        }
+    }
+    uint32_t lane = lane_count++;
+    FillLane(blocks[lane / Block::kWidth], lane % Block::kWidth, primitive);
+    return lane;
+}
+
+// EndBlock rounds lane_count up to the next block, so that the next lane starts a new block
+template <typename Block>
+void EndBlock(uint32_t& lane_count) {
+    lane_count = (lane_count + Block::kWidth - 1) / Block::kWidth * Block::kWidth;
+}
+
+} // namespace
+
+LeafPrimitives::LeafPrimitives(const std::vector<std::shared_ptr<Hittable>>& objects,
+                               const std::vector<uint32_t>& prim_order, const std::vector<BVHLinearNode>& nodes) {
+    _objects.reserve(prim_order.size());
+    for (uint32_t idx : prim_order) {
+        _objects.push_back(objects[idx]);
+    }
+
+    _handles.resize(_objects.size());
+    uint32_t sphere_lanes = 0;
+    uint32_t quad_lanes = 0;
+    for (const BVHLinearNode& node : nodes) {
+        if (!node.IsLeaf()) {
+            continue;
+        }
+        PrimitiveType type = BlockType(*_objects[node.offset]);
+        // a lone sphere is cheaper through its scalar test, which stops early at a negative discriminant
+        bool use_blocks = type == PrimitiveType::kQuadrilateral ||
+                          (type == PrimitiveType::kSphere && node.prim_count > 1);
+        for (uint32_t i = node.offset + 1; i < node.offset + node.prim_count && use_blocks; i++) {
+            use_blocks = BlockType(*_objects[i]) == type;
+        }
+
+        for (uint32_t i = node.offset; i < node.offset + node.prim_count; i++) {
+            PrimitiveHandle& handle = _handles[i];
+            handle.index = 0;
+            handle.type = BlockType(*_objects[i]);
+            handle.leaf_in_blocks = use_blocks && i == node.offset;
+            bool start_block = handle.leaf_in_blocks;
+            switch (handle.type) {
+            case PrimitiveType::kSphere:
+                handle.index = AddLane(_sphere_blocks, sphere_lanes, start_block,
+                                       static_cast<const Sphere*>(_objects[i].get()));
+                break;
+            case PrimitiveType::kQuadrilateral:
+                handle.index = AddLane(_quad_blocks, quad_lanes, start_block,
+                                       static_cast<const Quadrilateral*>(_objects[i].get()));
+                break;
+            default:
+                break;
+            }
+        }
+        // the spare lanes of the leaf's last block stay empty, a later leaf's lane there would be tested as part
+        // of this leaf
+        if (use_blocks && type == PrimitiveType::kSphere) {
+            EndBlock<SphereBlock>(sphere_lanes);
+        } else if (use_blocks) {
+            EndBlock<QuadBlock>(quad_lanes);
+        }
+    }
+}
+
+bool LeafPrimitives::IntersectBlocks(uint32_t first, uint32_t count, const Ray& r, double tmin, double& closest,
+                                     HitInfo& info) const {
+    static_assert(SphereBlock::kWidth == QuadBlock::kWidth, "leaves are split into blocks of the same width");
+    const int kWidth = SphereBlock::kWidth;
+    bool is_quad = _handles[first].type == PrimitiveType::kQuadrilateral;
+    uint32_t index = _handles[first].index / kWidth;
+    bool is_hit = false;
+    for (uint32_t base = 0; base < count; base += kWidth, index++) {
+        double t[kWidth];
+        double alpha[kWidth];
+        double beta[kWidth];
+        int hit_lane = -1;
+        if (is_quad) {
+            int mask = QuadBlockHits(_quad_blocks[index], count - base, r, tmin, closest, t, alpha, beta);
+            // Quadrilateral accepts a hit at the end of the interval, a later one at the same distance wins
+            for (int k = 0; k < kWidth; k++) {
+                if ((mask & (1 << k)) && t[k] <= closest) {
+                    closest = t[k];
+                    hit_lane = k;
+                }
+            }
+            if (hit_lane >= 0) {
+                info.SetHit(t[hit_lane], _objects[first + base + hit_lane].get(), alpha[hit_lane], beta[hit_lane]);
+            }
+        } else {
+            int mask = SphereBlockHits(_sphere_blocks[index], count - base, r, tmin, closest, t);
+            // Sphere only accepts roots strictly inside the interval, the first of equally distant hits wins
+            for (int k = 0; k < kWidth; k++) {
+                if ((mask & (1 << k)) && t[k] < closest) {
+                    closest = t[k];
+                    hit_lane = k;
+                }
+            }
+            if (hit_lane >= 0) {
+                info.SetHit(t[hit_lane], _objects[first + base + hit_lane].get());
+            }
+        }
+        is_hit = is_hit || hit_lane >= 0;
+    }
+    return is_hit;
+}
+
+bool LeafPrimitives::OccludedBlocks(uint32_t first, uint32_t count, const Ray& r, Interval ray_time_interval) const {
+    const int kWidth = SphereBlock::kWidth;
+    bool is_quad = _handles[first].type == PrimitiveType::kQuadrilateral;
+    uint32_t index = _handles[first].index / kWidth;
+    double tmin = ray_time_interval.GetMin();
+    double tmax = ray_time_interval.GetMax();
+    for (uint32_t base = 0; base < count; base += kWidth, index++) {
+        double t[kWidth];
+        double alpha[kWidth];
+        double beta[kWidth];
+        int mask = is_quad ? QuadBlockHits(_quad_blocks[index], count - base, r, tmin, tmax, t, alpha, beta)
+                           : SphereBlockHits(_sphere_blocks[index], count - base, r, tmin, tmax, t);
+        if (mask != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool LeafPrimitives::IntersectHandles(uint32_t first, uint32_t count, const Ray& r, double tmin, double& closest,
+                                      HitInfo& info, RandomStream& rng) const {
+    const uint32_t kWidth = SphereBlock::kWidth;
+    bool is_hit = false;
+    for (uint32_t i = first; i < first + count; i++) {
+        const PrimitiveHandle& handle = _handles[i];
+        double t, alpha, beta;
+        switch (handle.type) {
+        case PrimitiveType::kSphere:
+            if (SphereLaneHit(_sphere_blocks[handle.index / kWidth], handle.index % kWidth, r,
+                              Interval(tmin, closest), t)) {
+                info.SetHit(t, _objects[i].get());
+                closest = t;
+                is_hit = true;
+            }
+            break;
+        case PrimitiveType::kQuadrilateral:
+            if (QuadLaneHit(_quad_blocks[handle.index / kWidth], handle.index % kWidth, r,
+                            Interval(tmin, closest), t, alpha, beta)) {
+                info.SetHit(t, _objects[i].get(), alpha, beta);
+                closest = t;
+                is_hit = true;
+            }
+            break;
+        default:
+            if (_objects[i]->Intersect(r, Interval(tmin, closest), info, rng)) {
+                closest = info.GetHitTime();
+                is_hit = true;
+            }
+            break;
+        }
+    }
+    return is_hit;
+}
+
+bool LeafPrimitives::OccludedHandles(uint32_t first, uint32_t count, const Ray& r, Interval ray_time_interval,
+                                     RandomStream& rng) const {
+    const uint32_t kWidth = SphereBlock::kWidth;
+    for (uint32_t i = first; i < first + count; i++) {
+        const PrimitiveHandle& handle = _handles[i];
+        double t, alpha, beta;
+        bool is_hit = false;
+        switch (handle.type) {
+        case PrimitiveType::kSphere:
+            is_hit = SphereLaneHit(_sphere_blocks[handle.index / kWidth], handle.index % kWidth, r,
+                                   ray_time_interval, t);
+            break;
+        case PrimitiveType::kQuadrilateral:
+            is_hit = QuadLaneHit(_quad_blocks[handle.index / kWidth], handle.index % kWidth, r,
+                                 ray_time_interval, t, alpha, beta);
+            break;
+        default:
+            is_hit = _objects[i]->Occluded(r, ray_time_interval, rng);
+            break;
+        }
+        if (is_hit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
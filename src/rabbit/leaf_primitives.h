@@ -0,0 +1,117 @@
+#ifndef GPLAY_RABBIT_LEAF_PRIMITIVES_H
+#define GPLAY_RABBIT_LEAF_PRIMITIVES_H
+/*
+Class LeafPrimitives - The primitives of a BVH in leaf order, with spheres and quadrilaterals stored by value
+reference: https://www.embree.org/papers/2014-Siggraph-Embree.pdf (Wald et al., Embree: A Kernel Framework for Efficient CPU Ray Tracing)
+Spheres and quadrilaterals are copied into per-type arrays of structure of arrays blocks, as wide as an SSE2 register
+of doubles, and every leaf slot keeps a handle of the type and lane of its primitive. Leaves dispatch on the type with
+a switch instead of making one virtual call per primitive. A leaf whose primitives are all spheres or all
+quadrilaterals owns consecutive blocks and tests the ray against two primitives per instruction. The tests repeat
+the double precision arithmetic of Sphere and Quadrilateral operation by operation, so they report exactly the same
+hits. Every other Hittable is still called through Intersect.
+*/
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "rabbit/hittable.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+struct BVHLinearNode;
+
+// SphereBlock up to two spheres in SoA layout, unused lanes hold NaN and never hit
+struct alignas(16) SphereBlock {
+    static const int kWidth = 2;
+
+    // Centers at time 0 and their motion per unit of time
+    double center[3][kWidth];
+    double motion[3][kWidth];
+    double radius_squared[kWidth];
+};
+
+// QuadBlock up to two quadrilaterals in SoA layout, unused lanes hold NaN and never hit
+struct alignas(16) QuadBlock {
+    static const int kWidth = 2;
+
+    double corner[3][kWidth];
+    double side_u[3][kWidth];
+    double side_v[3][kWidth];
+    // \frac{\mathbf{n}}{\mathbf{n} \cdot \mathbf{n}} for the planar coordinates
+    double plane_basis[3][kWidth];
+    double normal[3][kWidth];
+    double plane_distance[kWidth];
+};
+
+class LeafPrimitives {
+public:
+    LeafPrimitives() = default;
+
+    // LeafPrimitives stores objects in the order of prim_order and builds the blocks of the leaves of nodes
+    LeafPrimitives(const std::vector<std::shared_ptr<Hittable>>& objects, const std::vector<uint32_t>& prim_order,
+                   const std::vector<BVHLinearNode>& nodes);
+
+    // IntersectLeaf closest hit among the primitives [first, first + count) of a leaf in [tmin, closest]
+    // shrinks closest on a hit
+    inline bool IntersectLeaf(uint32_t first, uint32_t count, const Ray& r, double tmin, double& closest,
+                              HitInfo& info, RandomStream& rng) const {
+        if (_handles[first].leaf_in_blocks) {
+            return IntersectBlocks(first, count, r, tmin, closest, info);
+        }
+        return IntersectHandles(first, count, r, tmin, closest, info, rng);
+    }
+
+    // OccludedLeaf whether any primitive [first, first + count) of a leaf blocks the ray
+    inline bool OccludedLeaf(uint32_t first, uint32_t count, const Ray& r, Interval ray_time_interval,
+                             RandomStream& rng) const {
+        if (_handles[first].leaf_in_blocks) {
+            return OccludedBlocks(first, count, r, ray_time_interval);
+        }
+        return OccludedHandles(first, count, r, ray_time_interval, rng);
+    }
+
+    // GetObjects returns the primitives in leaf order
+    inline const std::vector<std::shared_ptr<Hittable>>& GetObjects() const {
+        return _objects;
+    }
+
+    // BlockCount returns the number of sphere and quadrilateral blocks
+    inline size_t BlockCount() const {
+        return _sphere_blocks.size() + _quad_blocks.size();
+    }
+
+private:
+    // PrimitiveHandle where the primitive of a leaf slot is stored
+    struct PrimitiveHandle {
+        // Lane in the blocks of spheres or quadrilaterals, block index * kWidth + lane, unused for other types
+        uint32_t index;
+        PrimitiveType type;
+        // Set on the first slot of a leaf that owns consecutive blocks of a single type
+        bool leaf_in_blocks;
+    };
+
+    bool IntersectBlocks(uint32_t first, uint32_t count, const Ray& r, double tmin, double& closest,
+                         HitInfo& info) const;
+
+    bool OccludedBlocks(uint32_t first, uint32_t count, const Ray& r, Interval ray_time_interval) const;
+
+    bool IntersectHandles(uint32_t first, uint32_t count, const Ray& r, double tmin, double& closest,
+                          HitInfo& info, RandomStream& rng) const;
+
+    bool OccludedHandles(uint32_t first, uint32_t count, const Ray& r, Interval ray_time_interval,
+                         RandomStream& rng) const;
+
+    // Primitives in leaf order, hits still point to them for ComputeHitRecord
+    std::vector<std::shared_ptr<Hittable>> _objects;
+    std::vector<PrimitiveHandle> _handles;
+    std::vector<SphereBlock> _sphere_blocks;
+    std::vector<QuadBlock> _quad_blocks;
+};
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_LEAF_PRIMITIVES_H
@@ -0,0 +1,57 @@
+#include "rabbit/light.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+LightList::LightList() {}
+
+LightList::LightList(const Hittable& world, const MaterialTable& materials) {
+    world.CollectLights(materials, _lights);
+    _light_set.insert(_lights.begin(), _lights.end());
+}
+
+bool SampleLightDirection(const LightList& lights, const Ray& r_in, const HitRecord& record, const Material& material,
+                          Sampler& sampler, LightSample& sample) {
+    // both dimensions are drawn up front, so that every path vertex consumes the same sampler dimensions
+    const Hittable& light = lights.Pick(sampler.Get1D());
+    Vec3 direction = light.SampleDirection(record.hitpoint, r_in.GetTime(), sampler.Get2D());
+
+    double light_pdf = lights.DirectionPdf(light, record.hitpoint, direction, r_in.GetTime());
+    double scatter_pdf = material.Pdf(r_in, record, direction);
+    if (light_pdf <= 0 || scatter_pdf <= 0) {
+        return false;
+    }
+    sample.light = &light;
+    sample.shadow = Ray(record.hitpoint, direction, r_in.GetTime());
+    sample.f = material.Evaluate(r_in, record, direction);
+    sample.weight = PowerHeuristic(light_pdf, scatter_pdf) / light_pdf;
+    return true;
+}
+
+bool LocateLightSample(LightSample& sample, const MaterialTable& materials, RandomStream& rng) {
+    HitRecord light_record;
+    if (!sample.light->Hit(sample.shadow, Interval(0.001, kInfinity), light_record, rng)) {
+        return false;
+    }
+    sample.distance = light_record.t;
+    Color emitted = materials[light_record.material_id].Emitted(light_record.u, light_record.v, light_record.hitpoint);
+    sample.light_color = sample.f * emitted * sample.weight;
+    return true;
+}
+
+Color TraceLightSample(const LightSample& sample, const Hittable& world, const MaterialTable& materials,
+                       RandomStream& rng) {
+    LightSample located = sample;
+    if (!LocateLightSample(located, materials, rng)) {
+        return Color(0,0,0);
+    }
+    if (world.Occluded(located.shadow, ShadowInterval(located), rng)) {
+        return Color(0,0,0);
+    }
+    return located.light_color;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,107 @@
+#ifndef GPLAY_RABBIT_LIGHT_H
+#define GPLAY_RABBIT_LIGHT_H
+/*
+Class LightList - The emissive primitives of a scene, sampled directly by the integrator
+reference: https://raytracing.github.io/books/RayTracingTheRestOfYourLife.html
+           https://pbr-book.org/3ed-2018/Light_Transport_I_Surface_Reflection/Direct_Lighting
+Every primitive with an emissive material that is reachable without going through an instance is a light.
+Lights are picked uniformly, then the primitive samples a direction towards itself.
+*/
+
+#include <unordered_set>
+#include <vector>
+#include "rabbit/hittable.h"
+#include "rabbit/material.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+class LightList {
+public:
+    // LightList an empty list, i.e. no direct light sampling
+    LightList();
+
+    // LightList collects the emissive primitives of world
+    LightList(const Hittable& world, const MaterialTable& materials);
+
+    inline bool Empty() const {
+        return _lights.empty();
+    }
+
+    inline size_t Size() const {
+        return _lights.size();
+    }
+
+    // Pick selects a light uniformly, u is a sample in [0,1)
+    inline const Hittable& Pick(double u) const {
+        size_t index = static_cast<size_t>(u * _lights.size());
+        return *_lights[index < _lights.size() ? index : _lights.size() - 1];
+    }
+
+    // SelectionPdf probability with which Pick returns any given light
+    inline double SelectionPdf() const {
+        return _lights.empty() ? 0.0 : 1.0 / _lights.size();
+    }
+
+    // DirectionPdf solid angle density with which light sampling picks direction from origin towards light
+    inline double DirectionPdf(const Hittable& light, const Point3& origin, const Vec3& direction, double time) const {
+        return SelectionPdf() * light.DirectionPdf(origin, direction, time);
+    }
+
+    // Contains whether prim is one of the sampled lights
+    inline bool Contains(const Hittable* prim) const {
+        return _light_set.count(prim) > 0;
+    }
+
+private:
+    std::vector<const Hittable*> _lights;
+    std::unordered_set<const Hittable*> _light_set;
+};
+
+// Shadow rays stop this fraction short of the sampled light point, so that they do not hit the light itself
+const double kShadowEpsilon = 1e-5;
+
+// PowerHeuristic MIS weight of a sample drawn with density pdf_f against a second strategy with density pdf_g
+inline double PowerHeuristic(double pdf_f, double pdf_g) {
+    double f2 = pdf_f * pdf_f;
+    double g2 = pdf_g * pdf_g;
+    return f2 + g2 > 0 ? f2 / (f2 + g2) : 0;
+}
+
+// LightSample a direction towards a light, drawn for a scattering vertex and not yet tested for occlusion
+class LightSample {
+public:
+    const Hittable* light = nullptr;
+    Ray shadow;
+    // BSDF times cosine of the vertex for the shadow ray direction
+    Color f;
+    // MIS weight against material sampling divided by the light sampling density
+    double weight = 0;
+    // Set by LocateLightSample: distance to the light along the shadow ray and the weighted light it carries
+    double distance = 0;
+    Color light_color;
+};
+
+// SampleLightDirection picks a light and a direction towards it for the vertex record of material
+// Always draws the same sampler dimensions; false if the direction can not carry light
+bool SampleLightDirection(const LightList& lights, const Ray& r_in, const HitRecord& record, const Material& material,
+                          Sampler& sampler, LightSample& sample);
+
+// LocateLightSample finds the light point of sample and the light it carries, false if the shadow ray misses the light
+bool LocateLightSample(LightSample& sample, const MaterialTable& materials, RandomStream& rng);
+
+// ShadowInterval the part of the shadow ray of a located sample that has to be unblocked
+inline Interval ShadowInterval(const LightSample& sample) {
+    return Interval(0.001, sample.distance * (1 - kShadowEpsilon));
+}
+
+// TraceLightSample the weighted light that arrives along the shadow ray of sample, zero if it is blocked
+Color TraceLightSample(const LightSample& sample, const Hittable& world, const MaterialTable& materials,
+                       RandomStream& rng);
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_LIGHT_H
@@ -1,14 +1,20 @@
+#include <iostream>
+#include <string>
+
 #include "rabbit/draw.h"
-#include "rabbit/bvh.h"
+#include "rabbit/wide_bvh.h"
+#include "rabbit/mesh.h"
 #include "rabbit/object.h"
 
+using namespace gplay;
 using namespace gplay::rabbit;
 
 void RenderGroundAndSky() {
     HittableList world;
+    MaterialTable materials;
 
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-1), 100., std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-1), 100., materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
 
     Camera camera(
         Point3(0.,0.,0.),       // lookfrom
@@ -25,20 +31,21 @@ void RenderGroundAndSky() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_ground_and_sky.ppm");
+    RenderWorld(camera, world, materials, "render_ground_and_sky.ppm");
 }
 
 void RenderMaterialDemo() {
     HittableList world;
+    MaterialTable materials;
 
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
     // add a small lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, std::make_shared<Lambertian>(Color(0.3,0.3,0.3))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, materials.Add(std::make_shared<Lambertian>(Color(0.3,0.3,0.3)))));
     // add a metal sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3)));
+    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3))));
     // add another metal sphere with different albedo
-    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8))));
 
     Camera camera(
         Point3(0.,0.,0.),       // lookfrom
@@ -55,20 +62,21 @@ void RenderMaterialDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_material_demo.ppm");
+    RenderWorld(camera, world, materials, "render_material_demo.ppm");
 }
 
 void RenderMaterialWithPositionableCameraDemo() {
     HittableList world;
+    MaterialTable materials;
 
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
     // add a small lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, std::make_shared<Lambertian>(Color(0.3,0.3,0.3))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, materials.Add(std::make_shared<Lambertian>(Color(0.3,0.3,0.3)))));
     // add a metal sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3)));
+    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3))));
     // add another metal sphere with different albedo
-    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8))));
 
     Camera camera(
         Point3(-2.,2.,1.),      // lookfrom
@@ -85,20 +93,21 @@ void RenderMaterialWithPositionableCameraDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_material_with_positionable_camera_demo.ppm");
+    RenderWorld(camera, world, materials, "render_material_with_positionable_camera_demo.ppm");
 }
 
 void RenderMaterialWithSmallerFovDemo() {
     HittableList world;
+    MaterialTable materials;
 
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
     // add a small lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, std::make_shared<Lambertian>(Color(0.3,0.3,0.3))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, materials.Add(std::make_shared<Lambertian>(Color(0.3,0.3,0.3)))));
     // add a metal sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3)));
+    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3))));
     // add another metal sphere with different albedo
-    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8))));
 
     Camera camera(
         Point3(-2.,2.,1.),      // lookfrom
@@ -115,20 +124,21 @@ void RenderMaterialWithSmallerFovDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_material_with_smaller_fov_demo.ppm");
+    RenderWorld(camera, world, materials, "render_material_with_smaller_fov_demo.ppm");
 }
 
 void RenderMaterialWithDefocusBlurDemo() {
     HittableList world;
+    MaterialTable materials;
 
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
     // add a small lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, std::make_shared<Lambertian>(Color(0.3,0.3,0.3))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,0,-2), 0.5, materials.Add(std::make_shared<Lambertian>(Color(0.3,0.3,0.3)))));
     // add a metal sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3)));
+    world.AddObject(std::make_shared<Sphere>(Point3(1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.6,0.2), 0.3))));
     // add another metal sphere with different albedo
-    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-1,0,-2), 0.5, materials.Add(std::make_shared<Metal>(Color(0.8,0.8,0.8), 0.8))));
 
     auto lookfrom = Point3(-2.,2.,1.);
     auto lookat = Point3(0.,0.,-2.);
@@ -147,19 +157,20 @@ void RenderMaterialWithDefocusBlurDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_material_with_defocus_blur_demo.ppm");
+    RenderWorld(camera, world, materials, "render_material_with_defocus_blur_demo.ppm");
 }
 
 void RenderHollowGlassSphere() {
     HittableList world;
+    MaterialTable materials;
 
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-100.5,-2), 100., materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
     // add a hollow glass sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0.6,0.0,-2), 0.5, std::make_shared<Dielectric>(1.5)));
-    world.AddObject(std::make_shared<Sphere>(Point3(0.6,0.0,-2), 0.45, std::make_shared<Dielectric>(1.0/1.5)));
+    world.AddObject(std::make_shared<Sphere>(Point3(0.6,0.0,-2), 0.5, materials.Add(std::make_shared<Dielectric>(1.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0.6,0.0,-2), 0.45, materials.Add(std::make_shared<Dielectric>(1.0/1.5))));
     // add a glass sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(-0.6,0,-2), 0.5, std::make_shared<Dielectric>(1.5)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-0.6,0,-2), 0.5, materials.Add(std::make_shared<Dielectric>(1.5))));
 
     Camera camera(
         Point3(0.,0.,0.),       // lookfrom
@@ -176,52 +187,59 @@ void RenderHollowGlassSphere() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_hollow_glass_sphere.ppm");
+    RenderWorld(camera, world, materials, "render_hollow_glass_sphere.ppm");
 }
 
 void RenderMotionBlurDemo() {
     HittableList world;
+    MaterialTable materials;
+    RandomStream rng(2024, 0);
 
     // add a very big sphere as ground
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, std::make_shared<Lambertian>(Color(0.5,0.5,0.5))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
 
     // add small spheres randomly
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
-            auto choose_prob = RandomDouble();
-            Point3 center(a + 0.9*RandomDouble(), 0.2, b + 0.9*RandomDouble());
+            auto choose_prob = RandomDouble(rng);
+            Point3 center(a + 0.9*RandomDouble(rng), 0.2, b + 0.9*RandomDouble(rng));
 
             if (((center - Point3(-4, 0.2, 0)).Length() > 0.9) &&
                 ((center - Point3(0, 0.2, 0)).Length() > 0.9) &&
                 ((center - Point3(4, 0.2, 0)).Length() > 0.9)) {
                 if (choose_prob < 0.8) {
                     // diffuse
-                    auto center_mv = center + Vec3(0, RandomDouble(0,0.2), 0);
+                    auto center_mv = center + Vec3(0, RandomDouble(rng,0,0.2), 0);
                     world.AddObject(std::make_shared<Sphere>(center, center_mv, 0.2,
-                        std::make_shared<Lambertian>(RandomVec3()*RandomVec3())));
+                        materials.Add(std::make_shared<Lambertian>(RandomVec3(rng)*RandomVec3(rng)))));
                 } else if (choose_prob < 0.95) {
                     // metal
-                    auto fuzz =  RandomDouble(0, 0.5);
+                    auto fuzz =  RandomDouble(rng, 0, 0.5);
                     world.AddObject(std::make_shared<Sphere>(center, 0.2,
-                        std::make_shared<Metal>(RandomVec3(0.5,1.0), fuzz)));
+                        materials.Add(std::make_shared<Metal>(RandomVec3(rng,0.5,1.0), fuzz))));
                 } else {
                     // glass
                     world.AddObject(std::make_shared<Sphere>(center, 0.2,
-                        std::make_shared<Dielectric>(1.5)));
+                        materials.Add(std::make_shared<Dielectric>(1.5))));
                 }
             }
         }
     }
 
     // add a big dielectric sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(0,1,0), 1, std::make_shared<Dielectric>(1.5)));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,1,0), 1, materials.Add(std::make_shared<Dielectric>(1.5))));
     // add a big lambertian sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(4,1,0), 1, std::make_shared<Lambertian>(Color(0.3,0.5,0.2))));
+    world.AddObject(std::make_shared<Sphere>(Point3(4,1,0), 1, materials.Add(std::make_shared<Lambertian>(Color(0.3,0.5,0.2)))));
     // add a big metal sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(-4,1,0), 1, std::make_shared<Metal>(Color(0.7,0.6,0.5), 0.3)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-4,1,0), 1, materials.Add(std::make_shared<Metal>(Color(0.7,0.6,0.5), 0.3))));
 
     // construct bvh to speed up rendering
-    world = HittableList(std::make_shared<BVHNode>(world));
+    // the leaves test their spheres two at a time, so a few more spheres per leaf are cheaper than extra nodes
+    BVHBuildOptions bvh_options;
+    bvh_options.traversal_cost = 3.0;
+    auto bvh = std::make_shared<WideBVH>(world, bvh_options);
+    std::clog << bvh->GetBuildStats() << '\n' << bvh->GetWideStats() << '\n';
+    world = HittableList(bvh);
 
     Camera camera(
         Point3(-13.,2.,3.),     // lookfrom
@@ -238,15 +256,16 @@ void RenderMotionBlurDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_motion_blur.ppm");
+    RenderWorld(camera, world, materials, "render_motion_blur.ppm");
 }
 
 void RenderCheckeredSpheres() {
     HittableList world;
+    MaterialTable materials;
 
     auto checker_texture = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-10, 0), 10, std::make_shared<Lambertian>(checker_texture)));
-    world.AddObject(std::make_shared<Sphere>(Point3(0, 10, 0), 10, std::make_shared<Lambertian>(checker_texture)));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-10, 0), 10, materials.Add(std::make_shared<Lambertian>(checker_texture))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0, 10, 0), 10, materials.Add(std::make_shared<Lambertian>(checker_texture))));
 
     Camera camera(
         Point3(13.,2.,3.),      // lookfrom
@@ -263,19 +282,20 @@ void RenderCheckeredSpheres() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_checkered_spheres.ppm");
+    RenderWorld(camera, world, materials, "render_checkered_spheres.ppm");
 }
 
 void RenderTextureMappingDemo() {
     HittableList world;
+    MaterialTable materials;
 
     auto checker_texture = std::make_shared<CheckerTexture>(0.32, Color(.2, .3, .1), Color(.9, .9, .9));
     auto earth_image_texture = std::make_shared<ImageTexture>("earthmap.jpg");
 
     // add a very big sphere as ground
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, std::make_shared<Lambertian>(checker_texture)));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, materials.Add(std::make_shared<Lambertian>(checker_texture))));
     // add a sphere with earth image texture
-    world.AddObject(std::make_shared<Sphere>(Point3(-2,2,0), 2, std::make_shared<Lambertian>(earth_image_texture)));
+    world.AddObject(std::make_shared<Sphere>(Point3(-2,2,0), 2, materials.Add(std::make_shared<Lambertian>(earth_image_texture))));
 
     Camera camera(
         Point3(18, 5, 10),      // lookfrom
@@ -292,15 +312,16 @@ void RenderTextureMappingDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_texture_mapping_demo.ppm");
+    RenderWorld(camera, world, materials, "render_texture_mapping_demo.ppm");
 }
 
 void RenderPerlinSpheres() {
     HittableList world;
+    MaterialTable materials;
 
     auto perlin_noise_texture = std::make_shared<NoiseTexture>(4, std::make_shared<PerlinNoise>());
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, std::make_shared<Lambertian>(perlin_noise_texture)));
-    world.AddObject(std::make_shared<Sphere>(Point3(0,2,0), 2, std::make_shared<Lambertian>(perlin_noise_texture)));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, materials.Add(std::make_shared<Lambertian>(perlin_noise_texture))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,2,0), 2, materials.Add(std::make_shared<Lambertian>(perlin_noise_texture))));
 
     Camera camera(
         Point3(18, 5, 10),      // lookfrom
@@ -317,19 +338,20 @@ void RenderPerlinSpheres() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_perlin_spheres.ppm");
+    RenderWorld(camera, world, materials, "render_perlin_spheres.ppm");
 }
 
 void RenderSimpleLightDemo() {
     HittableList world;
+    MaterialTable materials;
 
     auto perlin_noise_texture = std::make_shared<NoiseTexture>(4, std::make_shared<PerlinNoise>());
-    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, std::make_shared<Lambertian>(perlin_noise_texture)));
-    world.AddObject(std::make_shared<Sphere>(Point3(0,2,0), 2, std::make_shared<Lambertian>(perlin_noise_texture)));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, materials.Add(std::make_shared<Lambertian>(perlin_noise_texture))));
+    world.AddObject(std::make_shared<Sphere>(Point3(0,2,0), 2, materials.Add(std::make_shared<Lambertian>(perlin_noise_texture))));
     // add a small lighting sphere
-    world.AddObject(std::make_shared<Sphere>(Point3(3,1,0), 1, std::make_shared<DiffuseLight>(Color(4,4,4))));
+    world.AddObject(std::make_shared<Sphere>(Point3(3,1,0), 1, materials.Add(std::make_shared<DiffuseLight>(Color(4,4,4)))));
     // add a lighting rectangle
-    world.AddObject(std::make_shared<Quadrilateral>(Point3(-1,5,-1), Vec3(2,0,0), Vec3(0,0,2), std::make_shared<DiffuseLight>(Color(1,0,0))));
+    world.AddObject(std::make_shared<Quadrilateral>(Point3(-1,5,-1), Vec3(2,0,0), Vec3(0,0,2), materials.Add(std::make_shared<DiffuseLight>(Color(1,0,0)))));
 
     Camera camera(
         Point3(18, 10, 10),     // lookfrom
@@ -346,16 +368,17 @@ void RenderSimpleLightDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_simple_light_demo.ppm");
+    RenderWorld(camera, world, materials, "render_simple_light_demo.ppm");
 }
 
 void RenderCornellBoxDemo() {
     HittableList world;
+    MaterialTable materials;
 
-    auto red   = std::make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+    auto red   = materials.Add(std::make_shared<Lambertian>(Color(.65, .05, .05)));
+    auto white = materials.Add(std::make_shared<Lambertian>(Color(.73, .73, .73)));
+    auto green = materials.Add(std::make_shared<Lambertian>(Color(.12, .45, .15)));
+    auto light = materials.Add(std::make_shared<DiffuseLight>(Color(7, 7, 7)));
 
     world.AddObject(std::make_shared<Quadrilateral>(Point3(555,0,0), Vec3(0,555,0), Vec3(0,0,555), green));
     world.AddObject(std::make_shared<Quadrilateral>(Point3(0,0,0), Vec3(0,555,0), Vec3(0,0,555), red));
@@ -389,16 +412,17 @@ void RenderCornellBoxDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_cornell_box_demo.ppm");
+    RenderWorld(camera, world, materials, "render_cornell_box_demo.ppm");
 }
 
 void RenderCornellBoxWithVolumesDemo() {
     HittableList world;
+    MaterialTable materials;
 
-    auto red   = std::make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+    auto red   = materials.Add(std::make_shared<Lambertian>(Color(.65, .05, .05)));
+    auto white = materials.Add(std::make_shared<Lambertian>(Color(.73, .73, .73)));
+    auto green = materials.Add(std::make_shared<Lambertian>(Color(.12, .45, .15)));
+    auto light = materials.Add(std::make_shared<DiffuseLight>(Color(7, 7, 7)));
 
     world.AddObject(std::make_shared<Quadrilateral>(Point3(555,0,0), Vec3(0,555,0), Vec3(0,0,555), green));
     world.AddObject(std::make_shared<Quadrilateral>(Point3(0,0,0), Vec3(0,555,0), Vec3(0,0,555), red));
@@ -410,12 +434,12 @@ void RenderCornellBoxWithVolumesDemo() {
     std::shared_ptr<Hittable> box1 = std::make_shared<Box>(Point3(0,0,0), Point3(165,330,165), white);
     box1 = std::make_shared<ObjectYRotated>(box1, 15);
     box1 = std::make_shared<ObjectTranslated>(box1, Vec3(265,0,295));
-    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(box1, 0.01, Color(0,0,0)));
+    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(box1, 0.01, materials.Add(std::make_shared<Isotropic>(Color(0,0,0)))));
 
     std::shared_ptr<Hittable> box2 = std::make_shared<Box>(Point3(0,0,0), Point3(165,165,165), white);
     box2 = std::make_shared<ObjectYRotated>(box2, -18);
     box2 = std::make_shared<ObjectTranslated>(box2, Vec3(130,0,65));
-    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(box2, 0.01, Color(1,1,1)));
+    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(box2, 0.01, materials.Add(std::make_shared<Isotropic>(Color(1,1,1)))));
 
     Camera camera(
         Point3(278, 278, -800),    // lookfrom
@@ -432,16 +456,17 @@ void RenderCornellBoxWithVolumesDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_cornell_box_with_volumes_demo.ppm");
+    RenderWorld(camera, world, materials, "render_cornell_box_with_volumes_demo.ppm");
 }
 
 void RenderCornellBoxWithSubsurfaceScatteringDemo() {
     HittableList world;
+    MaterialTable materials;
 
-    auto red   = std::make_shared<Lambertian>(Color(.65, .05, .05));
-    auto white = std::make_shared<Lambertian>(Color(.73, .73, .73));
-    auto green = std::make_shared<Lambertian>(Color(.12, .45, .15));
-    auto light = std::make_shared<DiffuseLight>(Color(7, 7, 7));
+    auto red   = materials.Add(std::make_shared<Lambertian>(Color(.65, .05, .05)));
+    auto white = materials.Add(std::make_shared<Lambertian>(Color(.73, .73, .73)));
+    auto green = materials.Add(std::make_shared<Lambertian>(Color(.12, .45, .15)));
+    auto light = materials.Add(std::make_shared<DiffuseLight>(Color(7, 7, 7)));
 
     world.AddObject(std::make_shared<Quadrilateral>(Point3(555,0,0), Vec3(0,555,0), Vec3(0,0,555), green));
     world.AddObject(std::make_shared<Quadrilateral>(Point3(0,0,0), Vec3(0,555,0), Vec3(0,0,555), red));
@@ -450,13 +475,13 @@ void RenderCornellBoxWithSubsurfaceScatteringDemo() {
     world.AddObject(std::make_shared<Quadrilateral>(Point3(0,0,555), Vec3(555,0,0), Vec3(0,555,0), white));
     world.AddObject(std::make_shared<Quadrilateral>(Point3(113,554,127), Vec3(330,0,0), Vec3(0,0,305), light));
 
-    auto sphere1 = std::make_shared<Sphere>(Point3(360, 120, 270), 120, std::make_shared<Dielectric>(1.6));
+    auto sphere1 = std::make_shared<Sphere>(Point3(360, 120, 270), 120, materials.Add(std::make_shared<Dielectric>(1.6)));
     world.AddObject(sphere1);
-    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(sphere1, 0.1, Color(0.2, 0.4, 0.9)));
+    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(sphere1, 0.1, materials.Add(std::make_shared<Isotropic>(Color(0.2, 0.4, 0.9)))));
 
-    auto sphere2 = std::make_shared<Sphere>(Point3(180, 65, 140), 65, std::make_shared<Dielectric>(1.6));
+    auto sphere2 = std::make_shared<Sphere>(Point3(180, 65, 140), 65, materials.Add(std::make_shared<Dielectric>(1.6)));
     world.AddObject(sphere2);
-    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(sphere2, 0.1, Color(0.2, 0.8, 0.4)));
+    world.AddObject(std::make_shared<ObjectWithConstDensityMedium>(sphere2, 0.1, materials.Add(std::make_shared<Isotropic>(Color(0.2, 0.8, 0.4)))));
 
     Camera camera(
         Point3(278, 278, -800),    // lookfrom
@@ -473,10 +498,118 @@ void RenderCornellBoxWithSubsurfaceScatteringDemo() {
     );
     camera.Initialize();
 
-    RenderWorld(camera, world, "render_cornell_box_with_subsurface_scattering_demo.ppm");
+    RenderWorld(camera, world, materials, "render_cornell_box_with_subsurface_scattering_demo.ppm");
+}
+
+void RenderInstancingDemo() {
+    HittableList world;
+    MaterialTable materials;
+    RandomStream rng(7, 0);
+
+    // add a very big sphere as ground
+    world.AddObject(std::make_shared<Sphere>(Point3(0,-1000,0), 1000, materials.Add(std::make_shared<Lambertian>(Color(0.5,0.5,0.5)))));
+
+    // bottom level: one small tower built once and shared by every copy
+    HittableList tower;
+    tower.AddObject(std::make_shared<Box>(Point3(-0.15,0,-0.15), Point3(0.15,0.5,0.15),
+        materials.Add(std::make_shared<Lambertian>(Color(0.8,0.3,0.2)))));
+    tower.AddObject(std::make_shared<Sphere>(Point3(0,0.65,0), 0.15, materials.Add(std::make_shared<Metal>(Color(0.8,0.8,0.9), 0.1))));
+    auto tower_bvh = std::make_shared<WideBVH>(tower);
+
+    // top level: ten thousand rotated, scaled and translated instances of the tower
+    HittableList instances;
+    for (int a = -50; a < 50; a++) {
+        for (int b = -50; b < 50; b++) {
+            double height = RandomDouble(rng, 0.5, 2.0);
+            Transform object_to_world = Transform::Scaling(Vec3(1, height, 1))
+                .Then(Transform::RotationY(RandomDouble(rng, 0, 90)))
+                .Then(Transform::Translation(Vec3(a*0.6, 0, b*0.6)));
+            instances.AddObject(std::make_shared<Instance>(tower_bvh, object_to_world));
+        }
+    }
+    auto bvh = std::make_shared<WideBVH>(instances);
+    std::clog << bvh->GetBuildStats() << '\n' << bvh->GetWideStats() << '\n';
+    world.AddObject(bvh);
+
+    Camera camera(
+        Point3(-12.,6.,10.),    // lookfrom
+        Point3(0.,0.,0.),       // lookat
+        Vec3(0.,1.,0.),         // vup
+        30,                     // vfov
+        16.0 / 9.0,             // aspect ratio
+        1024,                   // image width
+        64,                     // samples per pixel
+        32,                     // bounce max depth
+        0,                      // defocus angle
+        10.0,                   // focus distance
+        Color(0.7, 0.8, 1.0)    // background color
+    );
+    camera.Initialize();
+
+    RenderWorld(camera, world, materials, "render_instancing_demo.ppm");
 }
 
-int main() {
+void RenderTriangleMeshDemo() {
+    HittableList world;
+    MaterialTable materials;
+
+    // the OBJ file is looked up in GPLAY_MESHDATA_DIR and the working directory
+    auto mesh = std::make_shared<TriangleMesh>(gassets::MeshData("cow.obj"),
+        materials.Add(std::make_shared<Lambertian>(Color(0.8, 0.6, 0.4))));
+    if (mesh->TriangleCount() == 0) {
+        std::cerr << "ERROR: No triangles loaded from 'cow.obj', skipping the triangle mesh demo.\n";
+        return;
+    }
+    std::clog << mesh->TriangleCount() << " triangles\n" << mesh->GetBuildStats() << '\n';
+
+    // frame the mesh standing on a large ground sphere
+    AxisAlignedBoundingBox bbox = mesh->GetBoundingBox();
+    Point3 center = 0.5 * (Point3(bbox.x.GetMin(), bbox.y.GetMin(), bbox.z.GetMin()) +
+                           Point3(bbox.x.GetMax(), bbox.y.GetMax(), bbox.z.GetMax()));
+    double size = std::max(bbox.x.Size(), std::max(bbox.y.Size(), bbox.z.Size()));
+    double ground_radius = 1000 * size;
+    world.AddObject(std::make_shared<Sphere>(Point3(center.X(), bbox.y.GetMin() - ground_radius, center.Z()),
+        ground_radius, materials.Add(std::make_shared<Lambertian>(Color(0.5, 0.5, 0.5)))));
+    world.AddObject(mesh);
+    world.AddObject(std::make_shared<Sphere>(center + Vec3(-size, 2*size, -size), 0.5*size,
+        materials.Add(std::make_shared<DiffuseLight>(Color(6, 6, 6)))));
+
+    Camera camera(
+        center + Vec3(1.2*size, 0.6*size, 1.6*size),    // lookfrom
+        center,                                         // lookat
+        Vec3(0.,1.,0.),                                 // vup
+        40,                                             // vfov
+        16.0 / 9.0,                                     // aspect ratio
+        800,                                            // image width
+        64,                                             // samples per pixel
+        16,                                             // bounce max depth
+        0,                                              // defocus angle
+        10.0,                                           // focus distance
+        Color(0.5, 0.6, 0.7)                            // background color
+    );
+    camera.Initialize();
+
+    RenderWorld(camera, world, materials, "render_triangle_mesh_demo.ppm");
+}
+
+int main(int argc, char** argv) {
+    // heavier demos and the ones that need assets outside the repository are opt-in, run them by name,
+    // e.g. `rabbit instancing mesh`
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            std::string demo = argv[i];
+            if (demo == "instancing") {
+                RenderInstancingDemo();
+            } else if (demo == "mesh") {
+                RenderTriangleMeshDemo();
+            } else {
+                std::cerr << "ERROR: Unknown demo '" << demo << "'.\n";
+                return 1;
+            }
+        }
+        return 0;
+    }
+
     RenderGroundAndSky();
     RenderMaterialDemo();
     RenderMaterialWithPositionableCameraDemo();
@@ -4,47 +4,72 @@ namespace gplay {
 
 namespace rabbit {
 
+bool Material::Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered, Sampler& sampler) const {
+    ScatterSample sample;
+    if (!Sample(r_in, record, sample, sampler)) {
+        return false;
+    }
+    attenuation = sample.weight;
+    r_scattered = sample.scattered;
+    return true;
+}
+
 Lambertian::Lambertian(const Color& albedo) : _texture(std::make_shared<SolidColor>(albedo)) {}
 
 Lambertian::Lambertian(std::shared_ptr<Texture> texture) : _texture(texture) {}
 
-bool Lambertian::Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const {
-    Vec3 scatter_direction = record.normal + RandomUnitVec3();
+Color Lambertian::Evaluate(const Ray& r_in, const HitRecord& record, const Vec3& direction) const {
+    // BRDF albedo / pi times the cosine
+    return _texture->Value(record.u, record.v, record.hitpoint) * Pdf(r_in, record, direction);
+}
+
+bool Lambertian::Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const {
+    // normal + random unit vector is cosine distributed around the normal, which cancels the cosine of the BRDF
+    Vec3 scatter_direction = record.normal + SampleUnitVec3(sampler.Get2D());
     if (scatter_direction.IsNearZero()) {
         scatter_direction = record.normal;
     }
 
-    r_scattered = Ray(record.hitpoint, scatter_direction, r_in.GetTime());
-    attenuation = _texture->Value(record.u, record.v, record.hitpoint);
-    return true;
+    sample.scattered = Ray(record.hitpoint, scatter_direction, r_in.GetTime());
+    sample.weight = _texture->Value(record.u, record.v, record.hitpoint);
+    sample.pdf = Pdf(r_in, record, scatter_direction);
+    // a direction tangent to the surface carries no light
+    return sample.pdf > 0;
+}
+
+double Lambertian::Pdf(const Ray& r_in, const HitRecord& record, const Vec3& direction) const {
+    double cos_theta = Vec3Dot(record.normal, UnitVec(direction));
+    return cos_theta < 0 ? 0 : cos_theta / kPI;
 }
 
 Metal::Metal(const Color& albedo, double fuzz) : _albedo(albedo), _fuzz(fuzz < 1 ? fuzz : 1) {}
 
-bool Metal::Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const {
+bool Metal::Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const {
     Vec3 reflected = ReflectVec3(r_in.GetDirection(), record.normal);
-    reflected = UnitVec(reflected) + (_fuzz * RandomUnitVec3());
-    r_scattered = Ray(record.hitpoint, reflected, r_in.GetTime());
-    attenuation = _albedo;
-    return Vec3Dot(r_scattered.GetDirection(), record.normal) > 0;
+    reflected = UnitVec(reflected) + (_fuzz * SampleUnitVec3(sampler.Get2D()));
+    sample.scattered = Ray(record.hitpoint, reflected, r_in.GetTime());
+    sample.weight = _albedo;
+    sample.pdf = 0;
+    return Vec3Dot(sample.scattered.GetDirection(), record.normal) > 0;
 }
 
 Dielectric::Dielectric(double refractive_index) : _refractive_index(refractive_index) {}
 
-bool Dielectric::Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const {
-    attenuation = Color(1.0, 1.0, 1.0); // the glass surface absorbs nothing
+bool Dielectric::Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const {
+    sample.weight = Color(1.0, 1.0, 1.0); // the glass surface absorbs nothing
+    sample.pdf = 0;
     double ri = record.IsFrontFace() ? (1.0/_refractive_index) : _refractive_index;
     Vec3 unit_direction = UnitVec(r_in.GetDirection());
     double cos_theta = std::fmin(Vec3Dot(-unit_direction, record.normal), 1.0);
     double sin_theta = std::sqrt(1.0 - cos_theta*cos_theta);
 
     Vec3 scatter_direction;
-    if (ri*sin_theta > 1.0 || SchlickApprox(cos_theta, ri) > RandomDouble()) {
+    if (ri*sin_theta > 1.0 || SchlickApprox(cos_theta, ri) > sampler.Get1D()) {
         scatter_direction = ReflectVec3(unit_direction, record.normal);
     } else {
         scatter_direction = RefractVec3(unit_direction, record.normal, ri);
     }
-    r_scattered = Ray(record.hitpoint, scatter_direction, r_in.GetTime());
+    sample.scattered = Ray(record.hitpoint, scatter_direction, r_in.GetTime());
     return true;
 }
 
@@ -60,12 +85,26 @@ Isotropic::Isotropic(const Color& albedo) : _texture(std::make_shared<SolidColor
 
 Isotropic::Isotropic(std::shared_ptr<Texture> texture) : _texture(texture) {}
 
-bool Isotropic::Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const {
-    r_scattered = Ray(record.hitpoint, RandomUnitVec3(), r_in.GetTime()); // isotropic scatter
-    attenuation = _texture->Value(record.u, record.v, record.hitpoint);
+Color Isotropic::Evaluate(const Ray& r_in, const HitRecord& record, const Vec3& direction) const {
+    return _texture->Value(record.u, record.v, record.hitpoint) * Pdf(r_in, record, direction);
+}
+
+bool Isotropic::Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const {
+    sample.scattered = Ray(record.hitpoint, SampleUnitVec3(sampler.Get2D()), r_in.GetTime()); // isotropic scatter
+    sample.weight = _texture->Value(record.u, record.v, record.hitpoint);
+    sample.pdf = Pdf(r_in, record, sample.scattered.GetDirection());
     return true;
 }
 
+double Isotropic::Pdf(const Ray& r_in, const HitRecord& record, const Vec3& direction) const {
+    return 1 / (4 * kPI);
+}
+
+uint32_t MaterialTable::Add(std::shared_ptr<Material> material) {
+    _materials.push_back(material);
+    return static_cast<uint32_t>(_materials.size() - 1);
+}
+
 } // namespace rabbit
 
 } // namespace gplay
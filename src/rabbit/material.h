@@ -6,12 +6,31 @@ reference: https://github.com/RayTracing/raytracing.github.io/blob/release/src/T
 */
 
 #include "rabbit/hittable.h"
+#include "rabbit/sampler.h"
 #include "rabbit/texture.h"
 
 namespace gplay {
 
 namespace rabbit {
 
+// ScatterSample an incoming light direction drawn by Material::Sample
+class ScatterSample {
+public:
+    Ray scattered;
+    // BSDF times cosine divided by pdf, the factor that the path throughput is multiplied with
+    Color weight;
+    // Solid angle density of the scattered direction, 0 for specular (delta) scattering without a density
+    double pdf = 0;
+
+    inline bool IsSpecular() const {
+        return pdf == 0;
+    }
+};
+
+// Material surface and volume scattering
+// Materials with a density implement Evaluate, Sample and Pdf consistently, i.e. for a sampled direction
+// weight == Evaluate / Pdf, so that samples of different strategies can be weighted against each other.
+// Specular materials only implement Sample and report pdf 0.
 class Material {
 public:
     virtual ~Material() = default;
@@ -20,9 +39,28 @@ public:
         return Color(0, 0, 0);
     }
 
-    virtual bool Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const {
+    // IsEmissive whether Emitted may return light, primitives with an emissive material are sampled as lights
+    virtual bool IsEmissive() const {
+        return false;
+    }
+
+    // Evaluate BSDF (phase function for volumes) times the cosine to the normal for light arriving from direction
+    virtual Color Evaluate(const Ray& r_in, const HitRecord& record, const Vec3& direction) const {
+        return Color(0, 0, 0);
+    }
+
+    // Sample draws a scattered direction with its weight and pdf, false if the ray is absorbed
+    virtual bool Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const {
         return false;
     }
+
+    // Pdf solid angle density with which Sample picks direction
+    virtual double Pdf(const Ray& r_in, const HitRecord& record, const Vec3& direction) const {
+        return 0;
+    }
+
+    // Scatter the attenuation and scattered ray of a sample, for callers that do not need the densities
+    bool Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered, Sampler& sampler) const;
 };
 
 // Lambertian diffuse reflectance
@@ -31,7 +69,11 @@ public:
     Lambertian(const Color& albedo);
     Lambertian(std::shared_ptr<Texture> texture);
 
-    bool Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const override;
+    Color Evaluate(const Ray& r_in, const HitRecord& record, const Vec3& direction) const override;
+
+    bool Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const override;
+
+    double Pdf(const Ray& r_in, const HitRecord& record, const Vec3& direction) const override;
 
 private:
     std::shared_ptr<Texture> _texture;
@@ -42,7 +84,8 @@ class Metal : public Material {
 public:
     Metal(const Color& albedo, double fuzz);
 
-    bool Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const override;
+    // Sample reflects about the normal and perturbs the result within the fuzz sphere, treated as specular
+    bool Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const override;
 
 private:
     // Define some form of fractional reflectance i.e. whiteness
@@ -57,7 +100,8 @@ class Dielectric : public Material {
 public:
     Dielectric(double refractive_index);
 
-    bool Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const override;
+    // Sample chooses reflection or refraction by the Schlick approximation of the Fresnel factor
+    bool Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const override;
 
 private:
     // Refractive index in vacuum or air, or the ratio of the material's refractive index over
@@ -73,6 +117,10 @@ public:
 
     Color Emitted(double u, double v, const Point3& p) const override;
 
+    bool IsEmissive() const override {
+        return true;
+    }
+
 private:
     std::shared_ptr<Texture> _texture;
 };
@@ -83,12 +131,34 @@ public:
     Isotropic(const Color& albedo);
     Isotropic(std::shared_ptr<Texture> texture);
 
-    bool Scatter(const Ray& r_in, const HitRecord& record, Color& attenuation, Ray& r_scattered) const override;
+    Color Evaluate(const Ray& r_in, const HitRecord& record, const Vec3& direction) const override;
+
+    bool Sample(const Ray& r_in, const HitRecord& record, ScatterSample& sample, Sampler& sampler) const override;
+
+    double Pdf(const Ray& r_in, const HitRecord& record, const Vec3& direction) const override;
 
 private:
     std::shared_ptr<Texture> _texture;
 };
 
+// MaterialTable scene owned storage of the materials, primitives and hit records refer to them by a 32-bit id
+// so that the hit path never touches shared ownership counters
+class MaterialTable {
+public:
+    // Add stores material and returns its id
+    uint32_t Add(std::shared_ptr<Material> material);
+
+    inline const Material& operator[](uint32_t id) const {
+        return *_materials[id];
+    }
+
+    inline size_t Size() const {
+        return _materials.size();
+    }
+
+private:
+    std::vector<std::shared_ptr<Material>> _materials;
+};
 
 } // namespace rabbit
 
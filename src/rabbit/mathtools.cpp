@@ -25,35 +25,35 @@ Interval operator+(double displacement, const Interval& ival) {
     return ival + displacement;
 }
 
-void RandomPermuteArray(int arr[], int n) {
+void RandomPermuteArray(RandomStream& rng, int arr[], int n) {
     for (int i = n-1; i > 0; i--) {
-        int target = RandomInt(0, i);
+        int target = RandomInt(rng, 0, i);
         std::swap(arr[i], arr[target]);
     }
 }
 
-Point3 RandomPointInUnitDisk() {
+Point3 RandomPointInUnitDisk(RandomStream& rng) {
     // rejection sampling
     while (true) {
-        Point3 p = Point3(RandomDouble(-1.0,1.0), RandomDouble(-1.0,1.0), 0);
+        Point3 p = Point3(RandomDouble(rng,-1.0,1.0), RandomDouble(rng,-1.0,1.0), 0);
         if (p.LengthSquared() < 1.0) {
             return p;
         }
     }
 }
 
-Point3 RandomPointInDisk(double radius) {
-    return radius * RandomPointInUnitDisk();
+Point3 RandomPointInDisk(RandomStream& rng, double radius) {
+    return radius * RandomPointInUnitDisk(rng);
 }
 
-Point3 RandomPointInUnitSquare() {
-    return Point3(RandomDouble()-0.5, RandomDouble()-0.5, 0);
+Point3 RandomPointInUnitSquare(RandomStream& rng) {
+    return Point3(RandomDouble(rng)-0.5, RandomDouble(rng)-0.5, 0);
 }
 
-Vec3 RandomUnitVec3() {
+Vec3 RandomUnitVec3(RandomStream& rng) {
     // rejection sampling
     while (true) {
-        Vec3 p = RandomVec3(-1.0,1.0);
+        Vec3 p = RandomVec3(rng,-1.0,1.0);
         double lensq = p.LengthSquared();
         if (1e-160 < lensq && lensq <= 1.0) {
             return p / std::sqrt(lensq);
@@ -61,6 +61,31 @@ Vec3 RandomUnitVec3() {
     }
 }
 
+Point3 SamplePointInUnitDisk(const Sample2D& u) {
+    // Shirley-Chiu concentric mapping: squares around the center go to rings of the disk
+    double a = 2*u.x - 1;
+    double b = 2*u.y - 1;
+    if (a == 0 && b == 0) {
+        return Point3(0, 0, 0);
+    }
+    double r, theta;
+    if (std::fabs(a) > std::fabs(b)) {
+        r = a;
+        theta = (kPI/4) * (b/a);
+    } else {
+        r = b;
+        theta = (kPI/2) - (kPI/4) * (a/b);
+    }
+    return Point3(r*std::cos(theta), r*std::sin(theta), 0);
+}
+
+Vec3 SampleUnitVec3(const Sample2D& u) {
+    double z = 1 - 2*u.x;
+    double r = std::sqrt(std::fmax(0.0, 1 - z*z));
+    double phi = 2*kPI*u.y;
+    return Vec3(r*std::cos(phi), r*std::sin(phi), z);
+}
+
 Vec3 ReflectVec3(const Vec3& v, const Vec3& n) {
     return v - 2 * Vec3Dot(v,n) * n;
 }
@@ -5,7 +5,8 @@ Math tools - Utility Functions
 reference: https://github.com/RayTracing/raytracing.github.io/blob/release/src/TheNextWeek
 */
 
-#include <random>
+#include <limits>
+#include "rabbit/rng.h"
 #include "rabbit/vec3.h"
 
 namespace gplay {
@@ -91,46 +92,58 @@ inline double DegreesToRadians(double degrees) {
 }
 
 // RandomDouble returns a random real in [0,1).
-inline double RandomDouble() {
-    // return std::rand() / (RAND_MAX + 1.0);
-
-    static std::uniform_real_distribution<double> distribution(0.0, 1.0);
-    static std::mt19937 generator;
-    return distribution(generator);
+inline double RandomDouble(RandomStream& rng) {
+    return rng.NextDouble();
 }
 
 // RandomDouble returns a random real in [min,max).
-inline double RandomDouble(double min, double max) {
-    return min + (max-min) * RandomDouble();
+inline double RandomDouble(RandomStream& rng, double min, double max) {
+    return min + (max-min) * RandomDouble(rng);
 }
 
 // RandomInt returns a random integer in [min,max].
-inline int RandomInt(int min, int max) {
-    return int(RandomDouble(min, max+1));
+inline int RandomInt(RandomStream& rng, int min, int max) {
+    return int(RandomDouble(rng, min, max+1));
 }
 
-inline Vec3 RandomVec3() {
-    return Vec3(RandomDouble(), RandomDouble(), RandomDouble());
+inline Vec3 RandomVec3(RandomStream& rng) {
+    return Vec3(RandomDouble(rng), RandomDouble(rng), RandomDouble(rng));
 }
 
-inline Vec3 RandomVec3(double min, double max) {
-    return Vec3(RandomDouble(min, max), RandomDouble(min, max), RandomDouble(min, max));
+inline Vec3 RandomVec3(RandomStream& rng, double min, double max) {
+    return Vec3(RandomDouble(rng, min, max), RandomDouble(rng, min, max), RandomDouble(rng, min, max));
 }
 
+// Sample2D a point of the unit square [0,1)^2, e.g. two dimensions of a Sampler
+class Sample2D {
+public:
+    Sample2D() : x(0), y(0) {}
+    Sample2D(double x, double y) : x(x), y(y) {}
+
+    double x;
+    double y;
+};
+
 // RandomPermuteArray ...
-void RandomPermuteArray(int arr[], int n);
+void RandomPermuteArray(RandomStream& rng, int arr[], int n);
 
 // RandomPointInUnitDisk returns a random point in the unit disk centered at the origin
-Point3 RandomPointInUnitDisk();
+Point3 RandomPointInUnitDisk(RandomStream& rng);
 
 // RandomPointInDisk returns a random point in the disk with specific radius centered at the origin
-Point3 RandomPointInDisk(double radius);
+Point3 RandomPointInDisk(RandomStream& rng, double radius);
 
 // RandomPointInUnitSquare returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square
-Point3 RandomPointInUnitSquare();
+Point3 RandomPointInUnitSquare(RandomStream& rng);
 
 // RandomUnitVec3 return random vector on the surface of the unit sphere
-Vec3 RandomUnitVec3();
+Vec3 RandomUnitVec3(RandomStream& rng);
+
+// SamplePointInUnitDisk maps u to the unit disk with the concentric mapping, which keeps the stratification of u
+Point3 SamplePointInUnitDisk(const Sample2D& u);
+
+// SampleUnitVec3 maps u to a uniformly distributed point on the surface of the unit sphere
+Vec3 SampleUnitVec3(const Sample2D& u);
 
 // ReflectVec3 mirrored reflection
 Vec3 ReflectVec3(const Vec3& v, const Vec3& n);
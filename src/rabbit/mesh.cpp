@@ -0,0 +1,284 @@
+#include <cmath>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+
+#include "rabbit/mesh.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+// Slack added around the triangle bounds, relative to the largest coordinate of the mesh
+const double kBoundsPadding = 1e-9;
+
+// VertexKey all attributes of a loaded vertex, vertices with equal keys are merged
+struct VertexKey {
+    double e[8];
+
+    bool operator==(const VertexKey& other) const {
+        for (int i = 0; i < 8; i++) {
+            if (e[i] != other.e[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey& key) const {
+        size_t seed = 0;
+        for (int i = 0; i < 8; i++) {
+            seed ^= std::hash<double>()(key.e[i]) + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+        }
+        return seed;
+    }
+};
+
+// WatertightRay a ray prepared for the watertight triangle test
+// The vertices are translated to the ray origin, the axes permuted so that the largest direction component becomes
+// z, and sheared so that the ray runs along +z. The test then reduces to 2D edge functions at the origin.
+class WatertightRay {
+public:
+    explicit WatertightRay(const Ray& r) : origin(r.GetEndpoint()) {
+        const Vec3& dir = r.GetDirection();
+        kz = 0;
+        if (std::fabs(dir[1]) > std::fabs(dir[kz])) {
+            kz = 1;
+        }
+        if (std::fabs(dir[2]) > std::fabs(dir[kz])) {
+            kz = 2;
+        }
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // swapping x and y for a negative z keeps the winding of the triangles
+        if (dir[kz] < 0) {
+            std::swap(kx, ky);
+        }
+        sx = dir[kx] / dir[kz];
+        sy = dir[ky] / dir[kz];
+        sz = 1.0 / dir[kz];
+    }
+
+    Point3 origin;
+    int kx;
+    int ky;
+    int kz;
+    double sx;
+    double sy;
+    double sz;
+};
+
+// IntersectTriangle watertight ray-triangle test within [tmin, tmax]
+// b1 and b2 receive the barycentric coordinates of p1 and p2 at the hit
+inline bool IntersectTriangle(const WatertightRay& ray, const Point3& p0, const Point3& p1, const Point3& p2,
+                              double tmin, double tmax, double& t, double& b1, double& b2) {
+    Vec3 a = p0 - ray.origin;
+    Vec3 b = p1 - ray.origin;
+    Vec3 c = p2 - ray.origin;
+    double ax = a[ray.kx] - ray.sx * a[ray.kz];
+    double ay = a[ray.ky] - ray.sy * a[ray.kz];
+    double bx = b[ray.kx] - ray.sx * b[ray.kz];
+    double by = b[ray.ky] - ray.sy * b[ray.kz];
+    double cx = c[ray.kx] - ray.sx * c[ray.kz];
+    double cy = c[ray.ky] - ray.sy * c[ray.kz];
+
+    // scaled barycentric coordinates, a hit has no two of them with opposite signs
+    double u = cx * by - cy * bx;
+    double v = ax * cy - ay * cx;
+    double w = bx * ay - by * ax;
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) {
+        return false;
+    }
+    double det = u + v + w;
+    if (det == 0) {
+        return false;
+    }
+
+    // the scaled hit distance is compared to the interval before the division
+    double scaled_t = u * ray.sz * a[ray.kz] + v * ray.sz * b[ray.kz] + w * ray.sz * c[ray.kz];
+    if (det > 0 ? (scaled_t < tmin * det || scaled_t > tmax * det)
+                : (scaled_t > tmin * det || scaled_t < tmax * det)) {
+        return false;
+    }
+    double inv_det = 1.0 / det;
+    t = scaled_t * inv_det;
+    b1 = v * inv_det;
+    b2 = w * inv_det;
+    return true;
+}
+
+} // namespace
+
+MeshBuffers::MeshBuffers(const gassets::MeshData& mesh_data) {
+    // attributes the file does not provide are loaded as zeros
+    bool has_normals = false;
+    bool has_uvs = false;
+    for (const gassets::MeshVertex& vertex : mesh_data.vertices) {
+        has_normals = has_normals || vertex.vertex_normal.LengthSquared() > 0;
+        has_uvs = has_uvs || vertex.texture_coordinate[0] != 0 || vertex.texture_coordinate[1] != 0;
+    }
+
+    // the loader repeats every vertex for each triangle that uses it
+    std::unordered_map<VertexKey, uint32_t, VertexKeyHash> vertex_indices;
+    size_t vertex_count = mesh_data.GetVertexNum() / 3 * 3;
+    indices.reserve(vertex_count);
+    for (size_t i = 0; i < vertex_count; i++) {
+        const gassets::MeshVertex& vertex = mesh_data.vertices[i];
+        const Point3& p = vertex.coordinate;
+        Vec3 n = has_normals ? vertex.vertex_normal : Vec3(0, 0, 0);
+        double u = has_uvs ? vertex.texture_coordinate[0] : 0;
+        double v = has_uvs ? vertex.texture_coordinate[1] : 0;
+        VertexKey key{{p.X(), p.Y(), p.Z(), n.X(), n.Y(), n.Z(), u, v}};
+
+        auto inserted = vertex_indices.emplace(key, static_cast<uint32_t>(positions.size()));
+        if (inserted.second) {
+            positions.push_back(p);
+            if (has_normals) {
+                normals.push_back(n.LengthSquared() > 0 ? UnitVec(n) : n);
+            }
+            if (has_uvs) {
+                uvs.push_back(u);
+                uvs.push_back(v);
+            }
+        }
+        indices.push_back(inserted.first->second);
+    }
+}
+
+TriangleMesh::TriangleMesh(std::shared_ptr<const MeshBuffers> buffers, uint32_t material_id,
+                           const BVHBuildOptions& options)
+    : _buffers(std::move(buffers)), _material_id(material_id) {
+    const std::vector<Point3>& positions = _buffers->positions;
+    const std::vector<uint32_t>& indices = _buffers->indices;
+    size_t triangle_count = _buffers->TriangleCount();
+
+    std::vector<AxisAlignedBoundingBox> prim_bounds;
+    prim_bounds.reserve(triangle_count);
+    _bbox = AxisAlignedBoundingBox::empty;
+    for (size_t i = 0; i < triangle_count; i++) {
+        const Point3& p0 = positions[indices[3*i]];
+        const Point3& p1 = positions[indices[3*i + 1]];
+        const Point3& p2 = positions[indices[3*i + 2]];
+        prim_bounds.push_back(AxisAlignedBoundingBox(AxisAlignedBoundingBox(p0, p1), AxisAlignedBoundingBox(p2, p2)));
+        _bbox = AxisAlignedBoundingBox(_bbox, prim_bounds.back());
+    }
+
+    // Vertices loaded from single precision files lie exactly on the float planes of the node boxes, where the
+    // rounding of the slab test can cull a ray that the watertight test would hit, so the boxes get some slack
+    double scale = 0;
+    for (int axis = 0; axis < 3 && triangle_count > 0; axis++) {
+        const Interval& interval = _bbox.GetAxisInterval(axis);
+        scale = std::fmax(scale, std::fmax(std::fabs(interval.GetMin()), std::fabs(interval.GetMax())));
+    }
+    double padding = kBoundsPadding * scale;
+    for (AxisAlignedBoundingBox& bounds : prim_bounds) {
+        bounds = AxisAlignedBoundingBox(bounds.x.Expand(padding), bounds.y.Expand(padding), bounds.z.Expand(padding));
+    }
+    _bbox = AxisAlignedBoundingBox(_bbox.x.Expand(padding), _bbox.y.Expand(padding), _bbox.z.Expand(padding));
+
+    std::vector<uint32_t> prim_order;
+    _build_stats = BuildLinearBVH(prim_bounds, options, _nodes, prim_order);
+
+    // the triangles of a leaf are next to each other, no indirection through prim_order while tracing
+    _indices.reserve(3 * prim_order.size());
+    for (uint32_t idx : prim_order) {
+        _indices.insert(_indices.end(), indices.begin() + 3*idx, indices.begin() + 3*idx + 3);
+    }
+}
+
+TriangleMesh::TriangleMesh(const gassets::MeshData& mesh_data, uint32_t material_id, const BVHBuildOptions& options)
+    : TriangleMesh(std::make_shared<const MeshBuffers>(mesh_data), material_id, options) {}
+
+bool TriangleMesh::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    WatertightRay ray(r);
+    const std::vector<Point3>& positions = _buffers->positions;
+    bool is_hit = false;
+    double tmin = ray_time_interval.GetMin();
+    TraverseLinearBVH(_nodes, r, tmin, ray_time_interval.GetMax(), [&](uint32_t first, uint32_t count, double& closest) {
+        for (uint32_t i = first; i < first + count; i++) {
+            const uint32_t* tri = &_indices[3*i];
+            double t, b1, b2;
+            if (IntersectTriangle(ray, positions[tri[0]], positions[tri[1]], positions[tri[2]], tmin, closest,
+                                  t, b1, b2)) {
+                info.SetHit(t, this, b1, b2, i);
+                closest = t;
+                is_hit = true;
+            }
+        }
+    });
+    return is_hit;
+}
+
+void TriangleMesh::ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const {
+    const uint32_t* tri = &_indices[3*info.element];
+    double b0 = 1 - info.b0 - info.b1;
+    double b1 = info.b0;
+    double b2 = info.b1;
+
+    const std::vector<Point3>& positions = _buffers->positions;
+    const Point3& p0 = positions[tri[0]];
+    const Point3& p1 = positions[tri[1]];
+    const Point3& p2 = positions[tri[2]];
+    record.t = info.t;
+    // interpolating the vertices keeps the hit point on the triangle plane
+    record.hitpoint = b0*p0 + b1*p1 + b2*p2;
+    record.material_id = _material_id;
+    record.SetFaceNormal(r, UnitVec(Vec3Cross(p1 - p0, p2 - p0)));
+
+    const std::vector<Vec3>& normals = _buffers->normals;
+    if (!normals.empty()) {
+        Vec3 n = b0*normals[tri[0]] + b1*normals[tri[1]] + b2*normals[tri[2]];
+        if (n.LengthSquared() > 0) {
+            // the shading normal stays on the side of the geometric one that faces the ray
+            n = UnitVec(n);
+            record.normal = Vec3Dot(n, record.normal) < 0 ? -n : n;
+        }
+    }
+
+    const std::vector<double>& uvs = _buffers->uvs;
+    if (!uvs.empty()) {
+        record.u = b0*uvs[2*tri[0]] + b1*uvs[2*tri[1]] + b2*uvs[2*tri[2]];
+        record.v = b0*uvs[2*tri[0] + 1] + b1*uvs[2*tri[1] + 1] + b2*uvs[2*tri[2] + 1];
+    } else {
+        record.u = b1;
+        record.v = b2;
+    }
+}
+
+bool TriangleMesh::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    if (_nodes.empty()) {
+        return false;
+    }
+
+    WatertightRay ray(r);
+    const std::vector<Point3>& positions = _buffers->positions;
+    double tmin = ray_time_interval.GetMin();
+    double tmax = ray_time_interval.GetMax();
+    return OccludedLinearBVH(_nodes, r, tmin, tmax, [&](uint32_t first, uint32_t count) {
+        for (uint32_t i = first; i < first + count; i++) {
+            const uint32_t* tri = &_indices[3*i];
+            double t, b1, b2;
+            if (IntersectTriangle(ray, positions[tri[0]], positions[tri[1]], positions[tri[2]], tmin, tmax,
+                                  t, b1, b2)) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+AxisAlignedBoundingBox TriangleMesh::GetBoundingBox() const {
+    return _bbox;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
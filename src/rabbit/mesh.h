@@ -0,0 +1,86 @@
+#ifndef GPLAY_RABBIT_MESH_H
+#define GPLAY_RABBIT_MESH_H
+/*
+Class TriangleMesh - An indexed triangle mesh with its own BVH over the triangles
+reference: https://jcgt.org/published/0002/01/05/ (Woop, Benthin, Wald, Watertight Ray/Triangle Intersection)
+           https://pbr-book.org/3ed-2018/Shapes/Triangle_Meshes
+Every vertex is stored once in buffers shared by the triangles that use it. The mesh builds a LinearBVH over its
+triangles and enters the scene as a single object, so it can be instanced like any other bottom-level BVH.
+Triangles are tested with the watertight algorithm: edges shared by two triangles are never missed by both of them.
+Emissive meshes are not sampled as lights, they are only reached by scattered rays.
+*/
+
+#include <memory>
+#include <vector>
+#include "gassets/meshdata.h"
+#include "rabbit/bvh.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+// MeshBuffers the indexed vertex data of a triangle mesh
+class MeshBuffers {
+public:
+    MeshBuffers() = default;
+
+    // MeshBuffers takes the triangles of mesh_data, three consecutive vertices each, and merges identical vertices
+    explicit MeshBuffers(const gassets::MeshData& mesh_data);
+
+    inline size_t TriangleCount() const {
+        return indices.size() / 3;
+    }
+
+public:
+    std::vector<Point3> positions;
+    // Unit vertex normals for smooth shading, empty for flat triangles
+    std::vector<Vec3> normals;
+    // Texture coordinates u, v of every vertex, empty to use the barycentric coordinates of the hit instead
+    std::vector<double> uvs;
+    // Three vertex indices per triangle, the geometric normal faces the side from which they run counter-clockwise
+    std::vector<uint32_t> indices;
+};
+
+class TriangleMesh : public Hittable {
+public:
+    // TriangleMesh one material for all triangles of buffers, meshes made from the same buffers share them
+    TriangleMesh(std::shared_ptr<const MeshBuffers> buffers, uint32_t material_id,
+                 const BVHBuildOptions& options = BVHBuildOptions());
+
+    TriangleMesh(const gassets::MeshData& mesh_data, uint32_t material_id,
+                 const BVHBuildOptions& options = BVHBuildOptions());
+
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
+
+    // ComputeHitRecord interpolates the vertex normals and texture coordinates at the hit
+    void ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const override;
+
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
+
+    // GetBoundingBox ...
+    AxisAlignedBoundingBox GetBoundingBox() const override;
+
+    inline size_t TriangleCount() const {
+        return _indices.size() / 3;
+    }
+
+    // GetBuildStats returns build time and expected traversal cost of the triangle BVH
+    inline const BVHBuildStats& GetBuildStats() const {
+        return _build_stats;
+    }
+
+private:
+    std::shared_ptr<const MeshBuffers> _buffers;
+    // Vertex indices of the triangles in leaf order, three per triangle
+    std::vector<uint32_t> _indices;
+    std::vector<BVHLinearNode> _nodes;
+    BVHBuildStats _build_stats;
+    uint32_t _material_id;
+    AxisAlignedBoundingBox _bbox;
+};
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_MESH_H
@@ -4,13 +4,16 @@ namespace gplay {
 
 namespace rabbit {
 
-PerlinNoise::PerlinNoise() {
+PerlinNoise::PerlinNoise() : PerlinNoise(0) {}
+
+PerlinNoise::PerlinNoise(uint64_t seed) {
+    RandomStream rng(seed, 0);
     for (int i = 0; i < point_count; i++) {
-        _randvec[i] = UnitVec(RandomVec3(-1,1));
+        _randvec[i] = UnitVec(RandomVec3(rng,-1,1));
     }
-    GeneratePerm(_perm_x);
-    GeneratePerm(_perm_y);
-    GeneratePerm(_perm_z);
+    GeneratePerm(rng, _perm_x);
+    GeneratePerm(rng, _perm_y);
+    GeneratePerm(rng, _perm_z);
 }
 
 double PerlinNoise::NoiseValue(const Point3& p) const {
@@ -54,11 +57,11 @@ double PerlinNoise::NoiseTurbulence(const Point3& p, int depth) const {
     return std::fabs(accum);
 }
 
-void PerlinNoise::GeneratePerm(int perm[]) {
+void PerlinNoise::GeneratePerm(RandomStream& rng, int perm[]) {
     for (int i = 0; i < point_count; i++) {
         perm[i] = i;
     }
-    RandomPermuteArray(perm, point_count);
+    RandomPermuteArray(rng, perm, point_count);
 }
 
 } // namespace rabbit
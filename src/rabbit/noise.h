@@ -24,12 +24,15 @@ class PerlinNoise : public Noise {
 public:
     PerlinNoise();
 
+    // PerlinNoise make the noise lattice drawn from the given random seed
+    PerlinNoise(uint64_t seed);
+
     double NoiseValue(const Point3& p) const override;
 
     double NoiseTurbulence(const Point3& p, int depth) const override;
 
 private:
-    static void GeneratePerm(int perm[]);
+    static void GeneratePerm(RandomStream& rng, int perm[]);
 
 public:
     static const int point_count = 256;
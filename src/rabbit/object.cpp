@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <iostream>
+
 #include "rabbit/object.h"
 #include "rabbit/material.h"
 
@@ -5,25 +8,37 @@ namespace gplay {
 
 namespace rabbit {
 
-Sphere::Sphere(const Point3& center, double radius, std::shared_ptr<Material> material)
+namespace {
+
+// LocalToWorld maps a direction given in the orthonormal basis around unit vector w to world space
+Vec3 LocalToWorld(const Vec3& w, double x, double y, double z) {
+    Vec3 a = std::fabs(w.X()) > 0.9 ? Vec3(0,1,0) : Vec3(1,0,0);
+    Vec3 v = UnitVec(Vec3Cross(w, a));
+    Vec3 u = Vec3Cross(w, v);
+    return x*u + y*v + z*w;
+}
+
+} // namespace
+
+Sphere::Sphere(const Point3& center, double radius, uint32_t material_id)
     : _center(center, Vec3(0,0,0)),
       _radius(std::fmax(0,radius)),
-      _material(material) {
+      _material_id(material_id) {
     Point3 corner_offset = Point3(_radius, _radius, _radius);
     _bbox = AxisAlignedBoundingBox(center-corner_offset, center+corner_offset);
 }
 
-Sphere::Sphere(const Point3& center1, const Point3& center2, double radius, std::shared_ptr<Material> material)
+Sphere::Sphere(const Point3& center1, const Point3& center2, double radius, uint32_t material_id)
     : _center(center1, center2-center1),
       _radius(std::fmax(0,radius)),
-      _material(material) {
+      _material_id(material_id) {
     Point3 corner_offset = Point3(_radius, _radius, _radius);
     AxisAlignedBoundingBox bbox1(_center.AtPos(0)-corner_offset, _center.AtPos(0)+corner_offset);
     AxisAlignedBoundingBox bbox2(_center.AtPos(1)-corner_offset, _center.AtPos(1)+corner_offset);
     _bbox = AxisAlignedBoundingBox(bbox1, bbox2);
 }
 
-bool Sphere::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
+bool Sphere::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
     // -- Ray-Sphere Intersection --
     // t^2 \mathbf{d} \cdot \mathbf{d}
     //   - 2t \mathbf{d} \cdot (\mathbf{C} - \mathbf{O})
@@ -53,20 +68,81 @@ bool Sphere::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) co
         }
     }
 
-    record.t = root;
-    record.hitpoint = r.AtPos(root);
-    record.material = _material;
+    info.SetHit(root, this);
+    return true;
+}
+
+void Sphere::ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const {
+    Point3 curr_center = _center.AtPos(r.GetTime());
+    record.t = info.t;
+    record.hitpoint = r.AtPos(info.t);
+    record.material_id = _material_id;
     Vec3 outward_normal = (record.hitpoint - curr_center) / _radius;
     record.SetFaceNormal(r, outward_normal);
     GetSphereUV(outward_normal, record.u, record.v);
+}
 
-    return true;
+bool Sphere::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    // same roots as Hit, without the hit point, normal and texture coordinates
+    Vec3 oc = _center.AtPos(r.GetTime()) - r.GetEndpoint();
+    double h = Vec3Dot(r.GetDirection(), oc);
+    double c = oc.LengthSquared() - _radius*_radius;
+    double a = r.GetDirection().LengthSquared();
+
+    double discriminant = h*h - a*c;
+    if (discriminant < 0) {
+        return false;
+    }
+
+    double sqrtd = std::sqrt(discriminant);
+    return ray_time_interval.Surrounds((h-sqrtd) / a) || ray_time_interval.Surrounds((h+sqrtd) / a);
 }
 
 AxisAlignedBoundingBox Sphere::GetBoundingBox() const {
     return _bbox;
 }
 
+PrimitiveType Sphere::GetPrimitiveType() const {
+    return PrimitiveType::kSphere;
+}
+
+void Sphere::CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {
+    if (materials[_material_id].IsEmissive()) {
+        lights.push_back(this);
+    }
+}
+
+Vec3 Sphere::SampleDirection(const Point3& origin, double time, const Sample2D& u) const {
+    Vec3 direction = _center.AtPos(time) - origin;
+    double distance_squared = direction.LengthSquared();
+    // from inside, every direction hits the sphere
+    if (distance_squared <= _radius*_radius) {
+        return SampleUnitVec3(u);
+    }
+
+    // uniform direction in the cone of half angle theta_max, sin(theta_max) = radius / distance
+    double cos_theta_max = std::sqrt(1 - _radius*_radius/distance_squared);
+    double z = 1 + u.x * (cos_theta_max - 1);
+    double phi = 2 * kPI * u.y;
+    double sin_theta = std::sqrt(std::fmax(0.0, 1 - z*z));
+    return LocalToWorld(direction / std::sqrt(distance_squared), std::cos(phi)*sin_theta, std::sin(phi)*sin_theta, z);
+}
+
+double Sphere::DirectionPdf(const Point3& origin, const Vec3& direction, double time) const {
+    Vec3 to_center = _center.AtPos(time) - origin;
+    double distance_squared = to_center.LengthSquared();
+    if (distance_squared <= _radius*_radius) {
+        return 1 / (4 * kPI);
+    }
+
+    double cos_theta_max = std::sqrt(1 - _radius*_radius/distance_squared);
+    double cos_theta = Vec3Dot(UnitVec(direction), to_center) / std::sqrt(distance_squared);
+    if (cos_theta < cos_theta_max) {
+        return 0;
+    }
+    return 1 / (2 * kPI * (1 - cos_theta_max));
+}
+
 void Sphere::GetSphereUV(const Point3& p, double& u, double& v) {
     // p: a given point on the sphere of radius one, centered at the origin
     // u: returned value [0,1] of angle around the Y axis from X=-1 (\phi \rightarrow u)
@@ -84,14 +160,15 @@ void Sphere::GetSphereUV(const Point3& p, double& u, double& v) {
     v = theta / kPI;
 }
 
-Quadrilateral::Quadrilateral(const Point3& q, const Vec3& u, const Vec3& v, std::shared_ptr<Material> material)
-    : _q(q), _u(u), _v(v), _material(material) {
+Quadrilateral::Quadrilateral(const Point3& q, const Vec3& u, const Vec3& v, uint32_t material_id)
+    : _q(q), _u(u), _v(v), _material_id(material_id) {
     // Plane normal
     Vec3 n = Vec3Cross(_u, _v);
     _normal = UnitVec(n);
 
     _d = Vec3Dot(_normal, _q);
     _w = n / Vec3Dot(n,n);
+    _area = n.Length();
 
     // Compute the bounding box of all four vertices,
     // and combine the resulting two AABBs
@@ -101,7 +178,7 @@ Quadrilateral::Quadrilateral(const Point3& q, const Vec3& u, const Vec3& v, std:
     _bbox = AxisAlignedBoundingBox(bbox1, bbox2);
 }
 
-bool Quadrilateral::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
+bool Quadrilateral::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
     // -- Ray-Quadrilateral Intersection --
     //   1. finding the plane that contains that quad
     //   2. solving for the intersection of a ray and the quad-containing plane
@@ -119,237 +196,390 @@ bool Quadrilateral::Hit(const Ray& r, Interval ray_time_interval, HitRecord& rec
     //      \beta  = \mathbf{w} \cdot (\mathbf{u} \times \mathbf{p})
     //  where \mathbf{p} = \mathbf{P}' - \mathbf{Q}
 
+    double t, alpha, beta;
+    if (!PlaneHit(r, ray_time_interval, t, alpha, beta)) {
+        return false;
+    }
+
+    info.SetHit(t, this, alpha, beta);
+    return true;
+}
+
+bool Quadrilateral::PlaneHit(const Ray& r, Interval ray_time_interval, double& t, double& alpha, double& beta) const {
     // No hit if the ray is parallel to the plane
     double denom = Vec3Dot(_normal, r.GetDirection());
     if (std::fabs(denom) < 1e-8) {
         return false;
     }
 
-    double t = (_d - Vec3Dot(_normal, r.GetEndpoint())) / denom;
+    t = (_d - Vec3Dot(_normal, r.GetEndpoint())) / denom;
     if (!ray_time_interval.Contains(t)) {
         return false;
     }
 
-    Point3 intersection = r.AtPos(t);
-    Vec3 q_to_intersection = intersection - _q;
-    double alpha = Vec3Dot(_w, Vec3Cross(q_to_intersection, _v));
-    double beta = Vec3Dot(_w, Vec3Cross(_u, q_to_intersection));
-    if (!IsInterior(alpha, beta, record)) {
-        return false;
-    }
+    Vec3 q_to_intersection = r.AtPos(t) - _q;
+    alpha = Vec3Dot(_w, Vec3Cross(q_to_intersection, _v));
+    beta = Vec3Dot(_w, Vec3Cross(_u, q_to_intersection));
+    return IsInterior(alpha, beta);
+}
 
-    record.t = t;
-    record.hitpoint = intersection;
-    record.material = _material;
+void Quadrilateral::ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const {
+    record.t = info.t;
+    record.hitpoint = r.AtPos(info.t);
+    record.u = info.b0;
+    record.v = info.b1;
+    record.material_id = _material_id;
     record.SetFaceNormal(r, _normal);
-    return true;
+}
+
+bool Quadrilateral::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    double t, alpha, beta;
+    return PlaneHit(r, ray_time_interval, t, alpha, beta);
 }
 
 AxisAlignedBoundingBox Quadrilateral::GetBoundingBox() const {
     return _bbox;
 }
 
-bool Quadrilateral::IsInterior(double alpha, double beta, HitRecord& record) const {
-    // -- Interior Testing of The Intersection Using Planar Coordinates --
-    //  1. 0 <= alpha <= 1
-    //  2. 0 <= beta <= 1
+PrimitiveType Quadrilateral::GetPrimitiveType() const {
+    return PrimitiveType::kQuadrilateral;
+}
 
-    Interval unit_interval = Interval(0, 1);
-    if (!unit_interval.Contains(alpha) || !unit_interval.Contains(beta)) {
-        return false;
+void Quadrilateral::CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {
+    if (materials[_material_id].IsEmissive()) {
+        lights.push_back(this);
     }
-    record.u = alpha;
-    record.v = beta;
-
-    return true;
 }
 
-Box::Box(const Point3& a, const Point3& b, std::shared_ptr<Material> material)
-    : _material(material),
-      _boundary(std::make_shared<HittableList>()) {
-    Point3 minp = Point3(std::fmin(a.X(), b.X()), std::fmin(a.Y(), b.Y()), std::fmin(a.Z(), b.Z()));
-    Point3 maxp = Point3(std::fmax(a.X(), b.X()), std::fmax(a.Y(), b.Y()), std::fmax(a.Z(), b.Z()));
+Vec3 Quadrilateral::SampleDirection(const Point3& origin, double time, const Sample2D& u) const {
+    // NOTE: samples the whole parallelogram, shapes that override IsInterior need their own sampling
+    Point3 p = _q + u.x*_u + u.y*_v;
+    return p - origin;
+}
 
-    Vec3 dx = Vec3(maxp.X()-minp.X(), 0, 0);
-    Vec3 dy = Vec3(0, maxp.Y()-minp.Y(), 0);
-    Vec3 dz = Vec3(0, 0, maxp.Z()-minp.Z());
+double Quadrilateral::DirectionPdf(const Point3& origin, const Vec3& direction, double time) const {
+    double t, alpha, beta;
+    if (!PlaneHit(Ray(origin, direction, time), Interval(0.001, kInfinity), t, alpha, beta)) {
+        return 0;
+    }
 
-    _boundary->AddObject(std::make_shared<Quadrilateral>(Point3(minp.X(), minp.Y(), maxp.Z()),  dx,  dy, _material)); // front
-    _boundary->AddObject(std::make_shared<Quadrilateral>(Point3(maxp.X(), minp.Y(), maxp.Z()), -dz,  dy, _material)); // right
-    _boundary->AddObject(std::make_shared<Quadrilateral>(Point3(maxp.X(), minp.Y(), minp.Z()), -dx,  dy, _material)); // back
-    _boundary->AddObject(std::make_shared<Quadrilateral>(Point3(minp.X(), minp.Y(), minp.Z()),  dz,  dy, _material)); // left
-    _boundary->AddObject(std::make_shared<Quadrilateral>(Point3(minp.X(), maxp.Y(), maxp.Z()),  dx, -dz, _material)); // top
-    _boundary->AddObject(std::make_shared<Quadrilateral>(Point3(minp.X(), minp.Y(), minp.Z()),  dx,  dz, _material)); // bottom
+    // convert the uniform area density 1/A to solid angle: distance^2 / (cos * A)
+    double distance_squared = t * t * direction.LengthSquared();
+    double cosine = std::fabs(Vec3Dot(direction, _normal)) / direction.Length();
+    return distance_squared / (cosine * _area);
 }
 
-bool Box::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
-    return _boundary->Hit(r, ray_time_interval, record);
-}
+bool Quadrilateral::IsInterior(double alpha, double beta) const {
+    // -- Interior Testing of The Intersection Using Planar Coordinates --
+    //  1. 0 <= alpha <= 1
+    //  2. 0 <= beta <= 1
+    // the planar coordinates double as the texture coordinates of the hit
 
-AxisAlignedBoundingBox Box::GetBoundingBox() const {
-    return _boundary->GetBoundingBox();
+    Interval unit_interval = Interval(0, 1);
+    return unit_interval.Contains(alpha) && unit_interval.Contains(beta);
 }
 
-ObjectTranslated::ObjectTranslated(std::shared_ptr<Hittable> object, const Vec3& offset)
-    : _object(object),
-      _offset(offset){
-    // Remember to offset the bounding box,
-    // otherwise the incident ray might be looking in the wrong place and trivially reject the intersection
-    _bbox = _object->GetBoundingBox() + _offset;
+Box::Box(const Point3& a, const Point3& b, uint32_t material_id)
+    : _min(std::fmin(a.X(), b.X()), std::fmin(a.Y(), b.Y()), std::fmin(a.Z(), b.Z())),
+      _max(std::fmax(a.X(), b.X()), std::fmax(a.Y(), b.Y()), std::fmax(a.Z(), b.Z())),
+      _material_id(material_id),
+      _bbox(_min, _max) {}
+
+bool Box::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
+    double t_enter, t_exit;
+    int enter_face, exit_face;
+    if (!SlabHit(r, t_enter, t_exit, enter_face, exit_face)) {
+        return false;
+    }
+
+    // a ray that starts inside the box hits the face where it leaves
+    if (ray_time_interval.Contains(t_enter)) {
+        info.SetHit(t_enter, this, 0, 0, enter_face);
+        return true;
+    }
+    if (ray_time_interval.Contains(t_exit)) {
+        info.SetHit(t_exit, this, 0, 0, exit_face);
+        return true;
+    }
+    return false;
 }
 
-bool ObjectTranslated::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
-    // We don’t actually need to move objects in the scene;
-    // Instead we move the rays in the opposite direction
+void Box::ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const {
+    int face = static_cast<int>(info.element);
+    int axis = face / 2;
+    bool is_max_side = face % 2 != 0;
+
+    record.t = info.t;
+    record.hitpoint = r.AtPos(info.t);
+    // rounding may move the hit point off the face plane, put it back
+    record.hitpoint[axis] = is_max_side ? _max[axis] : _min[axis];
+    record.material_id = _material_id;
+    Vec3 outward_normal(0, 0, 0);
+    outward_normal[axis] = is_max_side ? 1 : -1;
+    record.SetFaceNormal(r, outward_normal);
 
-    // Move the ray backwards by the offset
-    Ray offset_r(r.GetEndpoint() - _offset, r.GetDirection(), r.GetTime());
+    // position of the hit relative to the box, in [0,1] along every axis
+    double p[3];
+    for (int i = 0; i < 3; i++) {
+        double size = _max[i] - _min[i];
+        p[i] = size > 0 ? (record.hitpoint[i] - _min[i]) / size : 0;
+    }
+    // texture coordinates run along the sides u and v of the quadrilaterals the faces used to be made of
+    switch (face) {
+    case 0: // left
+        record.u = p[2];
+        record.v = p[1];
+        break;
+    case 1: // right
+        record.u = 1 - p[2];
+        record.v = p[1];
+        break;
+    case 2: // bottom
+        record.u = p[0];
+        record.v = p[2];
+        break;
+    case 3: // top
+        record.u = p[0];
+        record.v = 1 - p[2];
+        break;
+    case 4: // back
+        record.u = 1 - p[0];
+        record.v = p[1];
+        break;
+    default: // front
+        record.u = p[0];
+        record.v = p[1];
+        break;
+    }
+}
 
-    // Determine whether an intersection exists along the offset ray (and if so, where)
-    if (!_object->Hit(offset_r, ray_time_interval, record)) {
+bool Box::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    double t_enter, t_exit;
+    int enter_face, exit_face;
+    if (!SlabHit(r, t_enter, t_exit, enter_face, exit_face)) {
         return false;
     }
+    return ray_time_interval.Contains(t_enter) || ray_time_interval.Contains(t_exit);
+}
 
-    // Move the intersection point forwards by the offset
-    record.hitpoint += _offset;
-
-    return true;
+void Box::CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {
+    if (materials[_material_id].IsEmissive()) {
+        lights.push_back(this);
+    }
 }
 
-AxisAlignedBoundingBox ObjectTranslated::GetBoundingBox() const {
+AxisAlignedBoundingBox Box::GetBoundingBox() const {
     return _bbox;
 }
 
-ObjectYRotated::ObjectYRotated(std::shared_ptr<Hittable> object, double angle)
-    : _object(object) {
-    auto radians = DegreesToRadians(angle);
-    _sin_theta = std::sin(radians);
-    _cos_theta = std::cos(radians);
-    _bbox = _object->GetBoundingBox();
+Vec3 Box::SampleDirection(const Point3& origin, double time, const Sample2D& u) const {
+    int face = std::min(static_cast<int>(u.x * 6), 5);
+    int axis = face / 2;
+    int axis_u = (axis + 1) % 3;
+    int axis_v = (axis + 2) % 3;
+    // the rest of u.x after picking the face is again uniform in [0,1)
+    double face_u = u.x * 6 - face;
+
+    Point3 p;
+    p[axis] = face % 2 != 0 ? _max[axis] : _min[axis];
+    p[axis_u] = _min[axis_u] + face_u * (_max[axis_u] - _min[axis_u]);
+    p[axis_v] = _min[axis_v] + u.y * (_max[axis_v] - _min[axis_v]);
+    return p - origin;
+}
 
-    Point3 min( kInfinity,  kInfinity,  kInfinity);
-    Point3 max(-kInfinity, -kInfinity, -kInfinity);
+double Box::DirectionPdf(const Point3& origin, const Vec3& direction, double time) const {
+    double t[2];
+    int face[2];
+    if (!SlabHit(Ray(origin, direction, time), t[0], t[1], face[0], face[1])) {
+        return 0;
+    }
 
-    // rotate bounding box's 8 points
+    // every face the direction reaches could have been sampled, each picked with probability 1/6
+    // uniform area density 1/A converts to solid angle as distance^2 / (cos * A)
+    double length_squared = direction.LengthSquared();
+    double length = std::sqrt(length_squared);
+    double pdf = 0;
     for (int i = 0; i < 2; i++) {
-        for (int j = 0; j < 2; j++) {
-            for (int k = 0; k < 2; k++) {
-                auto x = i*_bbox.x.GetMax() + (1-i)*_bbox.x.GetMin();
-                auto y = j*_bbox.y.GetMax() + (1-j)*_bbox.y.GetMin();
-                auto z = k*_bbox.z.GetMax() + (1-k)*_bbox.z.GetMin();
-
-                auto newx =  _cos_theta*x + _sin_theta*z;
-                auto newz = -_sin_theta*x + _cos_theta*z;
-
-                Vec3 tester(newx, y, newz);
-                for (int c = 0; c < 3; c++) {
-                    min[c] = std::fmin(min[c], tester[c]);
-                    max[c] = std::fmax(max[c], tester[c]);
-                }
-            }
+        if (t[i] < 0.001) {
+            continue;
         }
+        int axis = face[i] / 2;
+        double distance_squared = t[i] * t[i] * length_squared;
+        double cosine = std::fabs(direction[axis]) / length;
+        pdf += distance_squared / (cosine * FaceArea(axis));
     }
+    return pdf / 6;
+}
 
-    // renew rotated bbox
-    _bbox = AxisAlignedBoundingBox(min, max);
+bool Box::LineHit(const Ray& r, double& t_enter, double& t_exit) const {
+    int enter_face, exit_face;
+    return SlabHit(r, t_enter, t_exit, enter_face, exit_face);
 }
 
-bool ObjectYRotated::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
-    // Transform the ray from world space to object space
-    // i.e. Move the ray backwards by the offset
+bool Box::SlabHit(const Ray& r, double& t_enter, double& t_exit, int& enter_face, int& exit_face) const {
+    // -- Ray-Box Intersection --
+    // the line is inside the slab min <= P + t d <= max of every axis for t in [t_0, t_1] of that axis,
+    // it enters the box at the largest t_0 and leaves it at the smallest t_1
+    const Point3& origin = r.GetEndpoint();
+    const Vec3& dir = r.GetDirection();
+    t_enter = -kInfinity;
+    t_exit = kInfinity;
+    enter_face = 0;
+    exit_face = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (dir[axis] == 0) {
+            // parallel to the slab, the line is either always or never inside it
+            if (origin[axis] < _min[axis] || origin[axis] > _max[axis]) {
+                return false;
+            }
+            continue;
+        }
+
+        // going in the negative direction the line enters through the maximum side
+        bool is_neg = r.IsDirectionNegative(axis);
+        double inv_dir = r.GetInvDirection()[axis];
+        double t0 = ((is_neg ? _max[axis] : _min[axis]) - origin[axis]) * inv_dir;
+        double t1 = ((is_neg ? _min[axis] : _max[axis]) - origin[axis]) * inv_dir;
+        int near_face = 2 * axis + is_neg;
+        int far_face = 2 * axis + !is_neg;
+        if (t0 > t_enter) {
+            t_enter = t0;
+            enter_face = near_face;
+        }
+        if (t1 < t_exit) {
+            t_exit = t1;
+            exit_face = far_face;
+        }
+    }
+    return t_enter <= t_exit;
+}
 
-    Point3 origin = Point3(
-        (_cos_theta * r.GetEndpoint().X()) + (-_sin_theta * r.GetEndpoint().Z()),
-        r.GetEndpoint().Y(),
-        (_sin_theta * r.GetEndpoint().X()) + (_cos_theta * r.GetEndpoint().Z())
-    );
+double Box::FaceArea(int axis) const {
+    Vec3 size = _max - _min;
+    return size[(axis + 1) % 3] * size[(axis + 2) % 3];
+}
 
-    Vec3 direction = Vec3(
-        (_cos_theta * r.GetDirection().X()) + (-_sin_theta * r.GetDirection().Z()),
-        r.GetDirection().Y(),
-        (_sin_theta * r.GetDirection().X()) + (_cos_theta * r.GetDirection().Z())
-    );
+Instance::Instance(std::shared_ptr<Hittable> object, const Transform& object_to_world)
+    : _object(object),
+      _object_to_world(object_to_world) {
+    // Collapse chains like translate(rotate(object)) into one transform, so that a hit only crosses one level
+    auto inner = std::dynamic_pointer_cast<Instance>(object);
+    if (inner) {
+        _object = inner->_object;
+        _object_to_world = inner->_object_to_world.Then(object_to_world);
+    }
+    _depth = _object->GetInstanceDepth() + 1;
+    if (_depth > HitInfo::kMaxInstanceDepth) {
+        std::cerr << "ERROR: Instances nested " << _depth << " levels deep, at most " << HitInfo::kMaxInstanceDepth
+                  << " are supported. The instance is left empty.\n";
+        _object = std::make_shared<HittableList>();
+        _depth = 0;
+        _bbox = AxisAlignedBoundingBox::empty;
+        return;
+    }
+    // Remember to transform the bounding box,
+    // otherwise the incident ray might be looking in the wrong place and trivially reject the intersection
+    _bbox = _object_to_world.ApplyBox(_object->GetBoundingBox());
+}
 
-    Ray rotated_r(origin, direction, r.GetTime());
+bool Instance::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
+    // We don’t actually move the object in the scene;
+    // Instead we move the ray into object space with the inverse transform.
+    // The direction is not renormalized, so the hit time is valid in both spaces
+    Ray object_r = _object_to_world.ApplyInverse(r);
 
     // Determine whether an intersection exists in object space (and if so, where)
-    // i.e. Determine whether an intersection exists along the offset ray (and if so, where)
-
-    if (!_object->Hit(rotated_r, ray_time_interval, record)) {
+    HitInfo object_info;
+    if (!_object->Intersect(object_r, ray_time_interval, object_info, rng)) {
         return false;
     }
-
-    // Transform the intersection from object space back to world space
-    // i.e. Move the intersection point forwards by the offset
-
-    record.hitpoint = Point3(
-        (_cos_theta * record.hitpoint.X()) + (_sin_theta * record.hitpoint.Z()),
-        record.hitpoint.Y(),
-        (-_sin_theta * record.hitpoint.X()) + (_cos_theta * record.hitpoint.Z())
-    );
-
-    record.normal = Vec3(
-        (_cos_theta * record.normal.X()) + (_sin_theta * record.normal.Z()),
-        record.normal.Y(),
-        (-_sin_theta * record.normal.X()) + (_cos_theta * record.normal.Z())
-    );
-
+    // Remember the transform, FinalizeHit brings the surface interaction back to world space
+    info = object_info;
+    info.instance_transforms[0] = &_object_to_world;
+    for (int i = 0; i < object_info.instance_count; i++) {
+        info.instance_transforms[i+1] = object_info.instance_transforms[i];
+    }
+    info.instance_count = object_info.instance_count + 1;
     return true;
 }
 
-AxisAlignedBoundingBox ObjectYRotated::GetBoundingBox() const {
+bool Instance::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    return _object->Occluded(_object_to_world.ApplyInverse(r), ray_time_interval, rng);
+}
+
+AxisAlignedBoundingBox Instance::GetBoundingBox() const {
     return _bbox;
 }
 
-ObjectWithConstDensityMedium::ObjectWithConstDensityMedium(std::shared_ptr<Hittable> boundary, double density, std::shared_ptr<Texture> texture)
-    : _neg_inv_density(-1/density),
-      _boundary(boundary),
-      _phase_function(std::make_shared<Isotropic>(texture)) {}
+int Instance::GetInstanceDepth() const {
+    return _depth;
+}
+
+ObjectTranslated::ObjectTranslated(std::shared_ptr<Hittable> object, const Vec3& offset)
+    : Instance(object, Transform::Translation(offset)) {}
 
-ObjectWithConstDensityMedium::ObjectWithConstDensityMedium(std::shared_ptr<Hittable> boundary, double density, const Color& albedo)
+ObjectYRotated::ObjectYRotated(std::shared_ptr<Hittable> object, double angle)
+    : Instance(object, Transform::RotationY(angle)) {}
+
+ObjectWithConstDensityMedium::ObjectWithConstDensityMedium(std::shared_ptr<Hittable> boundary, double density, uint32_t phase_function_id)
     : _neg_inv_density(-1/density),
       _boundary(boundary),
-      _phase_function(std::make_shared<Isotropic>(albedo)) {}
+      _box_boundary(dynamic_cast<const Box*>(boundary.get())),
+      _phase_function_id(phase_function_id) {}
 
-bool ObjectWithConstDensityMedium::Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const {
+bool ObjectWithConstDensityMedium::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
     // -- Ray-Volume Interaction --
     // we have to be careful about the logic around the boundary to make sure this works for ray origins inside the volume
     // we assume that once a ray exits the constant medium boundary, it will continue forever outside the boundary
 
-    HitRecord record1, record2;
-    if (!_boundary->Hit(r, Interval::universe, record1)) {
-        return false;
-    }
-    if (!_boundary->Hit(r, Interval(record1.GetHitTime()+0.0001, kInfinity), record2)) {
-        return false;
+    // only the boundary hit times are needed, no surface interaction is evaluated
+    double t1, t2;
+    if (_box_boundary) {
+        // one slab test gives both hits
+        if (!_box_boundary->LineHit(r, t1, t2) || t2 < t1 + 0.0001) {
+            return false;
+        }
+    } else {
+        HitInfo info1, info2;
+        if (!_boundary->Intersect(r, Interval::universe, info1, rng)) {
+            return false;
+        }
+        if (!_boundary->Intersect(r, Interval(info1.GetHitTime()+0.0001, kInfinity), info2, rng)) {
+            return false;
+        }
+        t1 = info1.GetHitTime();
+        t2 = info2.GetHitTime();
     }
 
-    if (record1.GetHitTime() < ray_time_interval.GetMin()) {
-        record1.t = ray_time_interval.GetMin();
+    if (t1 < ray_time_interval.GetMin()) {
+        t1 = ray_time_interval.GetMin();
     }
-    if (record2.GetHitTime() > ray_time_interval.GetMax()) {
-        record2.t = ray_time_interval.GetMax();
+    if (t2 > ray_time_interval.GetMax()) {
+        t2 = ray_time_interval.GetMax();
     }
-    if (record1.GetHitTime() >= record2.GetHitTime()) {
+    if (t1 >= t2) {
         return false;
     }
-    if (record1.GetHitTime() < 0) {
-        record1.t = 0;
+    if (t1 < 0) {
+        t1 = 0;
     }
 
-    double distance_inside_boundary = (record2.t - record1.t) * r.GetDirection().Length();
-    double hit_distance = _neg_inv_density * std::log(RandomDouble());
+    double distance_inside_boundary = (t2 - t1) * r.GetDirection().Length();
+    double hit_distance = _neg_inv_density * std::log(RandomDouble(rng));
     if (hit_distance > distance_inside_boundary) {
         return false;
     }
 
-    record.t = record1.GetHitTime() + hit_distance / r.GetDirection().Length();
+    info.SetHit(t1 + hit_distance / r.GetDirection().Length(), this);
+    return true;
+}
+
+void ObjectWithConstDensityMedium::ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const {
+    record.t = info.t;
     record.hitpoint = r.AtPos(record.t);
     record.normal = Vec3(1,0,0); // no need (because of isotropic), any one is ok
     record.SetFrontFace(); // also arbitrary
-    record.material = _phase_function;
-
-    return true;
+    record.material_id = _phase_function_id;
 }
 
 AxisAlignedBoundingBox ObjectWithConstDensityMedium::GetBoundingBox() const {
@@ -7,6 +7,7 @@ reference: https://github.com/RayTracing/raytracing.github.io/blob/release/src/T
 
 #include "rabbit/hittable.h"
 #include "rabbit/texture.h"
+#include "rabbit/transform.h"
 
 namespace gplay {
 
@@ -15,15 +16,37 @@ namespace rabbit {
 class Sphere : public Hittable {
 public:
     // Sphere make a stationary sphere
-    Sphere(const Point3& center, double radius, std::shared_ptr<Material> material);
+    Sphere(const Point3& center, double radius, uint32_t material_id);
 
     // Sphere make a moving sphere
-    Sphere(const Point3& center1, const Point3& center2, double radius, std::shared_ptr<Material> material);
+    Sphere(const Point3& center1, const Point3& center2, double radius, uint32_t material_id);
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
+
+    void ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const override;
+
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
 
     AxisAlignedBoundingBox GetBoundingBox() const override;
 
+    PrimitiveType GetPrimitiveType() const override;
+
+    void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const override;
+
+    // SampleDirection samples the cone of directions under which the sphere is seen from origin
+    Vec3 SampleDirection(const Point3& origin, double time, const Sample2D& u) const override;
+
+    double DirectionPdf(const Point3& origin, const Vec3& direction, double time) const override;
+
+    // GetCenterPath returns the center at time 0 and its motion per unit of time
+    inline const Ray& GetCenterPath() const {
+        return _center;
+    }
+
+    inline double GetRadius() const {
+        return _radius;
+    }
+
 private:
     // GetSphereUV takes points on the unit sphere centered at the origin, and computes u and v
     // this function map theta and phi to texture coordinates u and v in [0,1], i.e. Texture mapping for Spheres
@@ -34,21 +57,53 @@ private:
     Ray _center;
     // Sphere radius
     double _radius;
-    std::shared_ptr<Material> _material;
+    uint32_t _material_id;
     AxisAlignedBoundingBox _bbox;
 };
 
 class Quadrilateral : public Hittable {
 public:
-    Quadrilateral(const Point3& q, const Vec3& u, const Vec3& v, std::shared_ptr<Material> material);
+    Quadrilateral(const Point3& q, const Vec3& u, const Vec3& v, uint32_t material_id);
+
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    void ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const override;
+
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
 
     AxisAlignedBoundingBox GetBoundingBox() const override;
 
+    // GetPrimitiveType derived shapes inherit kQuadrilateral, but BVH leaves only store exact Quadrilaterals in blocks
+    PrimitiveType GetPrimitiveType() const override;
+
+    void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const override;
+
+    // SampleDirection points at a uniformly distributed point of the quadrilateral
+    Vec3 SampleDirection(const Point3& origin, double time, const Sample2D& u) const override;
+
+    double DirectionPdf(const Point3& origin, const Vec3& direction, double time) const override;
+
+    inline const Point3& GetCorner() const { return _q; }
+
+    inline const Vec3& GetSideU() const { return _u; }
+
+    inline const Vec3& GetSideV() const { return _v; }
+
+    // GetPlaneBasis returns \frac{\mathbf{n}}{\mathbf{n} \cdot \mathbf{n}} of the planar coordinates
+    inline const Vec3& GetPlaneBasis() const { return _w; }
+
+    inline const Vec3& GetNormal() const { return _normal; }
+
+    // GetPlaneDistance returns D of the plane equation \mathbf{n} \cdot \mathbf{P} = D
+    inline double GetPlaneDistance() const { return _d; }
+
 public:
-    // IsInterior determine if the ray-plane intersection point is inside the quadrilateral
-    virtual bool IsInterior(double alpha, double beta, HitRecord& record) const;
+    // IsInterior determine if the ray-plane intersection point with planar coordinates alpha, beta is inside the quadrilateral
+    virtual bool IsInterior(double alpha, double beta) const;
+
+private:
+    // PlaneHit intersects the ray with the plane of the quadrilateral and returns the planar coordinates of the hit
+    bool PlaneHit(const Ray& r, Interval ray_time_interval, double& t, double& alpha, double& beta) const;
 
 private:
     // The starting corner of quadrilateral
@@ -64,67 +119,116 @@ private:
     Vec3 _normal;
     // D parameter for plane
     double _d;
+    // Area of the quadrilateral, i.e. |u x v|
+    double _area;
 
-    std::shared_ptr<Material> _material;
+    uint32_t _material_id;
     AxisAlignedBoundingBox _bbox;
 };
 
+// Box an axis-aligned box intersected directly with the slab test
+// The face where the ray enters (or leaves, from inside) the box gives normal and texture coordinates analytically,
+// the faces keep the orientation and texture coordinates of six quadrilaterals around the box
 class Box : public Hittable {
 public:
     // Box The 3D box (six sides) that contains the two opposite vertices a and b
-    Box(const Point3& a, const Point3& b, std::shared_ptr<Material> material);
+    Box(const Point3& a, const Point3& b, uint32_t material_id);
+
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
+
+    // ComputeHitRecord takes the face of the hit from the element of info
+    void ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const override;
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
 
     AxisAlignedBoundingBox GetBoundingBox() const override;
 
-private:
-    std::shared_ptr<Material> _material;
-    std::shared_ptr<HittableList> _boundary;
-};
+    void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const override;
 
-class ObjectTranslated : public Hittable {
-public:
-    ObjectTranslated(std::shared_ptr<Hittable> object, const Vec3& offset);
+    // SampleDirection picks one of the six faces uniformly and a uniformly distributed point on it
+    Vec3 SampleDirection(const Point3& origin, double time, const Sample2D& u) const override;
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    double DirectionPdf(const Point3& origin, const Vec3& direction, double time) const override;
 
-    AxisAlignedBoundingBox GetBoundingBox() const override;
+    // LineHit times where the line of the ray enters and leaves the box, false if it misses the box
+    bool LineHit(const Ray& r, double& t_enter, double& t_exit) const;
 
 private:
-    std::shared_ptr<Hittable> _object;
-    Vec3 _offset;
+    // SlabHit LineHit that also returns the faces
+    // faces are numbered 2 * axis for the minimum side and 2 * axis + 1 for the maximum side
+    bool SlabHit(const Ray& r, double& t_enter, double& t_exit, int& enter_face, int& exit_face) const;
+
+    // FaceArea area of the two faces perpendicular to axis
+    double FaceArea(int axis) const;
+
+private:
+    Point3 _min;
+    Point3 _max;
+    uint32_t _material_id;
     AxisAlignedBoundingBox _bbox;
 };
 
-class ObjectYRotated : public Hittable {
+// Instance places a shared object, typically a bottom-level BVH, into the world with an affine transform
+// A top-level BVH over instances forms a two-level acceleration structure: copies of an object only cost
+// one transform each, and instances of instances are collapsed into a single transform of the innermost object
+// Containers of instances nest deeper, a hit records at most HitInfo::kMaxInstanceDepth levels:
+// an instance over more levels is rejected with an error when it is built and stays empty
+class Instance : public Hittable {
 public:
-    ObjectYRotated(std::shared_ptr<Hittable> object, double angle);
+    Instance(std::shared_ptr<Hittable> object, const Transform& object_to_world);
+
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
 
     AxisAlignedBoundingBox GetBoundingBox() const override;
+
+    int GetInstanceDepth() const override;
+
+    // GetObject returns the instanced object, never an Instance itself
+    inline const std::shared_ptr<Hittable>& GetObject() const {
+        return _object;
+    }
+
+    // GetTransform returns the object to world transform
+    inline const Transform& GetTransform() const {
+        return _object_to_world;
+    }
+
 private:
     std::shared_ptr<Hittable> _object;
-    double _sin_theta;
-    double _cos_theta;
+    Transform _object_to_world;
     AxisAlignedBoundingBox _bbox;
+    int _depth;
+};
+
+class ObjectTranslated : public Instance {
+public:
+    ObjectTranslated(std::shared_ptr<Hittable> object, const Vec3& offset);
+};
+
+class ObjectYRotated : public Instance {
+public:
+    ObjectYRotated(std::shared_ptr<Hittable> object, double angle);
 };
 
 class ObjectWithConstDensityMedium : public Hittable {
 public:
-    ObjectWithConstDensityMedium(std::shared_ptr<Hittable> boundary, double density, std::shared_ptr<Texture> texture);
+    // ObjectWithConstDensityMedium phase_function_id is the id of the medium material, usually an Isotropic
+    ObjectWithConstDensityMedium(std::shared_ptr<Hittable> boundary, double density, uint32_t phase_function_id);
 
-    ObjectWithConstDensityMedium(std::shared_ptr<Hittable> boundary, double density, const Color& albedo);
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
 
-    bool Hit(const Ray& r, Interval ray_time_interval, HitRecord& record) const override;
+    void ComputeHitRecord(const Ray& r, const HitInfo& info, HitRecord& record) const override;
 
     AxisAlignedBoundingBox GetBoundingBox() const override;
 
 private:
     double _neg_inv_density;
     std::shared_ptr<Hittable> _boundary;
-    std::shared_ptr<Material> _phase_function;
+    // Set when the boundary is a Box, whose entry and exit come from a single slab test
+    const Box* _box_boundary;
+    uint32_t _phase_function_id;
 };
 
 } // namespace rabbit
@@ -0,0 +1,35 @@
+#include "rabbit/packet.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+RayPacket::RayPacket() {
+    for (int k = 0; k < kMaxSize; k++) {
+        rays[k] = nullptr;
+        rng[k] = nullptr;
+        // unused lanes still go through the slab tests, give them finite values that never hit
+        tmin[k] = 1;
+        tmax[k] = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            origin[axis][k] = 0;
+            inv_dir[axis][k] = 1;
+        }
+    }
+}
+
+void RayPacket::Add(const Ray& r, Interval ray_time_interval, RandomStream& ray_rng) {
+    int k = _size++;
+    rays[k] = &r;
+    rng[k] = &ray_rng;
+    tmin[k] = ray_time_interval.GetMin();
+    tmax[k] = ray_time_interval.GetMax();
+    for (int axis = 0; axis < 3; axis++) {
+        origin[axis][k] = r.GetEndpoint()[axis];
+        inv_dir[axis][k] = r.GetInvDirection()[axis];
+    }
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,70 @@
+#ifndef GPLAY_RABBIT_PACKET_H
+#define GPLAY_RABBIT_PACKET_H
+/*
+Class RayPacket - A few coherent rays traced through the scene together
+reference: https://www.sci.utah.edu/~wald/Publications/2001/CRT/CRT.pdf (Wald et al., Interactive Rendering with Coherent Ray Tracing)
+Camera rays of neighbouring samples and shadow rays towards one light start close together and point the same way,
+so they mostly visit the same BVH nodes. LinearBVH tests each node against all rays of a packet at once and loads it
+only once; when the rays split up, the rest of the subtree is traversed ray by ray. Other objects trace the rays of
+a packet one by one, e.g. WideBVH, whose single ray traversal already tests four boxes at once.
+*/
+
+#include <cstdint>
+#include "rabbit/mathtools.h"
+#include "rabbit/ray.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+class RayPacket {
+public:
+    static const int kMaxSize = 8;
+
+    RayPacket();
+
+    // Add appends a ray with its search interval, ray and rng have to outlive the packet
+    void Add(const Ray& r, Interval ray_time_interval, RandomStream& ray_rng);
+
+    inline int Size() const {
+        return _size;
+    }
+
+    // FullMask bit mask of all rays of the packet, bit k stands for ray k
+    inline uint32_t FullMask() const {
+        return (1u << _size) - 1;
+    }
+
+    const Ray* rays[kMaxSize];
+    // Streams of the rays for stochastic objects, see Hittable::Intersect
+    RandomStream* rng[kMaxSize];
+    double tmin[kMaxSize];
+    // Far end of each ray's interval, IntersectPacket shrinks it to the closest hit found so far
+    double tmax[kMaxSize];
+    // Ray origins and reciprocal directions per axis for the slab tests, unused lanes hold an empty interval
+    alignas(16) double origin[3][kMaxSize];
+    alignas(16) double inv_dir[3][kMaxSize];
+
+private:
+    int _size = 0;
+};
+
+// IsSingleRay whether exactly one ray of a packet mask is set
+inline bool IsSingleRay(uint32_t mask) {
+    return mask != 0 && (mask & (mask - 1)) == 0;
+}
+
+// LowestRay index of the lowest ray set in a non-empty packet mask
+inline int LowestRay(uint32_t mask) {
+    int k = 0;
+    while (!(mask & (1u << k))) {
+        k++;
+    }
+    return k;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_PACKET_H
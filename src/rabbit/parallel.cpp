@@ -0,0 +1,62 @@
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "rabbit/parallel.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+int ResolveThreadCount(int requested) {
+    if (requested > 0) {
+        return requested;
+    }
+
+    auto env_threads = getenv("GPLAY_RABBIT_THREADS");
+    if (env_threads) {
+        int num = std::atoi(env_threads);
+        if (num > 0) {
+            return num;
+        }
+    }
+
+    unsigned int hardware_threads = std::thread::hardware_concurrency();
+    return hardware_threads > 0 ? static_cast<int>(hardware_threads) : 1;
+}
+
+void ParallelFor(int count, int num_threads, const std::function<void(int, int)>& body) {
+    if (count <= 0) {
+        return;
+    }
+    num_threads = ResolveThreadCount(num_threads);
+    if (num_threads > count) {
+        num_threads = count;
+    }
+
+    std::atomic<int> next_index(0);
+    auto worker = [&](int thread_index) {
+        while (true) {
+            int index = next_index.fetch_add(1, std::memory_order_relaxed);
+            if (index >= count) {
+                return;
+            }
+            body(index, thread_index);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads-1);
+    for (int t = 1; t < num_threads; t++) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,27 @@
+#ifndef GPLAY_RABBIT_PARALLEL_H
+#define GPLAY_RABBIT_PARALLEL_H
+/*
+Parallel tools - a minimal dynamic-scheduling worker pool
+*/
+
+#include <functional>
+
+namespace gplay {
+
+namespace rabbit {
+
+// ResolveThreadCount maps a requested thread count to the number of workers actually used
+// A non-positive request falls back to the GPLAY_RABBIT_THREADS environment variable,
+// then to the hardware concurrency
+int ResolveThreadCount(int requested);
+
+// ParallelFor runs body(index, thread_index) for every index in [0, count) on num_threads workers
+// Workers grab the next index from a shared atomic counter, so uneven work items balance themselves
+// The calling thread takes part as worker 0 and the call returns once all items are done
+void ParallelFor(int count, int num_threads, const std::function<void(int, int)>& body);
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_PARALLEL_H
@@ -7,23 +7,27 @@ namespace rabbit {
 Ray::Ray() {}
 
 Ray::Ray(const Point3& endpoint, const Vec3& direction, double time)
-    : _endpoint(endpoint), _direction(direction), _time(time) {}
-
-Ray::Ray(const Point3& endpoint, const Vec3& direction)
-    :  _endpoint(endpoint), _direction(direction), _time(0.0) {}
-
-const Point3& Ray::GetEndpoint() const {
-    return _endpoint;
+    : _endpoint(endpoint), _direction(direction), _time(time) {
+    PrecomputeInverse();
 }
 
-const Vec3& Ray::GetDirection() const {
-    return _direction;
+Ray::Ray(const Point3& endpoint, const Vec3& direction)
+    :  _endpoint(endpoint), _direction(direction), _time(0.0) {
+    PrecomputeInverse();
 }
 
 Point3 Ray::AtPos(double time) const {
     return _endpoint + time * _direction;
 }
 
+void Ray::PrecomputeInverse() {
+    _inv_direction = Vec3(1.0 / _direction.X(), 1.0 / _direction.Y(), 1.0 / _direction.Z());
+    for (int axis = 0; axis < 3; axis++) {
+        // the sign of the reciprocal also tells -0 from +0
+        _dir_is_neg[axis] = _inv_direction[axis] < 0;
+    }
+}
+
 } // namespace rabbit
 
 } // namespace gplay
@@ -2,6 +2,8 @@
 #define GPLAY_RABBIT_RAY_H
 /*
 Class Ray
+The reciprocal direction and the direction signs are computed once with the ray, every slab test of the BVHs
+and bounding boxes the ray visits reads them instead of dividing again.
 */
 
 #include "rabbit/vec3.h"
@@ -16,18 +18,30 @@ public:
     Ray(const Point3& endpoint, const Vec3& direction, double time);
     Ray(const Point3& endpoint, const Vec3& direction);
 
-    const Point3& GetEndpoint() const;
+    inline const Point3& GetEndpoint() const { return _endpoint; }
 
-    const Vec3& GetDirection() const;
+    inline const Vec3& GetDirection() const { return _direction; }
+
+    // GetInvDirection returns 1 / direction per axis, infinite along axes the ray is parallel to
+    inline const Vec3& GetInvDirection() const { return _inv_direction; }
+
+    // IsDirectionNegative whether the ray runs towards smaller coordinates along axis, i.e. enters a box at its maximum
+    inline bool IsDirectionNegative(int axis) const { return _dir_is_neg[axis]; }
 
     Point3 AtPos(double time) const;
 
     inline double GetTime() const { return _time; }
 
+private:
+    // PrecomputeInverse computes the reciprocal direction and the direction signs
+    void PrecomputeInverse();
+
 private:
     Point3 _endpoint;
     Vec3 _direction;
+    Vec3 _inv_direction;
     double _time;
+    bool _dir_is_neg[3];
 };
 
 } // namespace rabbit
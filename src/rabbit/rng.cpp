@@ -0,0 +1,27 @@
+#include "rabbit/rng.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+RandomStream::RandomStream() {
+    SetSequence(0, 0);
+}
+
+RandomStream::RandomStream(uint64_t seed, uint64_t stream) {
+    SetSequence(seed, stream);
+}
+
+void RandomStream::SetSequence(uint64_t seed, uint64_t stream) {
+    // neighbouring stream ids are scrambled first, PCG streams that differ
+    // only in a few low bits of the increment are visibly correlated
+    _state = 0u;
+    _inc = (MixBits(stream) << 1u) | 1u;
+    NextUInt32();
+    _state += MixBits(seed);
+    NextUInt32();
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,69 @@
+#ifndef GPLAY_RABBIT_RNG_H
+#define GPLAY_RABBIT_RNG_H
+/*
+Class RandomStream - PCG32 random number stream
+reference: https://www.pcg-random.org/
+Every (pixel, sample) pair owns its own small stream, so renders are reproducible whatever the thread count
+and threads never share generator state.
+*/
+
+#include <cstdint>
+
+namespace gplay {
+
+namespace rabbit {
+
+// MixBits scrambles the bits of a 64-bit key (splitmix64 finalizer)
+inline uint64_t MixBits(uint64_t v) {
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+class RandomStream {
+public:
+    RandomStream();
+
+    // RandomStream make the stream selected by `stream` of the generator seeded with `seed`
+    RandomStream(uint64_t seed, uint64_t stream);
+
+    // SetSequence restarts the generator at the beginning of the given seed/stream pair
+    void SetSequence(uint64_t seed, uint64_t stream);
+
+    // NextUInt32 returns a uniformly distributed 32-bit integer
+    inline uint32_t NextUInt32() {
+        uint64_t old_state = _state;
+        _state = old_state * kMultiplier + _inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old_state >> 18u) ^ old_state) >> 27u);
+        uint32_t rot = static_cast<uint32_t>(old_state >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((~rot + 1u) & 31u));
+    }
+
+    // NextDouble returns a random real in [0,1)
+    inline double NextDouble() {
+        // 2^-32, the result is strictly below one
+        return NextUInt32() * 2.3283064365386963e-10;
+    }
+
+private:
+    static const uint64_t kMultiplier = 0x5851f42d4c957f2dULL;
+
+    uint64_t _state;
+    // Stream selector, always odd
+    uint64_t _inc;
+};
+
+// PixelSampleStream returns the stream for sample `sample_index` of pixel i, j, independent of render order
+inline RandomStream PixelSampleStream(uint64_t seed, int i, int j, int sample_index) {
+    uint64_t pixel_key = (static_cast<uint64_t>(static_cast<uint32_t>(j)) << 32) | static_cast<uint32_t>(i);
+    return RandomStream(seed ^ MixBits(pixel_key), static_cast<uint64_t>(sample_index));
+}
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_RNG_H
@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <limits>
+
+#include "rabbit/sampler.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+// Largest double below one
+const double kOneMinusEpsilon = 1.0 - std::numeric_limits<double>::epsilon() / 2;
+
+// HashValues combines a few keys into one well mixed 64-bit hash
+inline uint64_t HashValues(uint64_t a, uint64_t b, uint64_t c = 0, uint64_t d = 0) {
+    return MixBits(MixBits(MixBits(MixBits(a) ^ b) ^ c) ^ d);
+}
+
+inline uint64_t PixelKey(int i, int j) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(j)) << 32) | static_cast<uint32_t>(i);
+}
+
+inline int Log2Ceil(uint64_t v) {
+    int log2 = 0;
+    while ((uint64_t(1) << log2) < v) {
+        log2++;
+    }
+    return log2;
+}
+
+inline uint32_t ReverseBits32(uint32_t v) {
+    v = (v << 16) | (v >> 16);
+    v = ((v & 0x00ff00ff) << 8) | ((v & 0xff00ff00) >> 8);
+    v = ((v & 0x0f0f0f0f) << 4) | ((v & 0xf0f0f0f0) >> 4);
+    v = ((v & 0x33333333) << 2) | ((v & 0xcccccccc) >> 2);
+    v = ((v & 0x55555555) << 1) | ((v & 0xaaaaaaaa) >> 1);
+    return v;
+}
+
+// OwenScramble randomly permutes the binary digits of v, each digit depending on the digits above it
+// reference: https://psychopath.io/post/2021_01_30_building_a_better_lk_hash
+inline uint32_t OwenScramble(uint32_t v, uint32_t seed) {
+    v = ReverseBits32(v);
+    v ^= v * 0x3d20adea;
+    v += seed;
+    v *= (seed >> 16) | 1;
+    v ^= v * 0x05526c56;
+    v ^= v * 0x53a22864;
+    return ReverseBits32(v);
+}
+
+// SpreadBits2 inserts a zero bit above every bit of the low 32 bits of v
+inline uint64_t SpreadBits2(uint64_t v) {
+    v &= 0xffffffff;
+    v = (v ^ (v << 16)) & 0x0000ffff0000ffffULL;
+    v = (v ^ (v << 8)) & 0x00ff00ff00ff00ffULL;
+    v = (v ^ (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    v = (v ^ (v << 2)) & 0x3333333333333333ULL;
+    v = (v ^ (v << 1)) & 0x5555555555555555ULL;
+    return v;
+}
+
+inline uint64_t EncodeMorton2(uint32_t x, uint32_t y) {
+    return (SpreadBits2(y) << 1) | SpreadBits2(x);
+}
+
+// SobolTables the second Sobol dimension as XOR tables over the bytes of the index
+// The first dimension is the van der Corput sequence, i.e. the bit reversal of the index, and needs no table
+class SobolTables {
+public:
+    SobolTables() {
+        // dimension 1 has primitive polynomial x + 1, its generator matrix columns are the rows of Pascal's triangle mod 2
+        uint32_t columns[32];
+        for (int k = 0; k < 32; k++) {
+            columns[k] = k == 0 ? (1u << 31) : (columns[k-1] ^ (columns[k-1] >> 1));
+        }
+        for (int byte = 0; byte < 4; byte++) {
+            for (int value = 0; value < 256; value++) {
+                uint32_t v = 0;
+                for (int bit = 0; bit < 8; bit++) {
+                    if (value & (1 << bit)) {
+                        v ^= columns[8*byte + bit];
+                    }
+                }
+                dimension1[byte][value] = v;
+            }
+        }
+    }
+
+    uint32_t dimension1[4][256];
+};
+
+const SobolTables& GetSobolTables() {
+    static const SobolTables tables;
+    return tables;
+}
+
+// The 24 permutations of a base 4 digit
+const uint8_t kBase4Permutations[24][4] = {
+    {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+    {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+    {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+    {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2},
+};
+
+} // namespace
+
+uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t seed) {
+    // a hash that is a bijection on [0, 2^k), cycle walking skips the values in [n, 2^k)
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= seed;
+        i *= 0xe170893d;
+        i ^= seed >> 16;
+        i ^= (i & w) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3f;
+        i ^= seed >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= n);
+    return (i + seed) % n;
+}
+
+double SobolSample(uint64_t index, int dimension, uint32_t seed) {
+    // only the low 32 index bits are used, i.e. the sequence repeats after 2^32 points
+    uint32_t i = static_cast<uint32_t>(index);
+    uint32_t v;
+    if (dimension == 0) {
+        v = ReverseBits32(i);
+    } else {
+        const SobolTables& tables = GetSobolTables();
+        v = tables.dimension1[0][i & 0xff] ^ tables.dimension1[1][(i >> 8) & 0xff] ^
+            tables.dimension1[2][(i >> 16) & 0xff] ^ tables.dimension1[3][i >> 24];
+    }
+    v = OwenScramble(v, seed);
+    // 2^-32
+    return std::min(v * 2.3283064365386963e-10, kOneMinusEpsilon);
+}
+
+Sampler::Sampler(int samples_per_pixel, uint64_t seed)
+    : _samples_per_pixel(std::max(samples_per_pixel, 1)), _seed(seed) {}
+
+void Sampler::StartPixelSample(int i, int j, int sample_index) {
+    _pixel_x = i;
+    _pixel_y = j;
+    _sample_index = sample_index;
+    _dimension = 0;
+    _rng = PixelSampleStream(_seed, i, j, sample_index);
+}
+
+SamplerState Sampler::SaveState() const {
+    SamplerState state;
+    state.pixel_x = _pixel_x;
+    state.pixel_y = _pixel_y;
+    state.sample_index = _sample_index;
+    state.dimension = _dimension;
+    state.rng = _rng;
+    return state;
+}
+
+void Sampler::RestoreState(const SamplerState& state) {
+    _pixel_x = state.pixel_x;
+    _pixel_y = state.pixel_y;
+    _sample_index = state.sample_index;
+    _dimension = state.dimension;
+    _rng = state.rng;
+}
+
+IndependentSampler::IndependentSampler(int samples_per_pixel, uint64_t seed) : Sampler(samples_per_pixel, seed) {}
+
+double IndependentSampler::Get1D() {
+    _dimension++;
+    return _rng.NextDouble();
+}
+
+Sample2D IndependentSampler::Get2D() {
+    _dimension += 2;
+    double x = _rng.NextDouble();
+    double y = _rng.NextDouble();
+    return Sample2D(x, y);
+}
+
+StratifiedSampler::StratifiedSampler(int samples_per_pixel, uint64_t seed) : Sampler(samples_per_pixel, seed) {
+    // the most square factorization of the sample count
+    _x_strata = 1;
+    for (int d = 1; d * d <= _samples_per_pixel; d++) {
+        if (_samples_per_pixel % d == 0) {
+            _x_strata = d;
+        }
+    }
+    _y_strata = _samples_per_pixel / _x_strata;
+}
+
+double StratifiedSampler::Get1D() {
+    // every samples_per_pixel consecutive samples cover all strata once, in an order shuffled per pixel and dimension
+    uint32_t round = _sample_index / _samples_per_pixel;
+    uint32_t hash = static_cast<uint32_t>(HashValues(PixelKey(_pixel_x, _pixel_y), _dimension, _seed, round));
+    uint32_t stratum = PermutationElement(_sample_index % _samples_per_pixel, _samples_per_pixel, hash);
+    _dimension++;
+    return (stratum + _rng.NextDouble()) / _samples_per_pixel;
+}
+
+Sample2D StratifiedSampler::Get2D() {
+    uint32_t round = _sample_index / _samples_per_pixel;
+    uint32_t hash = static_cast<uint32_t>(HashValues(PixelKey(_pixel_x, _pixel_y), _dimension, _seed, round));
+    uint32_t stratum = PermutationElement(_sample_index % _samples_per_pixel, _samples_per_pixel, hash);
+    _dimension += 2;
+    double x = (stratum % _x_strata + _rng.NextDouble()) / _x_strata;
+    double y = (stratum / _x_strata + _rng.NextDouble()) / _y_strata;
+    return Sample2D(x, y);
+}
+
+SobolSampler::SobolSampler(int samples_per_pixel, uint64_t seed) : Sampler(samples_per_pixel, seed) {}
+
+uint64_t SobolSampler::SampleIndex(uint64_t hash) const {
+    // Every dimension pair reuses the first two Sobol dimensions. Shuffling the sample order within each block of
+    // 2^k points pads the pairs, i.e. decorrelates them, while each pair keeps its low discrepancy.
+    uint32_t block = 1u << Log2Ceil(_samples_per_pixel);
+    uint64_t first = static_cast<uint64_t>(_sample_index) / block * block;
+    return first + PermutationElement(_sample_index % block, block, static_cast<uint32_t>(hash >> 32));
+}
+
+double SobolSampler::Get1D() {
+    uint64_t hash = HashValues(PixelKey(_pixel_x, _pixel_y), _dimension, _seed);
+    _dimension++;
+    return SobolSample(SampleIndex(hash), 0, static_cast<uint32_t>(hash));
+}
+
+Sample2D SobolSampler::Get2D() {
+    uint64_t hash = HashValues(PixelKey(_pixel_x, _pixel_y), _dimension, _seed);
+    uint64_t index = SampleIndex(hash);
+    _dimension += 2;
+    uint32_t seed_y = static_cast<uint32_t>(MixBits(hash));
+    return Sample2D(SobolSample(index, 0, static_cast<uint32_t>(hash)), SobolSample(index, 1, seed_y));
+}
+
+ZSobolSampler::ZSobolSampler(int samples_per_pixel, int image_width, int image_height, uint64_t seed)
+    : Sampler(samples_per_pixel, seed) {
+    int log2_resolution = Log2Ceil(std::max(std::max(image_width, image_height), 1));
+    // Morton index and sample bits have to fit the 32-bit Sobol index, larger sample counts use several
+    // differently scrambled rounds
+    _log2_samples_per_pixel = std::min(Log2Ceil(_samples_per_pixel), std::max(32 - 2*log2_resolution, 0));
+    _num_base4_digits = log2_resolution + (_log2_samples_per_pixel + 1) / 2;
+}
+
+void ZSobolSampler::StartPixelSample(int i, int j, int sample_index) {
+    Sampler::StartPixelSample(i, j, sample_index);
+    // consecutive samples of a pixel and neighbouring pixels get consecutive Sobol indices
+    uint64_t sample_mask = (uint64_t(1) << _log2_samples_per_pixel) - 1;
+    _morton_index = (EncodeMorton2(i, j) << _log2_samples_per_pixel) | (sample_index & sample_mask);
+    _round_seed = MixBits(_seed ^ (static_cast<uint64_t>(sample_index) >> _log2_samples_per_pixel));
+}
+
+SamplerState ZSobolSampler::SaveState() const {
+    SamplerState state = Sampler::SaveState();
+    state.morton_index = _morton_index;
+    state.round_seed = _round_seed;
+    return state;
+}
+
+void ZSobolSampler::RestoreState(const SamplerState& state) {
+    Sampler::RestoreState(state);
+    _morton_index = state.morton_index;
+    _round_seed = state.round_seed;
+}
+
+uint64_t ZSobolSampler::SampleIndex() const {
+    // Randomly permuting the base 4 digits keeps every aligned group of 4^k indices inside one group,
+    // so each pixel still gets a well stratified slice of the sequence and neighbouring pixels complement it
+    // a single multiply-xorshift per digit is enough to pick one of 24 permutations, full MixBits rounds cost
+    // a noticeable share of the render time here
+    uint64_t dimension_key = MixBits(_dimension ^ _round_seed);
+    uint64_t sample_index = 0;
+    bool odd_log2 = (_log2_samples_per_pixel & 1) != 0;
+    int last_digit = odd_log2 ? 1 : 0;
+    for (int k = _num_base4_digits - 1; k >= last_digit; k--) {
+        int digit_shift = 2*k - (odd_log2 ? 1 : 0);
+        int digit = static_cast<int>((_morton_index >> digit_shift) & 3);
+        uint64_t higher_digits = _morton_index >> (digit_shift + 2);
+        uint64_t h = (higher_digits ^ dimension_key) * 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 31;
+        int p = static_cast<int>(((h >> 32) * 24) >> 32);
+        sample_index |= static_cast<uint64_t>(kBase4Permutations[p][digit]) << digit_shift;
+    }
+    if (odd_log2) {
+        // the lowest binary digit is flipped at random
+        uint64_t digit = _morton_index & 1;
+        uint64_t h = ((_morton_index >> 1) ^ dimension_key) * 0xbf58476d1ce4e5b9ULL;
+        sample_index |= digit ^ (h >> 63);
+    }
+    return sample_index;
+}
+
+double ZSobolSampler::Get1D() {
+    uint64_t index = SampleIndex();
+    uint64_t hash = HashValues(_dimension, _round_seed);
+    _dimension++;
+    return SobolSample(index, 0, static_cast<uint32_t>(hash));
+}
+
+Sample2D ZSobolSampler::Get2D() {
+    uint64_t index = SampleIndex();
+    uint64_t hash = HashValues(_dimension, _round_seed);
+    _dimension += 2;
+    return Sample2D(SobolSample(index, 0, static_cast<uint32_t>(hash)),
+                    SobolSample(index, 1, static_cast<uint32_t>(hash >> 32)));
+}
+
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, int samples_per_pixel, int image_width, int image_height,
+                                     uint64_t seed) {
+    switch (type) {
+    case SamplerType::kIndependent:
+        return std::unique_ptr<Sampler>(new IndependentSampler(samples_per_pixel, seed));
+    case SamplerType::kStratified:
+        return std::unique_ptr<Sampler>(new StratifiedSampler(samples_per_pixel, seed));
+    case SamplerType::kSobol:
+        return std::unique_ptr<Sampler>(new SobolSampler(samples_per_pixel, seed));
+    case SamplerType::kZSobol:
+    default:
+        return std::unique_ptr<Sampler>(new ZSobolSampler(samples_per_pixel, image_width, image_height, seed));
+    }
+}
+
+} // namespace rabbit
+
+} // namespace gplay
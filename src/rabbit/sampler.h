@@ -0,0 +1,167 @@
+#ifndef GPLAY_RABBIT_SAMPLER_H
+#define GPLAY_RABBIT_SAMPLER_H
+/*
+Class Sampler - Sample values for the pixel, lens, time and bounce dimensions of a path
+reference: https://pbr-book.org/4ed/Sampling_and_Reconstruction/Sampling_Interface
+           https://pbr-book.org/4ed/Sampling_and_Reconstruction/Sobol_Samplers
+           https://dl.acm.org/doi/10.1145/3414685.3417881 (Ahmed and Wonka, Screen-Space Blue-Noise Diffusion)
+A sampler is positioned at one sample of one pixel, then hands out the dimensions of that sample in order.
+Low discrepancy samplers spread the samples of a pixel evenly over every dimension (pair), so the estimates converge
+faster than with independent random numbers. Everything is a pure function of (seed, pixel, sample, dimension),
+renders stay identical for any thread count.
+*/
+
+#include <memory>
+#include "rabbit/mathtools.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+// SamplerType the sample generators that MakeSampler can create
+enum class SamplerType {
+    // Independent uniform random numbers
+    kIndependent,
+    // Jittered strata, shuffled independently for every dimension (pair)
+    kStratified,
+    // Owen scrambled Sobol points, dimension pairs padded by shuffling the sample order
+    kSobol,
+    // Sobol points ordered along the Morton curve of the pixels, distributes the error as blue noise over the image
+    kZSobol,
+};
+
+// SamplerState where a sampler stands within a sample, lets many paths share one sampler
+class SamplerState {
+public:
+    int pixel_x = 0;
+    int pixel_y = 0;
+    int sample_index = 0;
+    uint32_t dimension = 0;
+    // The sample's stream, also what intersection queries of the path draw from
+    RandomStream rng;
+    // ZSobolSampler: Morton index of the sample and the scramble seed of its round
+    uint64_t morton_index = 0;
+    uint64_t round_seed = 0;
+};
+
+class Sampler {
+public:
+    virtual ~Sampler() = default;
+
+    // StartPixelSample positions the sampler at the first dimension of sample `sample_index` of pixel i, j
+    virtual void StartPixelSample(int i, int j, int sample_index);
+
+    // Get1D returns the next dimension of the current sample
+    virtual double Get1D() = 0;
+
+    // Get2D returns the next pair of dimensions of the current sample
+    virtual Sample2D Get2D() = 0;
+
+    // Stream random numbers of the current sample for decisions the sampler does not stratify, e.g. volume scattering
+    inline RandomStream& Stream() {
+        return _rng;
+    }
+
+    // SaveState the position of the sampler within the current sample
+    virtual SamplerState SaveState() const;
+
+    // RestoreState continues the sample at the position SaveState returned, e.g. after other samples were drawn
+    // Cheaper than StartPixelSample, what the sampler type derives from pixel and sample is part of the state
+    virtual void RestoreState(const SamplerState& state);
+
+    inline int SamplesPerPixel() const {
+        return _samples_per_pixel;
+    }
+
+protected:
+    Sampler(int samples_per_pixel, uint64_t seed);
+
+    int _samples_per_pixel;
+    uint64_t _seed;
+    int _pixel_x = 0;
+    int _pixel_y = 0;
+    int _sample_index = 0;
+    // Index of the next dimension handed out
+    uint32_t _dimension = 0;
+    RandomStream _rng;
+};
+
+class IndependentSampler : public Sampler {
+public:
+    IndependentSampler(int samples_per_pixel, uint64_t seed = 0);
+
+    double Get1D() override;
+
+    Sample2D Get2D() override;
+};
+
+class StratifiedSampler : public Sampler {
+public:
+    // StratifiedSampler 2D dimensions use an x_strata * y_strata grid with x_strata * y_strata == samples_per_pixel
+    StratifiedSampler(int samples_per_pixel, uint64_t seed = 0);
+
+    double Get1D() override;
+
+    Sample2D Get2D() override;
+
+private:
+    int _x_strata;
+    int _y_strata;
+};
+
+class SobolSampler : public Sampler {
+public:
+    SobolSampler(int samples_per_pixel, uint64_t seed = 0);
+
+    double Get1D() override;
+
+    Sample2D Get2D() override;
+
+private:
+    // SampleIndex the Sobol index of the current sample for the next dimension (pair)
+    uint64_t SampleIndex(uint64_t hash) const;
+};
+
+class ZSobolSampler : public Sampler {
+public:
+    // ZSobolSampler image_width and image_height bound the pixel coordinates that are passed to StartPixelSample
+    ZSobolSampler(int samples_per_pixel, int image_width, int image_height, uint64_t seed = 0);
+
+    void StartPixelSample(int i, int j, int sample_index) override;
+
+    SamplerState SaveState() const override;
+
+    void RestoreState(const SamplerState& state) override;
+
+    double Get1D() override;
+
+    Sample2D Get2D() override;
+
+private:
+    // SampleIndex shuffles the base 4 digits of the Morton index with permutations seeded by the higher digits
+    uint64_t SampleIndex() const;
+
+    // Samples per pixel rounded up to a power of two, limited so that the Sobol index fits 32 bits
+    int _log2_samples_per_pixel;
+    int _num_base4_digits;
+    uint64_t _morton_index = 0;
+    // Seed of the current round of 2^_log2_samples_per_pixel samples, sample indices beyond it start a new scramble
+    uint64_t _round_seed = 0;
+};
+
+// MakeSampler creates a sampler of the given type for an image_width x image_height render
+std::unique_ptr<Sampler> MakeSampler(SamplerType type, int samples_per_pixel, int image_width, int image_height,
+                                     uint64_t seed = 0);
+
+// PermutationElement returns element i of a random permutation of [0, n) selected by seed, without storing it
+// reference: Kensler, Correlated Multi-Jittered Sampling
+uint32_t PermutationElement(uint32_t i, uint32_t n, uint32_t seed);
+
+// SobolSample returns dimension (0 or 1) of the Sobol point `index`, Owen scrambled with seed
+double SobolSample(uint64_t index, int dimension, uint32_t seed);
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_SAMPLER_H
@@ -0,0 +1,75 @@
+#include <cmath>
+
+#include "rabbit/transform.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+Transform::Transform() {}
+
+Transform::Transform(const gmath::SMatrix4& m)
+    : _m(m),
+      _inv(gmath::SMatrix4::Inverse(m)) {}
+
+Transform::Transform(const gmath::SMatrix4& m, const gmath::SMatrix4& inv)
+    : _m(m),
+      _inv(inv) {}
+
+Transform Transform::Translation(const Vec3& offset) {
+    gmath::SMatrix4 m;
+    gmath::SMatrix4 inv;
+    for (int axis = 0; axis < 3; axis++) {
+        m[3][axis] = offset[axis];
+        inv[3][axis] = -offset[axis];
+    }
+    return Transform(m, inv);
+}
+
+Transform Transform::RotationY(double angle) {
+    auto radians = DegreesToRadians(angle);
+    auto sin_theta = std::sin(radians);
+    auto cos_theta = std::cos(radians);
+    // x' = cos*x + sin*z, z' = -sin*x + cos*z
+    gmath::SMatrix4 m;
+    m[0][0] = cos_theta;  m[0][2] = -sin_theta;
+    m[2][0] = sin_theta;  m[2][2] = cos_theta;
+    // a rotation is inverted by its transpose
+    return Transform(m, gmath::TransposeMatrix(m));
+}
+
+Transform Transform::Scaling(const Vec3& factors) {
+    gmath::SMatrix4 m;
+    gmath::SMatrix4 inv;
+    for (int axis = 0; axis < 3; axis++) {
+        m[axis][axis] = factors[axis];
+        inv[axis][axis] = 1.0 / factors[axis];
+    }
+    return Transform(m, inv);
+}
+
+AxisAlignedBoundingBox Transform::ApplyBox(const AxisAlignedBoundingBox& bbox) const {
+    Point3 min( kInfinity,  kInfinity,  kInfinity);
+    Point3 max(-kInfinity, -kInfinity, -kInfinity);
+
+    // transform the 8 corners of the box
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            for (int k = 0; k < 2; k++) {
+                Point3 corner(i ? bbox.x.GetMax() : bbox.x.GetMin(),
+                              j ? bbox.y.GetMax() : bbox.y.GetMin(),
+                              k ? bbox.z.GetMax() : bbox.z.GetMin());
+                Point3 tester = ApplyPoint(corner);
+                for (int c = 0; c < 3; c++) {
+                    min[c] = std::fmin(min[c], tester[c]);
+                    max[c] = std::fmax(max[c], tester[c]);
+                }
+            }
+        }
+    }
+    return AxisAlignedBoundingBox(min, max);
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,96 @@
+#ifndef GPLAY_RABBIT_TRANSFORM_H
+#define GPLAY_RABBIT_TRANSFORM_H
+/*
+Class Transform - Affine transformation of points, vectors, normals, rays and bounding boxes
+reference: https://pbr-book.org/3ed-2018/Geometry_and_Transformations/Transformations
+Matrices follow gmath::SMatrix4 and use row vectors, i.e. p' = p * M, so that A.Then(B) is simply A * B.
+The inverse is kept alongside the matrix, rays are moved into object space without inverting anything per hit.
+*/
+
+#include "gmath/smatrix4.h"
+#include "rabbit/aabb.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+class Transform {
+public:
+    // Transform the identity transform
+    Transform();
+
+    // Transform make the transform of an invertible affine matrix
+    explicit Transform(const gmath::SMatrix4& m);
+
+    // Translation moves by offset
+    static Transform Translation(const Vec3& offset);
+
+    // RotationY rotates counterclockwise by angle degrees around the y axis
+    static Transform RotationY(double angle);
+
+    // Scaling scales each axis independently
+    static Transform Scaling(const Vec3& factors);
+
+    // Then returns the transform that applies this one first and next afterwards
+    inline Transform Then(const Transform& next) const {
+        return Transform(_m * next._m, next._inv * _inv);
+    }
+
+    // Inverse returns the inverse transform
+    inline Transform Inverse() const {
+        return Transform(_inv, _m);
+    }
+
+    // ApplyPoint ...
+    inline Point3 ApplyPoint(const Point3& p) const {
+        return ApplyPoint(_m, p);
+    }
+
+    // ApplyVector transforms a direction, translation is ignored
+    inline Vec3 ApplyVector(const Vec3& v) const {
+        return ApplyVector(_m, v);
+    }
+
+    // ApplyNormal transforms a surface normal with the inverse transpose, the result is not normalized
+    inline Vec3 ApplyNormal(const Vec3& n) const {
+        const auto& m = _inv.mat;
+        return Vec3(m[0][0]*n[0] + m[0][1]*n[1] + m[0][2]*n[2],
+                    m[1][0]*n[0] + m[1][1]*n[1] + m[1][2]*n[2],
+                    m[2][0]*n[0] + m[2][1]*n[1] + m[2][2]*n[2]);
+    }
+
+    // ApplyInverse moves a ray through the inverse transform, the ray parameter t of any point is preserved
+    inline Ray ApplyInverse(const Ray& r) const {
+        return Ray(ApplyPoint(_inv, r.GetEndpoint()), ApplyVector(_inv, r.GetDirection()), r.GetTime());
+    }
+
+    // ApplyBox returns the bounding box of the transformed box corners
+    AxisAlignedBoundingBox ApplyBox(const AxisAlignedBoundingBox& bbox) const;
+
+private:
+    Transform(const gmath::SMatrix4& m, const gmath::SMatrix4& inv);
+
+    static inline Point3 ApplyPoint(const gmath::SMatrix4& matrix, const Point3& p) {
+        const auto& m = matrix.mat;
+        return Point3(p[0]*m[0][0] + p[1]*m[1][0] + p[2]*m[2][0] + m[3][0],
+                      p[0]*m[0][1] + p[1]*m[1][1] + p[2]*m[2][1] + m[3][1],
+                      p[0]*m[0][2] + p[1]*m[1][2] + p[2]*m[2][2] + m[3][2]);
+    }
+
+    static inline Vec3 ApplyVector(const gmath::SMatrix4& matrix, const Vec3& v) {
+        const auto& m = matrix.mat;
+        return Vec3(v[0]*m[0][0] + v[1]*m[1][0] + v[2]*m[2][0],
+                    v[0]*m[0][1] + v[1]*m[1][1] + v[2]*m[2][1],
+                    v[0]*m[0][2] + v[1]*m[1][2] + v[2]*m[2][2]);
+    }
+
+private:
+    gmath::SMatrix4 _m;
+    gmath::SMatrix4 _inv;
+};
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_TRANSFORM_H
@@ -0,0 +1,467 @@
+#include <algorithm>
+#include <vector>
+
+#include "rabbit/wavefront.h"
+#include "rabbit/draw.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+// Paths per batch, enough for long shading loops per material while the path state still fits the caches
+const size_t kBatchSize = 4096;
+
+// Vec3Array one Vec3 per path, each component in an array of its own
+class Vec3Array {
+public:
+    explicit Vec3Array(size_t size) : x(size), y(size), z(size) {}
+
+    inline Vec3 Get(size_t k) const {
+        return Vec3(x[k], y[k], z[k]);
+    }
+
+    inline void Set(size_t k, const Vec3& v) {
+        x[k] = v.X();
+        y[k] = v.Y();
+        z[k] = v.Z();
+    }
+
+    inline void Add(size_t k, const Vec3& v) {
+        x[k] += v.X();
+        y[k] += v.Y();
+        z[k] += v.Z();
+    }
+
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> z;
+};
+
+// RayArray one ray per path, Get recomputes the reciprocal direction the traversals need
+class RayArray {
+public:
+    explicit RayArray(size_t size) : endpoint(size), direction(size), time(size) {}
+
+    inline Ray Get(size_t k) const {
+        return Ray(endpoint.Get(k), direction.Get(k), time[k]);
+    }
+
+    inline void Set(size_t k, const Ray& r) {
+        endpoint.Set(k, r.GetEndpoint());
+        direction.Set(k, r.GetDirection());
+        time[k] = r.GetTime();
+    }
+
+    Vec3Array endpoint;
+    Vec3Array direction;
+    std::vector<double> time;
+};
+
+// HitRecordArray one hit record per path
+class HitRecordArray {
+public:
+    explicit HitRecordArray(size_t size)
+        : hitpoint(size), normal(size), material_id(size), prim(size), t(size), u(size), v(size), front_face(size) {}
+
+    inline HitRecord Get(size_t k) const {
+        HitRecord record;
+        record.hitpoint = hitpoint.Get(k);
+        record.normal = normal.Get(k);
+        record.material_id = material_id[k];
+        record.prim = prim[k];
+        record.t = t[k];
+        record.u = u[k];
+        record.v = v[k];
+        record.SetFrontFace(front_face[k] != 0);
+        return record;
+    }
+
+    inline void Set(size_t k, const HitRecord& record) {
+        hitpoint.Set(k, record.hitpoint);
+        normal.Set(k, record.normal);
+        material_id[k] = record.material_id;
+        prim[k] = record.prim;
+        t[k] = record.t;
+        u[k] = record.u;
+        v[k] = record.v;
+        front_face[k] = record.IsFrontFace();
+    }
+
+    Vec3Array hitpoint;
+    Vec3Array normal;
+    std::vector<uint32_t> material_id;
+    std::vector<const Hittable*> prim;
+    std::vector<double> t;
+    std::vector<double> u;
+    std::vector<double> v;
+    std::vector<uint8_t> front_face;
+};
+
+// ScatterSampleArray one scatter sample per path
+class ScatterSampleArray {
+public:
+    explicit ScatterSampleArray(size_t size) : scattered(size), weight(size), pdf(size) {}
+
+    inline void Set(size_t k, const ScatterSample& sample) {
+        scattered.Set(k, sample.scattered);
+        weight.Set(k, sample.weight);
+        pdf[k] = sample.pdf;
+    }
+
+    RayArray scattered;
+    Vec3Array weight;
+    std::vector<double> pdf;
+};
+
+// LightSampleArray one light sample per path
+class LightSampleArray {
+public:
+    explicit LightSampleArray(size_t size)
+        : light(size), shadow(size), f(size), weight(size), distance(size), light_color(size) {}
+
+    inline LightSample Get(size_t k) const {
+        LightSample sample;
+        sample.light = light[k];
+        sample.shadow = shadow.Get(k);
+        sample.f = f.Get(k);
+        sample.weight = weight[k];
+        sample.distance = distance[k];
+        sample.light_color = light_color.Get(k);
+        return sample;
+    }
+
+    inline void Set(size_t k, const LightSample& sample) {
+        light[k] = sample.light;
+        shadow.Set(k, sample.shadow);
+        f.Set(k, sample.f);
+        weight[k] = sample.weight;
+        distance[k] = sample.distance;
+        light_color.Set(k, sample.light_color);
+    }
+
+    std::vector<const Hittable*> light;
+    RayArray shadow;
+    Vec3Array f;
+    std::vector<double> weight;
+    std::vector<double> distance;
+    Vec3Array light_color;
+};
+
+// PathBatch the state of a batch of paths in structure of arrays form, one entry per path in generation order
+// A stage reads only the arrays of the fields it needs, e.g. sorting by material streams just the material ids.
+class PathBatch {
+public:
+    PathBatch()
+        : state(kBatchSize), ray(kBatchSize), throughput(kBatchSize), radiance(kBatchSize),
+          prev_scatter_pdf(kBatchSize), record(kBatchSize), scatter(kBatchSize), light_sample(kBatchSize),
+          marked(kBatchSize, 0) {
+        for (auto queue : {&active, &hits, &sorted, &scattered, &lit, &located}) {
+            queue->reserve(kBatchSize);
+        }
+    }
+
+    // Pixel, sample and sampler position of each path
+    std::vector<SamplerState> state;
+    RayArray ray;
+    Vec3Array throughput;
+    Vec3Array radiance;
+    // Density with which the last vertex scattered into the ray, see RayColor
+    std::vector<double> prev_scatter_pdf;
+    HitRecordArray record;
+    ScatterSampleArray scatter;
+    LightSampleArray light_sample;
+    // Paths a stage keeps, for picking them from the active paths in generation order, zero between the stages
+    std::vector<uint8_t> marked;
+
+    // Queues of path indices between the stages
+    std::vector<uint32_t> active;
+    std::vector<uint32_t> hits;
+    std::vector<uint32_t> sorted;
+    std::vector<uint32_t> scattered;
+    std::vector<uint32_t> lit;
+    std::vector<uint32_t> located;
+    std::vector<size_t> material_offsets;
+};
+
+// WavefrontTracer the stages that advance the paths of a batch
+class WavefrontTracer {
+public:
+    WavefrontTracer(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                    const LightList& lights, bool ray_packets, Sampler& sampler, PathBatch& batch)
+        : _camera(camera), _world(world), _materials(materials), _lights(lights), _ray_packets(ray_packets),
+          _sampler(sampler), _batch(batch) {}
+
+    inline size_t Size() const {
+        return _size;
+    }
+
+    // Generate appends the camera rays of samples [first_sample, first_sample + count) of pixel i, j to the batch
+    void Generate(int i, int j, int first_sample, int count) {
+        for (int sample = first_sample; sample < first_sample + count; sample++, _size++) {
+            _sampler.StartPixelSample(i, j, sample);
+            _batch.ray.Set(_size, _camera.GetRay(i, j, _sampler));
+            _batch.state[_size] = _sampler.SaveState();
+            _batch.throughput.Set(_size, Color(1,1,1));
+            _batch.radiance.Set(_size, Color(0,0,0));
+            _batch.prev_scatter_pdf[_size] = 0;
+        }
+    }
+
+    // Trace runs the stages until every path of the batch has ended
+    void Trace() {
+        _batch.active.resize(_size);
+        for (size_t k = 0; k < _size; k++) {
+            _batch.active[k] = static_cast<uint32_t>(k);
+        }
+        for (int depth = 0; depth < _camera.MaxBounce() && !_batch.active.empty(); depth++) {
+            // only the camera rays and the shadow rays of their hits are coherent enough for packets, the
+            // scattered rays of later bounces point every which way
+            bool packets = depth == 0 && _ray_packets;
+            if (packets) {
+                ExtendPackets();
+            } else {
+                Extend();
+            }
+            SortByMaterial();
+            Shade();
+            if (packets) {
+                ShadowPackets();
+            } else {
+                Shadow();
+            }
+            Continue(depth);
+        }
+    }
+
+    // Flush adds the radiance of the paths to framebuffer in the order they were generated and empties the batch
+    void Flush(Framebuffer& framebuffer) {
+        for (size_t k = 0; k < _size; k++) {
+            framebuffer.AddSample(_batch.state[k].pixel_x, _batch.state[k].pixel_y, _batch.radiance.Get(k));
+        }
+        _size = 0;
+    }
+
+private:
+    // Extend intersects the rays of the active paths, paths that leave the scene gather the background
+    void Extend() {
+        _batch.hits.clear();
+        for (uint32_t k : _batch.active) {
+            HitRecord record;
+            if (_world.Hit(_batch.ray.Get(k), Interval(0.001, kInfinity), record, _batch.state[k].rng)) {
+                _batch.record.Set(k, record);
+                _batch.hits.push_back(k);
+            } else {
+                _batch.radiance.Add(k, _batch.throughput.Get(k) * _camera.BackgroundColor());
+            }
+        }
+    }
+
+    // ExtendPackets Extend with the rays traced in packets of consecutive active paths
+    void ExtendPackets() {
+        _batch.hits.clear();
+        for (size_t first = 0; first < _batch.active.size(); first += RayPacket::kMaxSize) {
+            size_t count = std::min(_batch.active.size() - first, static_cast<size_t>(RayPacket::kMaxSize));
+            const uint32_t* paths = &_batch.active[first];
+            Ray rays[RayPacket::kMaxSize];
+            RayPacket packet;
+            for (size_t n = 0; n < count; n++) {
+                rays[n] = _batch.ray.Get(paths[n]);
+                packet.Add(rays[n], Interval(0.001, kInfinity), _batch.state[paths[n]].rng);
+            }
+            HitRecord records[RayPacket::kMaxSize];
+            bool hits[RayPacket::kMaxSize];
+            _world.HitPacket(packet, records, hits);
+            for (size_t n = 0; n < count; n++) {
+                uint32_t k = paths[n];
+                if (hits[n]) {
+                    _batch.record.Set(k, records[n]);
+                    _batch.hits.push_back(k);
+                } else {
+                    _batch.radiance.Add(k, _batch.throughput.Get(k) * _camera.BackgroundColor());
+                }
+            }
+        }
+    }
+
+    // SortByMaterial orders the hits by material id, paths of one material keep their order
+    void SortByMaterial() {
+        const std::vector<uint32_t>& material_id = _batch.record.material_id;
+        _batch.material_offsets.assign(_materials.Size() + 1, 0);
+        for (uint32_t k : _batch.hits) {
+            _batch.material_offsets[material_id[k] + 1]++;
+        }
+        for (size_t m = 1; m < _batch.material_offsets.size(); m++) {
+            _batch.material_offsets[m] += _batch.material_offsets[m-1];
+        }
+        _batch.sorted.resize(_batch.hits.size());
+        for (uint32_t k : _batch.hits) {
+            _batch.sorted[_batch.material_offsets[material_id[k]]++] = k;
+        }
+        _batch.hits.swap(_batch.sorted);
+    }
+
+    // Shade gathers the emission at the hits, samples the scattered directions and draws the light samples
+    void Shade() {
+        _batch.scattered.clear();
+        _batch.lit.clear();
+        for (uint32_t k : _batch.hits) {
+            HitRecord record = _batch.record.Get(k);
+            Ray ray = _batch.ray.Get(k);
+            const Material& material = _materials[record.material_id];
+            if (material.IsEmissive()) {
+                double weight = 1;
+                if (_batch.prev_scatter_pdf[k] > 0 && _lights.Contains(record.prim)) {
+                    double light_pdf = _lights.DirectionPdf(*record.prim, ray.GetEndpoint(), ray.GetDirection(),
+                                                            ray.GetTime());
+                    weight = PowerHeuristic(_batch.prev_scatter_pdf[k], light_pdf);
+                }
+                Color emitted = material.Emitted(record.u, record.v, record.hitpoint);
+                _batch.radiance.Add(k, _batch.throughput.Get(k) * emitted * weight);
+            }
+
+            _sampler.RestoreState(_batch.state[k]);
+            ScatterSample scatter;
+            if (!material.Sample(ray, record, scatter, _sampler)) {
+                continue;
+            }
+            LightSample light_sample;
+            if (!scatter.IsSpecular() && !_lights.Empty() &&
+                SampleLightDirection(_lights, ray, record, material, _sampler, light_sample)) {
+                _batch.light_sample.Set(k, light_sample);
+                _batch.lit.push_back(k);
+            }
+            _batch.state[k] = _sampler.SaveState();
+            _batch.scatter.Set(k, scatter);
+            _batch.scattered.push_back(k);
+        }
+    }
+
+    // Shadow traces the light samples and gathers the light of the unblocked ones
+    void Shadow() {
+        for (uint32_t k : _batch.lit) {
+            Color light = TraceLightSample(_batch.light_sample.Get(k), _world, _materials, _batch.state[k].rng);
+            _batch.radiance.Add(k, _batch.throughput.Get(k) * light);
+        }
+    }
+
+    // ShadowPackets Shadow with the occlusion tests of the shadow rays that reach their light done in packets
+    void ShadowPackets() {
+        for (uint32_t k : _batch.lit) {
+            LightSample sample = _batch.light_sample.Get(k);
+            if (LocateLightSample(sample, _materials, _batch.state[k].rng)) {
+                _batch.light_sample.Set(k, sample);
+                _batch.marked[k] = 1;
+            }
+        }
+        // the hits are sorted by material, in generation order the samples of a pixel share the packets
+        PickMarked(_batch.located);
+        for (size_t first = 0; first < _batch.located.size(); first += RayPacket::kMaxSize) {
+            size_t count = std::min(_batch.located.size() - first, static_cast<size_t>(RayPacket::kMaxSize));
+            const uint32_t* paths = &_batch.located[first];
+            LightSample samples[RayPacket::kMaxSize];
+            RayPacket packet;
+            for (size_t n = 0; n < count; n++) {
+                samples[n] = _batch.light_sample.Get(paths[n]);
+                packet.Add(samples[n].shadow, ShadowInterval(samples[n]), _batch.state[paths[n]].rng);
+            }
+            bool occluded[RayPacket::kMaxSize] = {};
+            _world.OccludedPacket(packet, occluded);
+            for (size_t n = 0; n < count; n++) {
+                uint32_t k = paths[n];
+                if (!occluded[n]) {
+                    _batch.radiance.Add(k, _batch.throughput.Get(k) * samples[n].light_color);
+                }
+            }
+        }
+    }
+
+    // Continue applies the scattering weights and Russian roulette, the surviving paths are extended next
+    void Continue(int depth) {
+        for (uint32_t k : _batch.scattered) {
+            _batch.prev_scatter_pdf[k] = _batch.scatter.pdf[k];
+            Color throughput = _batch.throughput.Get(k) * _batch.scatter.weight.Get(k);
+            if (depth >= kRouletteStartDepth) {
+                double q = RouletteSurvival(throughput);
+                _sampler.RestoreState(_batch.state[k]);
+                double u = _sampler.Get1D();
+                _batch.state[k] = _sampler.SaveState();
+                if (u >= q) {
+                    continue;
+                }
+                throughput = throughput / q;
+            }
+            _batch.throughput.Set(k, throughput);
+            _batch.ray.Set(k, _batch.scatter.scattered.Get(k));
+            _batch.marked[k] = 1;
+        }
+        // back to generation order, the rays of neighbouring samples tend to visit the same nodes
+        std::vector<uint32_t>& survivors = _batch.sorted;
+        PickMarked(survivors);
+        _batch.active.swap(survivors);
+    }
+
+    // PickMarked the marked active paths in generation order, clears their marks
+    void PickMarked(std::vector<uint32_t>& paths) {
+        paths.clear();
+        for (uint32_t k : _batch.active) {
+            if (_batch.marked[k]) {
+                _batch.marked[k] = 0;
+                paths.push_back(k);
+            }
+        }
+    }
+
+    const Camera& _camera;
+    const Hittable& _world;
+    const MaterialTable& _materials;
+    const LightList& _lights;
+    bool _ray_packets;
+    Sampler& _sampler;
+    PathBatch& _batch;
+    // Number of paths in the batch
+    size_t _size = 0;
+};
+
+} // namespace
+
+void RenderTileWavefront(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                         const LightList& lights, const Tile& tile, const std::function<int(int, int)>& num_samples,
+                         bool ray_packets, Sampler& sampler, Framebuffer& framebuffer) {
+    // the sample ranges are fixed up front, a pixel's samples may be spread over consecutive batches
+    std::vector<int> first_sample;
+    std::vector<int> sample_count;
+    for (int j = tile.y0; j < tile.y1; j++) {
+        for (int i = tile.x0; i < tile.x1; i++) {
+            first_sample.push_back(framebuffer.GetSampleCount(i, j));
+            sample_count.push_back(num_samples(i, j));
+        }
+    }
+
+    // the path arrays are allocated once per render thread
+    thread_local PathBatch batch;
+    WavefrontTracer tracer(camera, world, materials, lights, ray_packets, sampler, batch);
+    int tile_width = tile.x1 - tile.x0;
+    size_t pixel = 0;
+    int pixel_samples_done = 0;
+    while (pixel < sample_count.size()) {
+        while (pixel < sample_count.size() && tracer.Size() < kBatchSize) {
+            int count = std::min(sample_count[pixel] - pixel_samples_done, static_cast<int>(kBatchSize - tracer.Size()));
+            int i = tile.x0 + static_cast<int>(pixel % tile_width);
+            int j = tile.y0 + static_cast<int>(pixel / tile_width);
+            tracer.Generate(i, j, first_sample[pixel] + pixel_samples_done, count);
+            pixel_samples_done += count;
+            if (pixel_samples_done >= sample_count[pixel]) {
+                pixel++;
+                pixel_samples_done = 0;
+            }
+        }
+        tracer.Trace();
+        tracer.Flush(framebuffer);
+    }
+}
+
+} // namespace rabbit
+
+} // namespace gplay
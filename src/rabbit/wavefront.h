@@ -0,0 +1,36 @@
+#ifndef GPLAY_RABBIT_WAVEFRONT_H
+#define GPLAY_RABBIT_WAVEFRONT_H
+/*
+Wavefront path tracing - The paths of many samples advanced together, one stage at a time
+reference: https://research.nvidia.com/publication/2013-07_Megakernels-Considered-Harmful (Laine, Karras, Aila)
+A batch of paths keeps its state in structure of arrays form, every field in an array of its own with one entry
+per path. Every bounce runs each stage over the whole batch: extend (intersect all rays), emission, sort the hits
+by material, shade (sample the materials and draw the light samples), shadow (trace the light samples) and
+continue (Russian roulette). Shading runs material by material, so one material's code and textures stay in the
+caches and its branches are predictable.
+The camera rays of neighbouring samples and the shadow rays can be traced as RayPackets, see packet.h.
+Every path draws the same sampler dimensions in the same order as RayColor, both give identical images.
+*/
+
+#include <functional>
+#include "rabbit/camera.h"
+#include "rabbit/framebuffer.h"
+#include "rabbit/light.h"
+#include "rabbit/material.h"
+#include "rabbit/sampler.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+// RenderTileWavefront traces num_samples(i, j) more samples of every pixel i, j of tile, continuing each pixel's
+// sample sequence like RenderPixelSamples. With ray_packets the camera rays and the shadow rays are traced in packets.
+void RenderTileWavefront(const Camera& camera, const Hittable& world, const MaterialTable& materials,
+                         const LightList& lights, const Tile& tile, const std::function<int(int, int)>& num_samples,
+                         bool ray_packets, Sampler& sampler, Framebuffer& framebuffer);
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_WAVEFRONT_H
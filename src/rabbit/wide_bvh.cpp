@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cmath>
+
+#include "rabbit/wide_bvh.h"
+
+namespace gplay {
+
+namespace rabbit {
+
+namespace {
+
+double BinaryNodeSurfaceArea(const BVHLinearNode& node) {
+    double dx = static_cast<double>(node.bounds_max[0]) - node.bounds_min[0];
+    double dy = static_cast<double>(node.bounds_max[1]) - node.bounds_min[1];
+    double dz = static_cast<double>(node.bounds_max[2]) - node.bounds_min[2];
+    return 2 * (dx*dy + dy*dz + dz*dx);
+}
+
+// CollapseNode emits the wide node for binary node `binary_index` and its subtree, returns its index
+uint32_t CollapseNode(const std::vector<BVHLinearNode>& binary_nodes, uint32_t binary_index,
+                      double root_area, std::vector<BVH4Node>& nodes, BVH4Stats& stats) {
+    const BVHLinearNode& binary_node = binary_nodes[binary_index];
+    stats.expected_node_visits += root_area > 0 ? BinaryNodeSurfaceArea(binary_node) / root_area : 1.0;
+
+    // start from the two children and keep opening the largest interior child until four slots are used
+    uint32_t children[BVH4Node::kWidth];
+    int child_count = 0;
+    if (binary_node.IsLeaf()) {
+        children[child_count++] = binary_index;
+    } else {
+        children[child_count++] = binary_node.offset;
+        children[child_count++] = binary_node.offset + 1;
+    }
+    while (child_count < BVH4Node::kWidth) {
+        int best = -1;
+        double best_area = -1;
+        for (int k = 0; k < child_count; k++) {
+            const BVHLinearNode& child = binary_nodes[children[k]];
+            if (!child.IsLeaf() && BinaryNodeSurfaceArea(child) > best_area) {
+                best = k;
+                best_area = BinaryNodeSurfaceArea(child);
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        uint32_t first = binary_nodes[children[best]].offset;
+        children[best] = first;
+        children[child_count++] = first + 1;
+    }
+
+    uint32_t node_index = static_cast<uint32_t>(nodes.size());
+    nodes.emplace_back();
+    BVH4Node wide_node;
+    wide_node.child_count = child_count;
+    for (int k = 0; k < BVH4Node::kWidth; k++) {
+        for (int axis = 0; axis < 3; axis++) {
+            wide_node.bounds_min[axis][k] = std::numeric_limits<float>::infinity();
+            wide_node.bounds_max[axis][k] = -std::numeric_limits<float>::infinity();
+        }
+        wide_node.offset[k] = 0;
+        wide_node.prim_count[k] = 0;
+    }
+    for (int k = 0; k < child_count; k++) {
+        const BVHLinearNode& child = binary_nodes[children[k]];
+        for (int axis = 0; axis < 3; axis++) {
+            wide_node.bounds_min[axis][k] = child.bounds_min[axis];
+            wide_node.bounds_max[axis][k] = child.bounds_max[axis];
+        }
+        if (child.IsLeaf()) {
+            wide_node.offset[k] = child.offset;
+            wide_node.prim_count[k] = child.prim_count;
+            stats.leaf_count++;
+        } else {
+            wide_node.offset[k] = CollapseNode(binary_nodes, children[k], root_area, nodes, stats);
+        }
+    }
+    nodes[node_index] = wide_node;
+    return node_index;
+}
+
+} // namespace
+
+BVH4Ray::BVH4Ray(const Ray& r, double tmin) : tmin(static_cast<float>(tmin)) {
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = static_cast<float>(r.GetEndpoint()[axis]);
+        inv_dir[axis] = static_cast<float>(r.GetInvDirection()[axis]);
+        dir_is_neg[axis] = r.IsDirectionNegative(axis);
+        // The rounded origin is within half an ulp, one ulp (plus the smallest normal for values flushed to zero) bounds it.
+        // Moving the origin along the direction shortens the distance to a plane ahead, moving it back lengthens it.
+        // copysign keeps this branchless, a data dependent branch per axis costs more than a shadow ray traversal.
+        float error = std::copysign(std::fabs(origin) * (1.0f/(1 << 23)) + std::numeric_limits<float>::min(), inv_dir[axis]);
+        near_origin[axis] = origin + error;
+        far_origin[axis] = origin - error;
+    }
+}
+
+std::ostream& operator<<(std::ostream& out, const BVH4Stats& stats) {
+    out << "BVH4: " << stats.node_count << " nodes, " << stats.leaf_count << " leaves, "
+        << "per ray: " << stats.expected_node_visits << " node visits";
+    return out;
+}
+
+BVH4Stats CollapseBVH4(const std::vector<BVHLinearNode>& binary_nodes, std::vector<BVH4Node>& nodes) {
+    BVH4Stats stats;
+    nodes.clear();
+    if (binary_nodes.empty()) {
+        return stats;
+    }
+    // a binary tree of n nodes has (n+1)/2 leaves, every wide node holds at least two of them or is the root
+    nodes.reserve(binary_nodes.size() / 2 + 1);
+    CollapseNode(binary_nodes, 0, BinaryNodeSurfaceArea(binary_nodes[0]), nodes, stats);
+    stats.node_count = nodes.size();
+    return stats;
+}
+
+WideBVH::WideBVH(const HittableList& obj_list, const BVHBuildOptions& options)
+    : WideBVH(obj_list.objs, options) {}
+
+WideBVH::WideBVH(const std::vector<std::shared_ptr<Hittable>>& objects, const BVHBuildOptions& options) {
+    std::vector<AxisAlignedBoundingBox> prim_bounds;
+    prim_bounds.reserve(objects.size());
+    _bbox = AxisAlignedBoundingBox::empty;
+    for (const auto& obj : objects) {
+        prim_bounds.push_back(obj->GetBoundingBox());
+        _bbox = AxisAlignedBoundingBox(_bbox, prim_bounds.back());
+    }
+
+    std::vector<BVHLinearNode> binary_nodes;
+    std::vector<uint32_t> prim_order;
+    _build_stats = BuildLinearBVH(prim_bounds, options, binary_nodes, prim_order);
+    _wide_stats = CollapseBVH4(binary_nodes, _nodes);
+    // the wide tree keeps the leaves of the binary one
+    _primitives = LeafPrimitives(objects, prim_order, binary_nodes);
+}
+
+bool WideBVH::Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const {
+    bool is_hit = false;
+    double tmin = ray_time_interval.GetMin();
+    TraverseBVH4(_nodes, r, tmin, ray_time_interval.GetMax(), [&](uint32_t first, uint32_t count, double& closest) {
+        if (_primitives.IntersectLeaf(first, count, r, tmin, closest, info, rng)) {
+            is_hit = true;
+        }
+    });
+    return is_hit;
+}
+
+bool WideBVH::Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const {
+    return OccludedBVH4(_nodes, r, ray_time_interval.GetMin(), ray_time_interval.GetMax(),
+                        [&](uint32_t first, uint32_t count) {
+        return _primitives.OccludedLeaf(first, count, r, ray_time_interval, rng);
+    });
+}
+
+void WideBVH::CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const {
+    for (const auto& prim : _primitives.GetObjects()) {
+        prim->CollectLights(materials, lights);
+    }
+}
+
+int WideBVH::GetInstanceDepth() const {
+    int depth = 0;
+    for (const auto& prim : _primitives.GetObjects()) {
+        depth = std::max(depth, prim->GetInstanceDepth());
+    }
+    return depth;
+}
+
+AxisAlignedBoundingBox WideBVH::GetBoundingBox() const {
+    return _bbox;
+}
+
+} // namespace rabbit
+
+} // namespace gplay
@@ -0,0 +1,254 @@
+#ifndef GPLAY_RABBIT_WIDE_BVH_H
+#define GPLAY_RABBIT_WIDE_BVH_H
+/*
+Class WideBVH - A 4-wide Bounding Volume Hierarchy collapsed from the binary LinearBVH
+reference: https://www.embree.org/papers/2008-SPT-MultiBVH.pdf
+           https://pbr-book.org/4ed/Primitives_and_Intersection_Acceleration/Bounding_Volume_Hierarchies
+Every node stores the single precision boxes of its (up to) four children in SoA layout,
+so that one ray is tested against all of them at once with SSE. The hit children are then visited nearest first.
+Compared with the binary tree this roughly halves the number of traversal steps and node fetches.
+*/
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "rabbit/bvh.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace gplay {
+
+namespace rabbit {
+
+// BVH4Node a node of the 4-wide BVH, two cache lines
+struct alignas(16) BVH4Node {
+    static const int kWidth = 4;
+
+    // Child bounds per axis in SoA layout, rounded outwards; unused slots hold empty boxes
+    float bounds_min[3][kWidth];
+    float bounds_max[3][kWidth];
+    // Interior child: index of the child node
+    // Leaf child: index of the first primitive in the reordered primitive array
+    uint32_t offset[kWidth];
+    // Number of primitives of a leaf child, 0 for an interior child
+    uint16_t prim_count[kWidth];
+    // Number of used child slots
+    uint32_t child_count;
+};
+
+// Relative slack of the far distances, the subtraction, the rounded inverse direction and the product
+// each add a relative error of 2^-24 to a slab distance, 2^-20 covers both the near and the far one
+// as well as rounding tmin and the closest hit to float
+const float kBVH4FarSlack = 1.0f/(1 << 20);
+
+// WidenFar pushes a far distance (or the closest hit it is compared with) past its rounding error
+inline float WidenFar(float t) {
+    return t + std::fabs(t) * kBVH4FarSlack;
+}
+
+// BVH4Ray single precision copy of a ray prepared for the BVH4Node slab tests
+// The origin is moved outwards per plane by its rounding error, so the float intervals contain the double precision ones
+class BVH4Ray {
+public:
+    BVH4Ray(const Ray& r, double tmin);
+
+    // Origin moved so that the distances to the near planes can only shrink
+    float near_origin[3];
+    // Origin moved so that the distances to the far planes can only grow
+    float far_origin[3];
+    float inv_dir[3];
+    // Whether the direction is negative along each axis, selects the near and far planes
+    int dir_is_neg[3];
+    float tmin;
+};
+
+// IntersectBVH4Node tests the ray against all child boxes of node within [ray.tmin, tmax]
+// tmax is expected to be widened already, see WidenFar
+// Returns the bit mask of the children hit and stores their entry distances in tnear
+inline int IntersectBVH4Node(const BVH4Node& node, const BVH4Ray& ray, float tmax, float tnear[BVH4Node::kWidth]) {
+#if defined(__SSE2__)
+    __m128 near_t = _mm_set1_ps(ray.tmin);
+    __m128 far_t = _mm_set1_ps(tmax);
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 far_slack = _mm_set1_ps(kBVH4FarSlack);
+    for (int axis = 0; axis < 3; axis++) {
+        const float* near_plane = ray.dir_is_neg[axis] ? node.bounds_max[axis] : node.bounds_min[axis];
+        const float* far_plane = ray.dir_is_neg[axis] ? node.bounds_min[axis] : node.bounds_max[axis];
+        __m128 inv_dir = _mm_set1_ps(ray.inv_dir[axis]);
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(near_plane), _mm_set1_ps(ray.near_origin[axis])), inv_dir);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(far_plane), _mm_set1_ps(ray.far_origin[axis])), inv_dir);
+        t1 = _mm_add_ps(t1, _mm_mul_ps(_mm_andnot_ps(sign_mask, t1), far_slack));
+        // max/min return their second operand for NaN (0 * inf), so a degenerate axis leaves the interval unchanged
+        near_t = _mm_max_ps(t0, near_t);
+        far_t = _mm_min_ps(t1, far_t);
+    }
+    _mm_storeu_ps(tnear, near_t);
+    int mask = _mm_movemask_ps(_mm_cmple_ps(near_t, far_t));
+#else
+    int mask = 0;
+    for (int k = 0; k < BVH4Node::kWidth; k++) {
+        float near_t = ray.tmin;
+        float far_t = tmax;
+        for (int axis = 0; axis < 3; axis++) {
+            float near_plane = ray.dir_is_neg[axis] ? node.bounds_max[axis][k] : node.bounds_min[axis][k];
+            float far_plane = ray.dir_is_neg[axis] ? node.bounds_min[axis][k] : node.bounds_max[axis][k];
+            float t0 = (near_plane - ray.near_origin[axis]) * ray.inv_dir[axis];
+            float t1 = WidenFar((far_plane - ray.far_origin[axis]) * ray.inv_dir[axis]);
+            near_t = t0 > near_t ? t0 : near_t;
+            far_t = t1 < far_t ? t1 : far_t;
+        }
+        tnear[k] = near_t;
+        mask |= (near_t <= far_t) << k;
+    }
+#endif
+    return mask & ((1 << node.child_count) - 1);
+}
+
+// BVH4Stats summary of a collapsed tree
+class BVH4Stats {
+public:
+    size_t node_count = 0;
+    size_t leaf_count = 0;
+    // Expected number of 4-wide node tests per ray that hits the root bounds
+    double expected_node_visits = 0;
+};
+
+std::ostream& operator<<(std::ostream& out, const BVH4Stats& stats);
+
+// CollapseBVH4 builds the 4-wide tree of a binary tree made by BuildLinearBVH, leaves keep their primitive ranges
+BVH4Stats CollapseBVH4(const std::vector<BVHLinearNode>& binary_nodes, std::vector<BVH4Node>& nodes);
+
+// TraverseBVH4 visits the leaves of the tree hit by the ray in [tmin, closest], nearest first
+// intersect_leaf(first, count, closest) tests a primitive range and shrinks closest on a hit
+template <typename LeafFn>
+void TraverseBVH4(const std::vector<BVH4Node>& nodes, const Ray& r, double tmin, double closest, LeafFn&& intersect_leaf) {
+    if (nodes.empty()) {
+        return;
+    }
+
+    struct StackEntry {
+        uint32_t offset;
+        uint32_t prim_count;
+        float tnear;
+    };
+    // every node pushes at most three entries more than it pops, and the binary tree is shallower than the stack size
+    StackEntry stack[3*kBVHTraversalStackSize + BVH4Node::kWidth];
+    int stack_size = 0;
+    stack[stack_size++] = StackEntry{0, 0, -std::numeric_limits<float>::infinity()};
+
+    BVH4Ray ray(r, tmin);
+    // The entry distances carry the same rounding error as the far ones, compare them with the widened closest hit
+    float closest_bound = WidenFar(static_cast<float>(closest));
+    while (stack_size > 0) {
+        StackEntry entry = stack[--stack_size];
+        if (entry.tnear > closest_bound) {
+            continue;
+        }
+        if (entry.prim_count > 0) {
+            intersect_leaf(entry.offset, entry.prim_count, closest);
+            closest_bound = WidenFar(static_cast<float>(closest));
+            continue;
+        }
+
+        const BVH4Node& node = nodes[entry.offset];
+        float tnear[BVH4Node::kWidth];
+        int mask = IntersectBVH4Node(node, ray, closest_bound, tnear);
+
+        // push the hit children farthest first, so that the nearest one is popped next
+        StackEntry hits[BVH4Node::kWidth];
+        int hit_count = 0;
+        for (int k = 0; k < BVH4Node::kWidth; k++) {
+            if (mask & (1 << k)) {
+                StackEntry child{node.offset[k], node.prim_count[k], tnear[k]};
+                int pos = hit_count++;
+                while (pos > 0 && hits[pos-1].tnear < child.tnear) {
+                    hits[pos] = hits[pos-1];
+                    pos--;
+                }
+                hits[pos] = child;
+            }
+        }
+        for (int k = 0; k < hit_count; k++) {
+            stack[stack_size++] = hits[k];
+        }
+    }
+}
+
+// OccludedBVH4 returns whether any leaf range hit by the ray in [tmin, tmax] reports an intersection
+// Children are not sorted, the first leaf with occluded(first, count) true ends the traversal
+template <typename LeafFn>
+bool OccludedBVH4(const std::vector<BVH4Node>& nodes, const Ray& r, double tmin, double tmax, LeafFn&& occluded) {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    uint32_t stack[3*kBVHTraversalStackSize + BVH4Node::kWidth];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    BVH4Ray ray(r, tmin);
+    float tmax_bound = WidenFar(static_cast<float>(tmax));
+    while (stack_size > 0) {
+        const BVH4Node& node = nodes[stack[--stack_size]];
+        float tnear[BVH4Node::kWidth];
+        int mask = IntersectBVH4Node(node, ray, tmax_bound, tnear);
+        for (int k = 0; k < BVH4Node::kWidth; k++) {
+            if (!(mask & (1 << k))) {
+                continue;
+            }
+            if (node.prim_count[k] == 0) {
+                stack[stack_size++] = node.offset[k];
+            } else if (occluded(node.offset[k], node.prim_count[k])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+class WideBVH : public Hittable {
+public:
+    WideBVH(const HittableList& obj_list, const BVHBuildOptions& options = BVHBuildOptions());
+
+    WideBVH(const std::vector<std::shared_ptr<Hittable>>& objects, const BVHBuildOptions& options = BVHBuildOptions());
+
+    // Intersect respond to the query "does this ray hit you?" with the closest primitive hit
+    bool Intersect(const Ray& r, Interval ray_time_interval, HitInfo& info, RandomStream& rng) const override;
+
+    // Occluded any-hit traversal, children are visited in storage order and the first intersection ends the query
+    bool Occluded(const Ray& r, Interval ray_time_interval, RandomStream& rng) const override;
+
+    void CollectLights(const MaterialTable& materials, std::vector<const Hittable*>& lights) const override;
+
+    int GetInstanceDepth() const override;
+
+    // GetBoundingBox ...
+    AxisAlignedBoundingBox GetBoundingBox() const override;
+
+    // GetBuildStats returns the statistics of the binary tree the wide tree was collapsed from
+    inline const BVHBuildStats& GetBuildStats() const {
+        return _build_stats;
+    }
+
+    // GetWideStats returns node count and expected traversal steps of the wide tree
+    inline const BVH4Stats& GetWideStats() const {
+        return _wide_stats;
+    }
+
+private:
+    std::vector<BVH4Node> _nodes;
+    BVHBuildStats _build_stats;
+    BVH4Stats _wide_stats;
+    // Primitives reordered so that each leaf covers a contiguous range
+    LeafPrimitives _primitives;
+    AxisAlignedBoundingBox _bbox;
+};
+
+} // namespace rabbit
+
+} // namespace gplay
+
+#endif // GPLAY_RABBIT_WIDE_BVH_H
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "rabbit/bvh.h"
+#include "rabbit/wide_bvh.h"
+#include "rabbit/object.h"
+
+using namespace gplay::rabbit;
+
+// Random spheres and quadrilaterals, so that the BVH leaves mix primitive types and block leaves with an odd count
+// sit next to leaves whose spheres and quads are traced one by one
+std::vector<std::shared_ptr<Hittable>> MakeMixedObjects(RandomStream& rng) {
+    std::vector<std::shared_ptr<Hittable>> objects;
+    for (uint32_t n = 0; n < 400; n++) {
+        Point3 p(10 * RandomDouble(rng), 10 * RandomDouble(rng), 10 * RandomDouble(rng));
+        if (RandomDouble(rng) < 0.5) {
+            objects.push_back(std::make_shared<Sphere>(p, 0.1 + 0.3 * RandomDouble(rng), n));
+        } else {
+            Vec3 u = RandomVec3(rng) * 0.6 - Vec3(0.3, 0.3, 0.3);
+            Vec3 v = RandomVec3(rng) * 0.6 - Vec3(0.3, 0.3, 0.3);
+            objects.push_back(std::make_shared<Quadrilateral>(p, u, v, n));
+        }
+    }
+    return objects;
+}
+
+// CountMismatches rays whose closest hit through bvh differs from the one of the plain list
+int CountMismatches(const Hittable& bvh, const HittableList& list, int num_rays) {
+    RandomStream ray_rng(11, 0);
+    RandomStream rng(0, 0);
+    int mismatches = 0;
+    for (int n = 0; n < num_rays; n++) {
+        Point3 origin(RandomDouble(ray_rng, -2, 12), RandomDouble(ray_rng, -2, 12), RandomDouble(ray_rng, -2, 12));
+        Vec3 direction = RandomVec3(ray_rng) * 2 - Vec3(1, 1, 1);
+        Ray r(origin, direction);
+        HitRecord expected;
+        HitRecord found;
+        bool expected_hit = list.Hit(r, Interval(0.001, kInfinity), expected, rng);
+        bool found_hit = bvh.Hit(r, Interval(0.001, kInfinity), found, rng);
+        if (expected_hit != found_hit ||
+            (expected_hit && (expected.t != found.t || expected.material_id != found.material_id))) {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+int main() {
+    RandomStream rng(7, 0);
+    std::vector<std::shared_ptr<Hittable>> objects = MakeMixedObjects(rng);
+    HittableList list;
+    for (const auto& obj : objects) {
+        list.AddObject(obj);
+    }
+
+    const int kNumRays = 200000;
+    int failures = 0;
+    const BVHSplitMethod methods[] = { BVHSplitMethod::kMedian, BVHSplitMethod::kSAH, BVHSplitMethod::kLBVH };
+    const char* method_names[] = { "median", "SAH", "LBVH" };
+    for (int m = 0; m < 3; m++) {
+        BVHBuildOptions options;
+        options.split_method = methods[m];
+        int linear_mismatches = CountMismatches(LinearBVH(objects, options), list, kNumRays);
+        int wide_mismatches = CountMismatches(WideBVH(objects, options), list, kNumRays);
+        std::cout << method_names[m] << ": LinearBVH " << linear_mismatches << ", WideBVH " << wide_mismatches
+                  << " of " << kNumRays << " rays differ from the HittableList\n";
+        failures += linear_mismatches + wide_mismatches;
+    }
+    return failures == 0 ? 0 : 1;
+}